@@ -0,0 +1,250 @@
+#include "chessboard.h"
+#include <benchmark/benchmark.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Fixed corpus of realistic positions. Castling and en passant are not
+// modelled by the rules, so only piece placement and side to move matter.
+struct CorpusPosition {
+    const char *name;
+    const char *fen;
+};
+
+static const CorpusPosition corpus[] = {
+    {"start", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w"},
+    {"italian", "r1bq1rk1/pppp1ppp/2n2n2/2b1p3/2B1P3/2NP1N2/PPP2PPP/R1BQ1RK1 w"},
+    {"queens_gambit", "r1bq1rk1/pp1nbppp/2p1pn2/3p2B1/2PP4/2NBPN2/PP3PPP/R2QK2R w"},
+    {"sicilian", "r1b1kb1r/1pqp1ppp/p1n1pn2/8/3NP3/2N1B3/PPP1BPPP/R2QK2R b"},
+    {"open_middlegame", "2rq1rk1/pb2bppp/1pn1pn2/2pp4/3P4/1PNBPN2/PB3PPP/2RQ1RK1 w"},
+    {"rook_endgame", "8/5k2/4p3/1p1pPp2/pP1P1P2/P3K3/8/2R2r2 w"},
+    {"pawn_endgame", "8/5k2/3p4/1p1Pp2p/pP2Pp1P/P4P1K/8/8 b"},
+    {"queen_vs_king", "8/8/8/3k4/8/8/2Q5/K7 w"},
+    {"back_rank_mate", "3R2k1/5ppp/8/8/8/8/5PPP/6K1 b"},
+};
+static const int corpus_size = sizeof(corpus) / sizeof(corpus[0]);
+
+static void load(int index, Chessboard &board, char &turn)
+{
+    if (!boardFromFen(corpus[index].fen, board, turn))
+    {
+        abort();
+    }
+}
+
+// Every (from, to) pair of the side to move whose source is `type`, legal or not,
+// across the corpus: the input a server sees from clients dragging pieces around
+struct MoveCase {
+    int position;
+    int move[4];
+};
+
+static std::vector<MoveCase> candidate_moves(char type)
+{
+    std::vector<MoveCase> cases;
+    for (int i = 0; i < corpus_size; i++)
+    {
+        Chessboard board;
+        char turn;
+        load(i, board, turn);
+        for (int y1 = 0; y1 < 8; y1++)
+            for (int x1 = 0; x1 < 8; x1++)
+            {
+                if (board[y1][x1].type != type || board[y1][x1].color != turn) continue;
+                for (int y2 = 0; y2 < 8; y2++)
+                    for (int x2 = 0; x2 < 8; x2++)
+                        cases.push_back({i, {x1, y1, x2, y2}});
+            }
+    }
+    return cases;
+}
+
+static const char piece_types[] = {'p', 'k', 'b', 'r', 'q', 'K'};
+static const char *piece_names[] = {"pawn", "knight", "bishop", "rook", "queen", "king"};
+
+static void BM_CanMove(benchmark::State &state)
+{
+    std::vector<MoveCase> cases = candidate_moves(piece_types[state.range(0)]);
+    std::vector<Chessboard> boards(corpus_size);
+    std::vector<char> turns(corpus_size);
+    for (int i = 0; i < corpus_size; i++)
+    {
+        load(i, boards[i], turns[i]);
+    }
+
+    size_t next = 0;
+    for (auto _ : state)
+    {
+        // can_move applies legal moves, so validate against a scratch copy
+        const MoveCase &c = cases[next];
+        Chessboard board = boards[c.position];
+        int move[4];
+        memcpy(move, c.move, sizeof(move));
+        benchmark::DoNotOptimize(can_move(board, move, turns[c.position]));
+        next = (next + 1 == cases.size()) ? 0 : next + 1;
+    }
+    state.SetLabel(piece_names[state.range(0)]);
+}
+BENCHMARK(BM_CanMove)->DenseRange(0, 5);
+
+// Benchmarks over single corpus positions, labelled with the position name
+#define CORPUS_BENCHMARK(fn) BENCHMARK(fn)->DenseRange(0, corpus_size - 1)
+
+static void BM_KingPosition(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    int king_pos[2];
+    for (auto _ : state)
+    {
+        king_position(board, turn, king_pos);
+        benchmark::DoNotOptimize(king_pos);
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_KingPosition);
+
+static void BM_Check(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    int king_pos[2];
+    king_position(board, turn, king_pos);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(check(board, turn, king_pos));
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_Check);
+
+static void BM_Checkmate(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    int king_pos[2];
+    king_position(board, turn, king_pos);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(checkmate(board, turn, king_pos));
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_Checkmate);
+
+static void BM_Stalemate(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    int king_pos[2];
+    king_position(board, turn, king_pos);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(stalemate(board, turn, king_pos));
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_Stalemate);
+
+static void BM_GameDecider(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(gameDecider(board, turn));
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_GameDecider);
+
+static void BM_LegalMoves(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    int moves[256][4];
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(legal_moves(board, turn, moves, 256));
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_LegalMoves);
+
+static void BM_LegalMoveSet(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    LegalMoves legal;
+    for (auto _ : state)
+    {
+        legal_move_set(board, turn, legal);
+        benchmark::DoNotOptimize(legal);
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_LegalMoveSet);
+
+static void BM_SerializeChessboard(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    int data[128];
+    for (auto _ : state)
+    {
+        serializeChessboard(board, data);
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_SerializeChessboard);
+
+static void BM_DeserializeChessboard(benchmark::State &state)
+{
+    Chessboard board;
+    char turn;
+    load(state.range(0), board, turn);
+    int data[128];
+    serializeChessboard(board, data);
+    for (auto _ : state)
+    {
+        deserializeChessboard(data, board);
+        benchmark::DoNotOptimize(board);
+    }
+    state.SetLabel(corpus[state.range(0)].name);
+}
+CORPUS_BENCHMARK(BM_DeserializeChessboard);
+
+int main(int argc, char **argv)
+{
+    // Report JSON unless a format was asked for explicitly
+    std::vector<char *> args(argv, argv + argc);
+    bool has_format = false;
+    for (int i = 1; i < argc; i++)
+    {
+        has_format |= strncmp(argv[i], "--benchmark_format", 18) == 0;
+    }
+    static char json_format[] = "--benchmark_format=json";
+    if (!has_format)
+    {
+        args.push_back(json_format);
+    }
+    int count = (int)args.size();
+
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,25 @@
+# Writes the files in INPUTS into OUTPUT as byte arrays, listed in embedded_assets[].
+# Each asset is named after its file without the extension.
+# Usage: cmake -DOUTPUT=<file.cpp> -DINPUTS=<a.png|b.png> -P embed_assets.cmake
+# (inputs are separated with '|' so the list survives the custom command)
+
+string(REPLACE "|" ";" INPUTS "${INPUTS}")
+
+set(source "// Generated by cmake/embed_assets.cmake, do not edit\n#include \"assets.h\"\n\n")
+set(table "")
+set(index 0)
+foreach(input ${INPUTS})
+    get_filename_component(name ${input} NAME_WE)
+    file(READ ${input} hex HEX)
+    string(LENGTH "${hex}" length)
+    math(EXPR size "${length} / 2")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    string(REGEX REPLACE "((0x..,){32})" "\\1\n    " bytes "${bytes}")
+    string(APPEND source "static const unsigned char asset_${index}[${size}] = {\n    ${bytes}\n};\n\n")
+    string(APPEND table "    {\"${name}\", asset_${index}, ${size}},\n")
+    math(EXPR index "${index} + 1")
+endforeach()
+
+string(APPEND source "const EmbeddedAsset embedded_assets[] = {\n${table}};\n")
+string(APPEND source "const size_t embedded_asset_count = ${index};\n")
+file(WRITE ${OUTPUT} "${source}")
@@ -0,0 +1,63 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Position analysis service.
+//
+// A peer sends REQUEST_ANALYSIS on the attach port and keeps the connection
+// open. Every query carries a position in the serializeChessboard() format
+// and a depth; the reply carries the best move found and its score. Many
+// queries may be outstanding on one connection, replies come back as they
+// finish and are matched by the tag the client chose.
+//
+// One hub thread owns all analysis connections. It answers queries it has
+// a result for from a cache keyed by position, joins a query to a job
+// already queued or running for the same position at the same or greater
+// depth, and hands the remaining ones over to the workers a batch at a time.
+// Workers take the highest priority job first and run at a lower
+// scheduling priority than the game threads, so analysis load does not
+// show in move latency. A job whose every query was cancelled, or whose
+// connections all closed, is stopped where it is.
+
+#define ANALYSIS_QUERY 'q'     // Followed by an AnalysisQuery
+#define ANALYSIS_CANCEL 'x'    // Followed by the uint32_t tag of a query
+
+#define ANALYSIS_DONE 'A'      // Reply statuses
+#define ANALYSIS_CANCELLED 'x'
+#define ANALYSIS_REJECTED 'e'  // Malformed query or too many outstanding
+
+#define ANALYSIS_MAX_DEPTH 8
+#define ANALYSIS_MAX_NODES 2000000 // Per job, the reply tells the depth completed
+#define ANALYSIS_MAX_PENDING 256   // Outstanding queries per connection
+#define ANALYSIS_CACHE_ENTRIES 16384
+#define ANALYSIS_NICE 10           // Added to the workers' nice value
+
+#pragma pack(push, 1)
+struct AnalysisQuery {
+    uint32_t tag;          // Chosen by the client, echoed in the reply
+    uint8_t depth;         // 1 to ANALYSIS_MAX_DEPTH
+    uint8_t priority;      // Higher runs first
+    char turn;             // Side to move
+    uint8_t unused;
+    int32_t board[128];    // serializeChessboard()
+};
+
+struct AnalysisReply {
+    char status;
+    uint8_t depth;         // Completed depth
+    uint16_t move;         // pack_move() of the best move, 0 when there is none
+    uint32_t tag;
+    int32_t score;         // Centipawns for the side to move, see SEARCH_MATE
+    uint32_t nodes;
+};
+#pragma pack(pop)
+
+// Starts the hub and `workers` analysis threads
+bool analysis_start(int workers);
+// Hands a connection that sent REQUEST_ANALYSIS to the hub
+bool analysis_serve(int socket);
+size_t analysis_queue_length();
+
+#endif // ANALYSIS_H
@@ -0,0 +1,16 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <stddef.h>
+
+// Files compiled into the binary by cmake/embed_assets.cmake
+struct EmbeddedAsset {
+    const char *name; // File name without directory and extension
+    const unsigned char *data;
+    size_t size;
+};
+
+extern const EmbeddedAsset embedded_assets[];
+extern const size_t embedded_asset_count;
+
+#endif // ASSETS_H
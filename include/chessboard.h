@@ -1,9 +1,10 @@
 #ifndef CHESSBOARD_H
 #define CHESSBOARD_H
 
-#include <vector>
+#include <array>
 #include <cstring>
 #include <stdlib.h>
+#include <stdint.h>
 
 
 // Struktura reprezentująca pionek
@@ -15,9 +16,18 @@ struct Piece {
 };
 
 
-using Chessboard = std::vector<std::vector<Piece>>;
+// Plansza trzymana w miejscu (8x8 = 128 bajtów), bez alokacji na stercie
+using Chessboard = std::array<std::array<Piece, 8>, 8>;
 Chessboard initializeBoard();
 Chessboard initializeEndgameBoard();
+bool boardFromFen(const char *fen, Chessboard &board, char &turn); // Load piece placement and side to move from FEN
+#define FEN_SIZE 76 // Placement, side to move and the terminator
+void boardToFen(const Chessboard &board, char turn, char fen[FEN_SIZE]); // Inverse of boardFromFen
+#define UCI_MOVE_SIZE 6 // e7e8q and the terminator
+// Coordinate notation of a move on `board`. The rules here have no promotion,
+// but a pawn reaching the last rank is written as promoting to a queen so
+// UCI tools accept the move.
+void moveToUci(const Chessboard &board, const int move[4], char text[UCI_MOVE_SIZE]);
 
 void serializeChessboard(const Chessboard& board, int data[128]);
 void deserializeChessboard(const int data[128], Chessboard& board);
@@ -33,5 +43,22 @@ bool can_king_move(const Chessboard &board, const int move[4]);   // Check if a
 bool stalemate(Chessboard &board, char turn, int king_pos[]);
 bool checkmate(Chessboard &board, char turn, int king_pos[]);
 void king_position(Chessboard &board, char turn, int king_pos[]);
+int legal_moves(const Chessboard &board, char turn, int moves[][4], int max_moves); // Collect all legal moves of a side
+
+// Legal moves of one side as bitsets, squares are numbered y * 8 + x.
+// `from` marks the squares with a movable piece; targets[i] holds the
+// destinations of the i-th such square in ascending order. A side never
+// has more than 16 pieces, so the set has a fixed size and is sent as is.
+struct LegalMoves {
+    uint64_t from;
+    uint64_t targets[16];
+};
+void legal_move_set(const Chessboard &board, char turn, LegalMoves &legal);
+uint64_t legal_targets(const LegalMoves &legal, int x, int y); // Destinations of the piece on (x, y)
+bool legal_move_allowed(const LegalMoves &legal, const int move[4]); // Bit test, also rejects out of range squares
+
+// Zobrist hash of the piece placement and the side to move. The keys come
+// from a fixed seed, so hashes are stable across runs and machines.
+uint64_t position_hash(const Chessboard &board, char turn);
 
 #endif // CHESSBOARD_H
@@ -0,0 +1,60 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <atomic>
+#include <stdint.h>
+
+// Log-linear latency histogram in the spirit of HdrHistogram: every power
+// of two is split into 32 linear sub-buckets, so any recorded value is
+// reported within ~3% of its true value. Values are clamped below 2^40
+// (about 18 minutes in nanoseconds) to keep a histogram under 10 KiB.
+//
+// A histogram has a single writer. Counters are relaxed atomics, so other
+// threads may read or merge it at any time without locking the writer.
+
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct LatencyHistogram {
+    std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> max;
+};
+
+void histogram_reset(LatencyHistogram &h);
+// Adds all values of `src` to `dst`; `dst` must not have another writer
+void histogram_merge(LatencyHistogram &dst, const LatencyHistogram &src);
+// Smallest recorded value such that `percentile` percent of values are not larger
+uint64_t histogram_percentile(const LatencyHistogram &h, double percentile);
+uint64_t histogram_count(const LatencyHistogram &h);
+
+inline int histogram_bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+// Records one value; only the owning thread may call this
+inline void histogram_record(LatencyHistogram &h, uint64_t value)
+{
+    if (value >> HISTOGRAM_MAX_BITS)
+    {
+        value = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+    }
+    std::atomic<uint64_t> &bucket = h.counts[histogram_bucket(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.total.store(h.total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (value > h.max.load(std::memory_order_relaxed))
+    {
+        h.max.store(value, std::memory_order_relaxed);
+    }
+}
+
+#endif // HISTOGRAM_H
@@ -9,10 +9,41 @@
 
 #include "chessboard.h"
 
+#define WINDOW_SIZE 800 // Rozmiar okna w pikselach
+#define FRAME_LIMIT 60  // Maksymalna liczba klatek na sekundę
+
+// Where each image sits inside the atlas
+struct AtlasLayout {
+    sf::IntRect boardRect;      // Board image
+    sf::IntRect pieceRects[12]; // White then black: pawn, knight, bishop, rook, queen, king
+    sf::IntRect whiteRect;      // Opaque white texels used to draw tinted squares
+};
+
+// Decoded atlas pixels. Building it needs no window, so it can run on
+// another thread while the client connects.
+struct AtlasImage {
+    sf::Image image;
+    AtlasLayout layout;
+};
+
+// Board renderer kept between frames: one atlas texture holding the board
+// and all pieces, and one vertex array drawn with a single draw call. The
+// vertices are rebuilt only when the position or the highlight changes.
+struct BoardView {
+    sf::Texture atlas;
+    AtlasLayout layout;
+    sf::VertexArray vertices;   // Quads: board, highlighted squares, pieces
+};
+
 // Funkcja do inicjalizacji okna
 void window_init(sf::RenderWindow& window);
-void load_pieces(std::map<std::string, sf::Texture>& pieceTextures, sf::Texture& chessboardTexture);
-void window_display(sf::RenderWindow& window, const std::map<std::string, sf::Texture>& pieceTextures, const sf::Texture& chessboardTexture, Chessboard board, char side);
-sf::Vector2i pixelToGrid(sf::Vector2i pixelPos); 
+// Decodes the images embedded in the binary and packs them into one image
+bool atlas_build(AtlasImage& atlas);
+// Uploads the atlas to the GPU, needs the window's context
+bool board_view_load(BoardView& view, const AtlasImage& atlas);
+// Rebuilds the vertices; `highlight` marks squares (y * 8 + x, board coordinates) to tint
+void board_view_update(BoardView& view, const Chessboard& board, char side, uint64_t highlight);
+void board_view_draw(sf::RenderWindow& window, const BoardView& view);
+sf::Vector2i pixelToGrid(sf::Vector2i pixelPos);
 
 #endif // DISPLAY_H
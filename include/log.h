@@ -0,0 +1,79 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <stdint.h>
+#include <type_traits>
+
+// Asynchronous logger for latency-sensitive threads.
+//
+// A log call copies the format pointer and up to LOG_MAX_ARGS arguments
+// into a fixed-size record on the calling thread's single-producer ring.
+// It never formats, locks or blocks. A background thread drains all
+// rings, formats the records and writes them in batches. When a ring is
+// full, or a thread exceeds LOG_RATE_PER_SEC, records are dropped and
+// counted instead of stalling the caller.
+//
+// Format strings and %s arguments must be string literals: only their
+// pointers are stored.
+
+#define LOG_MAX_ARGS 6
+#define LOG_RING_SIZE 256     // Records per thread, power of two
+#define LOG_RATE_PER_SEC 1000 // Sustained records per second per thread, with an equal burst
+
+enum LogLevel { LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR };
+
+union LogArg {
+    long long i;
+    unsigned long long u;
+    double d;
+    const char *s;
+};
+
+struct LogRecord {
+    uint64_t time_ns;
+    const char *format;
+    uint8_t level;
+    uint8_t arg_count;
+    LogArg args[LOG_MAX_ARGS];
+};
+
+// Starts the writer thread; records below `min_level` are discarded at the call site
+bool log_start(LogLevel min_level, int fd);
+// Writes everything logged so far; used before exiting
+void log_flush();
+
+extern std::atomic<int> log_min_level;
+void log_push(LogLevel level, const char *format, const LogArg *args, int arg_count);
+
+inline LogArg log_arg(const char *value) { LogArg a; a.s = value; return a; }
+inline LogArg log_arg(double value) { LogArg a; a.d = value; return a; }
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, LogArg>::type log_arg(T value)
+{
+    LogArg a;
+    if (std::is_signed<T>::value)
+        a.i = (long long)value;
+    else
+        a.u = (unsigned long long)value;
+    return a;
+}
+
+template <typename... Args>
+inline void log_write(LogLevel level, const char *format, Args... args)
+{
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    if (level < log_min_level.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    LogArg packed[sizeof...(Args) + 1] = {log_arg(args)...};
+    log_push(level, format, packed, (int)sizeof...(Args));
+}
+
+#define log_debug(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) log_write(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif // LOG_H
@@ -0,0 +1,112 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "histogram.h"
+
+// Server metrics. Every thread writes to its own block of counters and
+// histograms with relaxed atomic stores, so recording an event costs a
+// few nanoseconds and never takes a lock. Blocks are summed only when the
+// stats endpoint is scraped. A block is handed to the next new thread
+// when its owner exits, so memory follows the peak thread count and no
+// counts are lost.
+
+enum MetricCounter {
+    METRIC_ACCEPTS,           // Player connections accepted
+    METRIC_SESSIONS_STARTED,
+    METRIC_SESSIONS_REJECTED, // Session pool was full
+    METRIC_MOVES_RECEIVED,
+    METRIC_MOVES_VALIDATED,   // Moves accepted by can_move
+    METRIC_MOVES_REJECTED,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_SPECTATORS_JOINED,
+    METRIC_SPECTATORS_DROPPED, // Too slow to keep up
+    METRIC_SESSIONS_RESUMED,   // Players reattached after their connection dropped
+    METRIC_POSITION_CACHE_HITS,   // Positions whose rules evaluation came from the cache
+    METRIC_POSITION_CACHE_MISSES,
+    METRIC_ANALYSIS_REQUESTS,
+    METRIC_ANALYSIS_CACHED,    // Answered from the analysis result cache
+    METRIC_ANALYSIS_COALESCED, // Joined a job already queued or running for the position
+    METRIC_ANALYSIS_CANCELLED,
+    METRIC_MUX_CONNECTIONS,    // Multiplexed connections accepted
+    METRIC_MUX_FRAMES_REPLACED, // Frames overwritten by a newer one before their connection read them
+    METRIC_COUNTERS
+};
+
+enum DisconnectReason {
+    DISCONNECT_CHECKMATE,
+    DISCONNECT_STALEMATE,
+    DISCONNECT_PEER_CLOSED, // A player's connection closed
+    DISCONNECT_RESIGNED,    // A player left through the window close message
+    DISCONNECT_ERROR,
+    DISCONNECT_TIME_FORFEIT, // The side to move ran out of time
+    DISCONNECT_IDLE,         // No move within the idle timeout
+    DISCONNECT_REASONS
+};
+
+enum MetricTimer {
+    TIMER_CAN_MOVE,
+    TIMER_GAME_DECIDER,
+    TIMER_ANALYSIS,           // One analysis job's search
+    METRIC_TIMERS
+};
+
+struct ThreadMetrics {
+    std::atomic<uint64_t> counters[METRIC_COUNTERS];
+    std::atomic<uint64_t> disconnects[DISCONNECT_REASONS];
+    LatencyHistogram timers[METRIC_TIMERS]; // Nanoseconds
+    bool in_use;
+    ThreadMetrics *next;
+};
+
+// Gauges read at scrape time, such as active sessions, appended by the caller
+typedef void (*MetricsGaugeFn)(FILE *out);
+
+// Serves the plain-text stats on 127.0.0.1:port from a background thread
+bool metrics_serve(int port, MetricsGaugeFn gauges);
+// Label used for the reason in the stats, e.g. "checkmate"
+const char *disconnect_reason_name(DisconnectReason reason);
+
+ThreadMetrics *metrics_acquire();
+extern thread_local ThreadMetrics *metrics_tls;
+
+// Metrics block of the calling thread
+inline ThreadMetrics &metrics_local()
+{
+    if (!metrics_tls)
+    {
+        metrics_tls = metrics_acquire();
+    }
+    return *metrics_tls;
+}
+
+inline void metrics_add(MetricCounter counter, uint64_t value = 1)
+{
+    std::atomic<uint64_t> &c = metrics_local().counters[counter];
+    c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void metrics_disconnect(DisconnectReason reason)
+{
+    std::atomic<uint64_t> &c = metrics_local().disconnects[reason];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+inline uint64_t metrics_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+inline void metrics_time(MetricTimer timer, uint64_t started_ns)
+{
+    histogram_record(metrics_local().timers[timer], metrics_now_ns() - started_ns);
+}
+
+#endif // METRICS_H
@@ -0,0 +1,58 @@
+#ifndef MOVE_LOG_H
+#define MOVE_LOG_H
+
+#include <stdint.h>
+
+#include "session.h"
+
+// Write-ahead log of live games.
+//
+// Session threads append fixed-size binary records (game start, move, game
+// end) to a shared in-memory batch. A single writer thread swaps the batch
+// out, writes it with one write() and makes it durable with one fdatasync(),
+// so all moves that arrived during the previous sync share the next one.
+// A session thread that needs its record on disk before answering waits
+// for the sequence number its append returned. A batch that cannot be
+// synced after MOVE_LOG_RETRIES attempts is cut off the file again, and
+// from then on every wait reports failure instead of acknowledging.
+//
+// On startup the log is replayed into the session pool: every game without
+// an end record is restored with its position, clocks and resume secrets,
+// then the log is rewritten to hold only those games. The writer keeps the
+// records of the running games in memory as well, and checkpoints the log
+// the same way once it holds MOVE_LOG_COMPACT_RATIO times as many records:
+// the running games go to a new file that is renamed over the log.
+
+#define MOVE_LOG_BATCH 65536        // Records per in-memory batch; appends wait while both are full
+#define MOVE_LOG_COMPACT_RATIO 4    // Log records per running game record that trigger a checkpoint
+#define MOVE_LOG_COMPACT_MIN 65536  // Smallest log, in records, that is checkpointed
+#define MOVE_LOG_RETRIES 3          // Attempts at writing a batch before the log gives up
+
+enum MoveLogType : uint8_t { MOVE_LOG_START = 1, MOVE_LOG_MOVE, MOVE_LOG_END };
+
+struct MoveLogRecord {
+    uint32_t game;
+    uint8_t type;    // MoveLogType
+    uint8_t unused;
+    uint16_t move;   // pack_move() of MOVE_LOG_MOVE records
+    uint32_t a;      // START: White's resume secret, MOVE: mover's clock after the move (ms)
+    uint32_t b;      // START: Black's resume secret
+};
+
+// Recovers the games left in the log at `path` into the session pool, which
+// must be freshly initialized, compacts the log and starts the writer thread.
+// `restored` is called for every recovered game once appending is possible;
+// recovered clocks start from `clock_base_ms` until a move sets them.
+bool move_log_open(const char *path, int32_t clock_base_ms, void (*restored)(GameSession *session));
+// Flushes what is pending and stops the writer thread
+void move_log_close();
+
+// Each append returns the sequence number to wait for, 0 if the log is not open
+uint64_t move_log_start(const GameSession *session);
+uint64_t move_log_move(const GameSession *session, uint16_t move, int32_t remaining_ms);
+uint64_t move_log_end(const GameSession *session);
+// Blocks until every record up to `sequence` is on disk. False if the log
+// failed to sync it: the record is not durable and never will be.
+bool move_log_wait(uint64_t sequence);
+
+#endif // MOVE_LOG_H
@@ -0,0 +1,68 @@
+#ifndef MULTIPLEX_H
+#define MULTIPLEX_H
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Multiplexed connections for automated players.
+//
+// A bot farm opens one connection to ATTACH_PORT, sends REQUEST_MULTIPLEX
+// followed by the server's key (MUX_KEY_SIZE bytes, zero padded) and gets
+// MUX_ACCEPTED back, or 'e' if the key is wrong or the server runs without
+// one. The connection then carries any number of games at once. Every
+// message is tagged with its game id: the client sends fixed-size
+// MuxRequests, the server answers with a MuxHeader followed, for MUX_GAME
+// and MUX_FRAME, by a regular frame (status, board, legal moves).
+//
+// MUX_JOIN asks for a seat in the next game. Seats are paired in the order
+// they ask, from any multiplexed connection, the earlier one playing White;
+// both seats of a game may be on the same connection. The MUX_GAME that
+// starts the game echoes the tag of the join. A game ends with a final
+// frame ('c', 's' or 't') or with MUX_END when a player left, its
+// connection closed or the game went idle. MUX_END with game 0 rejects the
+// join of that tag.
+//
+// All multiplexed connections are served by one hub thread, which also
+// plays their games: there is no thread per game. Frames are snapshots, so
+// each seat has at most one frame waiting for its connection. While a
+// connection does not read, later updates of a game replace the waiting
+// frame instead of queueing behind it, and the hub stops reading that
+// connection's moves. Multiplexed games are not written to the move log
+// and have no resume tokens: when a connection closes its games end.
+
+#define MUX_KEY_SIZE 32
+#define MUX_ACCEPTED 'm'
+
+#define MUX_JOIN 'j'   // Client: seat in the next game, `game` carries a tag instead
+#define MUX_MOVE 'm'   // Client: move of `game`
+#define MUX_LEAVE 'x'  // Client: resign `game`
+
+#define MUX_GAME 'g'   // Server: game started, `tag` of the join, frame follows
+#define MUX_FRAME 'f'  // Server: frame follows
+#define MUX_END 'e'    // Server: game ended without a final frame, or join rejected
+
+#define MUX_MAX_SEATS 65536           // Waiting and playing seats per connection
+#define MUX_OUTPUT_BATCH (256 * 1024) // Waiting frames are written out while less than this is unsent
+#define MUX_MAX_OUTPUT (4 << 20)      // Unsent bytes before a connection that does not read is dropped
+
+#pragma pack(push, 1)
+struct MuxRequest {
+    char type;
+    uint8_t unused[3];
+    uint32_t game;     // Tag of a MUX_JOIN
+    int32_t move[4];   // MUX_MOVE only
+};
+
+struct MuxHeader {
+    char type;
+    char side;         // Seat the message is for, 'w' or 'b'
+    uint16_t unused;
+    uint32_t game;
+    uint32_t tag;      // MUX_GAME and rejected joins
+};
+#pragma pack(pop)
+
+#define MUX_FRAME_SIZE (sizeof(MuxHeader) + FRAME_SIZE)
+
+#endif // MULTIPLEX_H
@@ -0,0 +1,37 @@
+#ifndef POSITION_CACHE_H
+#define POSITION_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chessboard.h"
+
+// Process-wide cache of the rules evaluation of a position: the legal move
+// set of the side to move and the gameDecider() outcome.
+//
+// Positions are keyed by position_hash() and verified against a packed copy
+// of the placement, so a hash collision is a miss, never a wrong answer.
+// The cache is set-associative: a hash selects one set of
+// POSITION_CACHE_WAYS entries and a position can live only there, so memory
+// is fixed at init. Each set evicts with CLOCK. A hit marks its entry
+// referenced, and the hand skips referenced entries once, clearing the
+// mark. A new entry starts unreferenced, so a position seen only once is
+// the first to go and opening traffic stays cached. Sets are guarded by
+// striped mutexes; lookups and inserts copy one entry under the lock and
+// the rules run outside it.
+
+#define POSITION_CACHE_WAYS 8
+#define POSITION_CACHE_LOCKS 256
+#define POSITION_CACHE_MB 16      // Default size used by the server
+
+// Sizes the cache to at most `memory_bytes`; 0 disables it
+bool position_cache_init(size_t memory_bytes);
+void position_cache_free();
+size_t position_cache_capacity(); // Entries
+
+// gameDecider() for `turn` on `board`; when the game goes on `legal` gets
+// the legal move set, otherwise it is cleared. Served from the cache when
+// possible, hits and misses are counted in the thread's metrics.
+char position_cache_evaluate(Chessboard &board, char turn, LegalMoves &legal);
+
+#endif // POSITION_CACHE_H
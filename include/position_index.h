@@ -0,0 +1,54 @@
+#ifndef POSITION_INDEX_H
+#define POSITION_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Index of every position reached in an archive, built offline.
+//
+// Each game is replayed and every position in it (ply 0 being the initial
+// one) is recorded as its position_hash() with the archive game number and
+// ply. The entries are sorted by hash and written to one file, which is
+// mapped and searched in place, so a lookup touches a few pages and needs
+// no loading step.
+//
+// Building is parallel in both phases: threads replay disjoint block ranges
+// of the archive into sorted runs on disk, bounded by the memory budget,
+// then each thread merges one slice of the hash space from all runs and
+// writes it straight to its final place in the index.
+
+#define POSITION_INDEX_MAGIC 0x58444950u  // "PIDX"
+#define POSITION_INDEX_MEMORY_MB 256      // Default run buffer budget of a build
+
+struct PositionIndexHeader {
+    uint32_t magic;
+    uint32_t unused;
+    uint64_t count;
+};
+
+struct PositionEntry {
+    uint64_t hash;
+    uint32_t game;   // Archive game number, see archive_read()
+    uint16_t ply;    // Moves played before the position
+    uint16_t unused;
+};
+
+// Builds the index of the archive at `archive_path` with `threads` threads
+// sharing `memory_bytes` of run buffers. Run files are written next to the
+// index and removed afterwards.
+bool position_index_build(const char *archive_path, const char *index_path, int threads, size_t memory_bytes);
+
+struct PositionIndex {
+    int fd;
+    const uint8_t *data;            // Mapped file
+    size_t size;
+    const PositionEntry *entries;   // Sorted by hash, game and ply
+    uint64_t count;
+};
+
+bool position_index_open(PositionIndex &index, const char *path);
+void position_index_close(PositionIndex &index);
+// Entries of the position with `hash` are entries[first] to entries[first + count - 1]; returns count
+uint64_t position_index_find(const PositionIndex &index, uint64_t hash, uint64_t &first);
+
+#endif // POSITION_INDEX_H
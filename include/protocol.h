@@ -0,0 +1,52 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include "chessboard.h"
+
+// Wire protocol shared by the server and its clients.
+//
+// Players connect to SERVER_PORT and receive their side ('w' or 'b')
+// followed by the board, the legal moves and their resume token. Every
+// later update is a frame: one status byte
+// (side to move, or 'c' checkmate, 's' stalemate, 't' the side to move
+// lost on time, 'e' session ended)
+// followed by the board serialized with serializeChessboard() and the
+// LegalMoves of the side to move, so clients can reject illegal drops
+// without a round-trip. The set is empty once the game is decided.
+//
+// Other peers connect to ATTACH_PORT and start with a one byte request
+// type followed by its arguments. A player whose connection dropped sends
+// REQUEST_RESUME with its token and gets back, in one message, 'r', its
+// side, both clocks in milliseconds (int32, 0 without time control) and
+// a regular frame of the current position. REQUEST_ANALYSIS turns the
+// connection into a stream of analysis queries and replies, see analysis.h.
+// REQUEST_MULTIPLEX turns it into one bot connection playing many games,
+// see multiplex.h.
+//
+// A server started with a Unix socket path also accepts players on that
+// path and attach requests on the path with UNIX_ATTACH_SUFFIX appended,
+// speaking the same protocol. Only there REQUEST_MULTIPLEX_SHM moves a
+// multiplexed connection onto shared-memory rings, see shm_ring.h.
+
+#define SERVER_PORT 1101
+#define ATTACH_PORT 1102
+#define STATS_PORT 1103  // Plain-text metrics, bound to 127.0.0.1 only
+
+#define BOARD_DATA_SIZE (128 * sizeof(int))  // Serialized board
+#define LEGAL_DATA_SIZE (sizeof(LegalMoves))  // Legal moves of the side to move
+#define FRAME_SIZE (1 + BOARD_DATA_SIZE + LEGAL_DATA_SIZE) // Status byte + board + legal moves
+
+#define RESUME_TOKEN_SIZE sizeof(uint64_t)               // Game id in the low half, per-player secret in the high half
+#define HELLO_SIZE (FRAME_SIZE + RESUME_TOKEN_SIZE)       // First message to a player
+#define RESUME_REPLY_SIZE (2 + 2 * sizeof(int32_t) + FRAME_SIZE)
+
+#define REQUEST_SPECTATE 'v' // Followed by the uint32_t game id, answered with 'v' + board
+#define REQUEST_RESUME 'r'   // Followed by the resume token, answered with a resume reply or 'e'
+#define REQUEST_ANALYSIS 'a' // Analysis queries follow, answered with 'e' if the service is off
+#define REQUEST_MULTIPLEX 'm' // Followed by the server key, answered with 'm' or 'e'
+#define REQUEST_MULTIPLEX_SHM 'M' // Same, 'm' comes with the shared-memory descriptors
+
+#define UNIX_ATTACH_SUFFIX ".attach"
+
+#endif // PROTOCOL_H
@@ -0,0 +1,88 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <atomic>
+#include <stdint.h>
+
+#include "chessboard.h"
+
+// Position evaluation and best-move search on top of the rules library.
+//
+// The evaluation is linear: material plus a piece-square bonus for every
+// piece, White's pieces counted positive and Black's negative, returned
+// from the side to move's point of view in centipawns. Tables are indexed
+// from the owner's side, square 0 being a8 for White (a1 for Black), so
+// one table serves both colors.
+//
+// The search is an iterative-deepening alpha-beta (negamax) with a
+// capture-only quiescence search. Captures are tried first, most valuable
+// victim by least valuable attacker, and each iteration starts with the
+// previous iteration's best move. Moves come from legal_moves(), so the
+// rules of the server apply unchanged.
+//
+// A search may be given a transposition table. Its entries are two words,
+// the key stored xor-ed with the data, so several searches can share one
+// table without locks: a torn entry fails the key check and reads as a
+// miss. Each position_hash() maps to one entry, and a new result always
+// replaces the old one.
+
+#define SEARCH_MATE 100000       // Score of giving mate now; mate in n plies scores SEARCH_MATE - n
+#define SEARCH_MAX_DEPTH 32
+#define SEARCH_QUIESCENCE_DEPTH 6 // Captures followed below the nominal depth
+
+enum EvalPiece { EVAL_PAWN, EVAL_KNIGHT, EVAL_BISHOP, EVAL_ROOK, EVAL_QUEEN, EVAL_KING, EVAL_PIECES };
+
+struct EvalParams {
+    int32_t material[EVAL_PIECES];
+    int32_t pst[EVAL_PIECES][64];
+};
+
+extern const EvalParams default_eval_params;
+
+// Parameter files are text: the six material values, then the six tables
+// in EvalPiece order, rank 8 first; '#' starts a comment
+bool eval_params_load(const char *path, EvalParams &params);
+bool eval_params_save(const char *path, const EvalParams &params);
+
+// Sparse features for tuning, one per piece: kind * 64 + table square,
+// plus EVAL_BLACK_FEATURES for Black's pieces. evaluate() from White's side
+// is the sum over them of material plus table value, negated for Black.
+#define EVAL_BLACK_FEATURES (EVAL_PIECES * 64)
+#define EVAL_FEATURES (2 * EVAL_BLACK_FEATURES)
+int eval_features(const Chessboard &board, uint16_t features[64]); // Returns the count
+
+// EvalPiece of a board piece type, -1 for an empty square
+int eval_piece(char type);
+int evaluate(const Chessboard &board, char turn, const EvalParams &params);
+
+struct SearchTable {
+    std::atomic<uint64_t> *entries; // Two words per entry
+    size_t mask;                    // Entry count - 1, the count is a power of two
+};
+
+// Largest power of two number of entries that fits in `mb` megabytes
+bool search_table_create(SearchTable &table, size_t mb);
+void search_table_clear(SearchTable &table);
+void search_table_free(SearchTable &table);
+
+// Zero fields mean no limit; the search always finishes depth 1
+struct SearchLimits {
+    int depth;
+    uint64_t nodes;
+    int64_t movetime_ms;
+    const std::atomic<bool> *stop; // Polled while searching, may be NULL
+    SearchTable *table;            // Transposition table, may be NULL
+};
+
+struct SearchResult {
+    int move[4];      // Best move, valid when has_move
+    bool has_move;    // False when the side to move has no legal move
+    int score;        // Side to move's view, see SEARCH_MATE
+    int depth;        // Last completed iteration
+    uint64_t nodes;
+};
+
+void search(const Chessboard &board, char turn, const SearchLimits &limits, const EvalParams &params,
+            SearchResult &result);
+
+#endif // SEARCH_H
@@ -0,0 +1,77 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chessboard.h"
+#include "timer_wheel.h"
+
+#define MAX_PLIES 1024                 // Move history capacity of a single session
+#define SESSION_STACK_SIZE (64 * 1024) // Stack size of a game session thread
+
+// Per-side game clock, in milliseconds
+typedef struct {
+    int32_t remaining_ms[2]; // [0] white, [1] black
+    int32_t increment_ms;    // Added to the mover's clock after each move
+    int64_t turn_started_ms; // Monotonic time the current turn started
+} GameClock;
+
+// Fixed-size record holding all state of one game. Records live in the
+// session pool, so creating and ending a game never touches the heap.
+typedef struct {
+    int clientSocketWhite;
+    int clientSocketBlack;
+    uint32_t id;               // Generation above the pool slot index in the low bits, unique per game
+    int next_free;             // Free list link, valid only while the slot is unused
+    char turn;                 // 'w' or 'b'
+    uint16_t ply;              // Number of moves stored in `moves`
+    Chessboard board;          // Current position
+    LegalMoves legal;          // Moves of the side to move, sent with every frame
+    GameClock clock;
+    Timer deadline;            // Next clock or idle deadline, on the server's timer wheel
+    int wake_fd;               // eventfd the timer thread signals when `deadline` expires
+    uint32_t resume_secret[2];  // Token secrets of White and Black, 0 once the game is over
+    int64_t disconnected_ms[2]; // When a player's connection dropped, 0 while connected
+    int pending_socket[2];      // Reattached connection not yet taken by the session thread, -1 if none
+    bool multiplexed;           // Played by the multiplex hub, not in the move log
+    bool watchable;             // Running and open to spectators, under the server's resume lock
+    bool snapshot_wanted;       // A new spectator waits for the current position, same lock
+    uint16_t moves[MAX_PLIES]; // Move history, see pack_move()
+} GameSession;
+
+// Allocates the pool once at startup; `capacity` bounds concurrent games
+bool session_pool_init(size_t capacity);
+// Takes a free record and sets it up for a new game, NULL when the pool is full
+GameSession *session_acquire(int clientSocketWhite, int clientSocketBlack);
+// Returns the record to the pool
+void session_release(GameSession *session);
+// The record that holds or last held game `id`, NULL if its slot moved on
+GameSession *session_find(uint32_t id);
+// Startup only, before the first session_acquire: claims the slot of game
+// `id` for a recovered game with no players attached. NULL if another
+// recovered game already holds the slot.
+GameSession *session_restore(uint32_t id);
+// Rebuilds the free list from every slot session_restore did not claim
+void session_pool_relink();
+
+size_t session_pool_capacity();
+size_t session_pool_in_use();
+
+// Appends a move to the session history (ignored once MAX_PLIES is reached)
+void session_record_move(GameSession *session, const int move[4]);
+
+enum SessionMoveResult { SESSION_MOVE_ILLEGAL, SESSION_MOVE_LATE, SESSION_MOVE_PLAYED };
+
+// Plays the mover's move that arrived at `now_ms`. With `timed` the clock is
+// charged first: if the flag already fell the move does not count, so the
+// board and history are left as they were and the mover's clock reads 0.
+// A played move is on the board and in the history, and the clock has the
+// time spent taken off and the increment added; the turn does not pass.
+SessionMoveResult session_play_move(GameSession *session, int move[4], int64_t now_ms, bool timed);
+
+// Packs a move {x1, y1, x2, y2} into 12 bits: from square << 6 | to square
+uint16_t pack_move(const int move[4]);
+void unpack_move(uint16_t packed, int move[4]);
+
+#endif // SESSION_H
@@ -0,0 +1,67 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared-memory transport for engines on the same host.
+//
+// Two single-producer single-consumer byte rings live in one memfd, one per
+// direction, and carry exactly the bytes a socket would. Each side has an
+// eventfd it sleeps on. A writer rings the peer's eventfd only when the
+// peer said it is about to sleep waiting for data, and a reader only when
+// the peer waits for space, so a busy peer costs no syscalls at all.
+//
+// The server creates the area and hands the memfd and both eventfds to
+// the client over a Unix socket (SCM_RIGHTS). The socket stays open: the
+// connection ends when either side closes it.
+
+#define SHM_RING_SIZE (1 << 20) // Bytes per direction, a power of two
+#define SHM_FDS 3               // memfd, server eventfd, client eventfd
+
+#define SHM_WAIT_DATA 1
+#define SHM_WAIT_SPACE 2
+
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head; // Bytes written so far, by the producer
+    alignas(64) std::atomic<uint64_t> tail; // Bytes read so far, by the consumer
+    alignas(64) uint8_t data[SHM_RING_SIZE];
+};
+
+struct ShmArea {
+    ShmRing rings[2];                               // [0] client to server, [1] server to client
+    alignas(64) std::atomic<uint32_t> waiting[2];   // SHM_WAIT_* of the server [0] and the client [1]
+};
+
+// One side's view of a connection
+struct ShmEndpoint {
+    ShmArea *area;  // NULL when not connected
+    int side;       // 0 server, 1 client
+    int fds[SHM_FDS];
+    uint32_t armed; // What the last shm_prepare_wait announced
+};
+
+// Server side: creates the area and the eventfds
+bool shm_create(ShmEndpoint &endpoint);
+// Client side: maps the area from the descriptors shm_create made, taking them over
+bool shm_attach(ShmEndpoint &endpoint, const int fds[SHM_FDS]);
+void shm_close(ShmEndpoint &endpoint);
+
+// Copies as much as fits, returns the bytes written
+size_t shm_write(ShmEndpoint &endpoint, const void *data, size_t size);
+// Copies up to `size` bytes, returns the bytes read; 0 when the ring is empty
+size_t shm_read(ShmEndpoint &endpoint, void *data, size_t size);
+
+// Eventfd to poll for POLLIN while waiting
+int shm_wait_fd(const ShmEndpoint &endpoint);
+// Announces a wait for SHM_WAIT_* `what`. False if it is already satisfied,
+// in which case the caller does not sleep. Either way shm_end_wait follows.
+bool shm_prepare_wait(ShmEndpoint &endpoint, uint32_t what);
+void shm_end_wait(ShmEndpoint &endpoint);
+
+// Passes descriptors with a one byte message over a Unix socket
+bool shm_send_fds(int socket, char message, const int fds[SHM_FDS]);
+bool shm_receive_fds(int socket, char &message, int fds[SHM_FDS]);
+
+#endif // SHM_RING_H
@@ -0,0 +1,27 @@
+#ifndef SPECTATOR_H
+#define SPECTATOR_H
+
+#include <stdint.h>
+#include "chessboard.h"
+
+#define SPECTATOR_MAX_LAG 8           // Updates a watcher may fall behind before it is dropped
+#define SPECTATOR_STALL_MS 5000       // Time a watcher may block a single frame before it is dropped
+
+// Starts the fan-out thread that writes board updates to spectators
+bool spectator_hub_start();
+
+// Games get a channel only once someone watches them; publishing to or
+// closing a game without one costs a hash lookup and nothing else.
+
+// Publishes an update of a watched game. The frame is serialized once and shared by all watchers.
+void spectator_publish(uint32_t id, char status, const int data[128], const LegalMoves &legal);
+// Ends a game; watchers are disconnected once their last frame is written
+void spectator_close_game(uint32_t id);
+
+// Subscribes a connected socket to a running game, which the caller has
+// checked. False if the game is closing. Sets `snapshot_wanted` when the
+// channel has no frame yet: the game must then publish its current state,
+// which the watcher receives as its hello.
+bool spectator_watch(int socket, uint32_t id, bool &snapshot_wanted);
+
+#endif // SPECTATOR_H
@@ -0,0 +1,34 @@
+#ifndef SPRT_H
+#define SPRT_H
+
+#include <stdint.h>
+
+// Match statistics for accepting or rejecting a change by self-play.
+//
+// Elo is logistic: a score s (win = 1, draw = 1/2) maps to
+// -400 log10(1/s - 1). The sequential probability ratio test weighs
+// H0 "the first engine is elo0 stronger" against H1 "it is elo1 stronger"
+// with the normal approximation of the trinomial (win, draw, loss)
+// log-likelihood ratio, so a new result updates it in O(1). The test
+// stops once the LLR leaves [lower, upper].
+
+enum SprtVerdict { SPRT_CONTINUE, SPRT_ACCEPT_H0, SPRT_ACCEPT_H1 };
+
+// Results from the first engine's point of view
+struct MatchScore {
+    uint64_t wins;
+    uint64_t draws;
+    uint64_t losses;
+};
+
+double elo_from_score(double score);
+double score_from_elo(double elo);
+// Elo difference and the half-width of its 95% interval, 0 without games
+void elo_estimate(const MatchScore &match, double &elo, double &error95);
+
+// Stopping bounds for false positive rate alpha and false negative rate beta
+void sprt_bounds(double alpha, double beta, double &lower, double &upper);
+double sprt_llr(const MatchScore &match, double elo0, double elo1);
+SprtVerdict sprt_verdict(double llr, double lower, double upper);
+
+#endif // SPRT_H
@@ -0,0 +1,42 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timer wheel. Timers are intrusive (embedded in the object
+// they belong to), so arming and cancelling never allocate and cost O(1)
+// regardless of how many timers are pending. Level 0 has one slot per
+// tick; every further level covers TIMER_WHEEL_SLOTS times the span of the
+// one below and is cascaded down when the lower level wraps around.
+//
+// A wheel is not thread-safe; its owner serializes access to it.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // 64^4 ticks, about 31 days at 10 ms per tick
+
+struct Timer {
+    Timer *next;      // Slot list links, NULL while the timer is not armed
+    Timer *prev;
+    uint64_t expires; // Tick the timer fires at
+    void (*callback)(Timer *timer);
+    void *data;       // Free for the owner
+};
+
+struct TimerWheel {
+    uint64_t now;                                       // Last tick processed
+    Timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // List heads
+};
+
+void timer_wheel_init(TimerWheel &wheel, uint64_t now);
+// Arms `timer` to fire at tick `expires`, re-arming it if it is pending.
+// Expiries in the past fire on the next tick; ones beyond the wheel's
+// span fire at its end.
+void timer_add(TimerWheel &wheel, Timer *timer, uint64_t expires);
+void timer_cancel(Timer *timer);
+bool timer_pending(const Timer *timer);
+// Processes every tick up to `now`, calling the callbacks of expired timers.
+// A callback may re-arm or cancel any timer.
+void timer_wheel_advance(TimerWheel &wheel, uint64_t now);
+
+#endif // TIMER_WHEEL_H
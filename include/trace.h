@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped tracing of hot paths, enabled with the CHESS_TRACE CMake option.
+//
+// TRACE_SCOPE("name") records how long the enclosing scope took into a
+// ring buffer owned by the calling thread. The rings are written to a
+// Chrome trace / Perfetto JSON file on SIGUSR1 and at exit. Without
+// CHESS_TRACE the macros expand to nothing.
+
+#ifdef CHESS_TRACE
+
+#include <stdint.h>
+
+#define TRACE_RING_SIZE 1024 // Events kept per thread, the oldest are overwritten
+
+// Starts the dump thread; call at the top of main before other threads exist
+void trace_init();
+// Writes all rings to $CHESS_TRACE_FILE (default chess_trace.json)
+void trace_dump();
+
+uint64_t trace_now_ns();
+void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns);
+
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : name(name), start(trace_now_ns()) {}
+    ~TraceScope() { trace_record(name, start, trace_now_ns()); }
+
+private:
+    const char *name; // Must be a string literal
+    uint64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#else
+
+inline void trace_init() {}
+inline void trace_dump() {}
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif // CHESS_TRACE
+
+#endif // TRACE_H
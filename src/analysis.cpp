@@ -0,0 +1,535 @@
+#include "analysis.h"
+#include "search.h"
+#include "session.h"
+#include "metrics.h"
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define ANALYSIS_MAX_OUTPUT (64 * 1024) // Unsent reply bytes before a client that does not read is dropped
+
+struct AnalysisWaiter {
+    uint64_t client;
+    uint32_t tag;
+};
+
+struct AnalysisJob {
+    Chessboard board;
+    char turn;
+    int depth;
+    int priority;
+    uint64_t sequence;                   // Submission order among equal priorities
+    uint64_t hash;
+    bool queued;                         // Still in `queue`, guarded by queue_lock
+    std::atomic<bool> stop;              // Set by the hub once nobody waits for the result
+    std::vector<AnalysisWaiter> waiters; // Hub thread only
+    SearchResult result;                 // Written by the worker
+};
+
+struct AnalysisClient {
+    int socket;
+    uint64_t id;
+    std::vector<uint8_t> in;  // Bytes of an incomplete message
+    std::vector<uint8_t> out; // Replies not yet sent
+    int pending;              // Queries without a reply
+    bool done;
+};
+
+struct CachedAnalysis {
+    uint64_t hash;
+    Chessboard board;
+    char turn;
+    uint8_t depth;            // 0 for an empty slot
+    uint16_t move;
+    int32_t score;
+    uint32_t nodes;
+};
+
+// Shared between the hub and the workers
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static std::vector<AnalysisJob *> queue;    // Heap, see job_before()
+static std::vector<AnalysisJob *> finished; // Picked up by the hub
+static std::vector<int> new_clients;
+static int wake_fd = -1;
+
+// Hub thread only
+static std::vector<AnalysisClient> clients;
+static std::unordered_multimap<uint64_t, AnalysisJob *> inflight; // By position hash
+static std::vector<CachedAnalysis> cache;
+static uint64_t next_client = 1;
+static uint64_t next_sequence = 0;
+
+// Heap ordering: higher priority first, then older
+static bool job_before(const AnalysisJob *a, const AnalysisJob *b)
+{
+    if (a->priority != b->priority)
+        return a->priority < b->priority;
+    return a->sequence > b->sequence;
+}
+
+static void wake_hub()
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("Analysis wakeup failed");
+    }
+}
+
+static void *workerThread(void *)
+{
+    // Game threads come first when the cores are busy
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), ANALYSIS_NICE);
+    while (1)
+    {
+        pthread_mutex_lock(&queue_lock);
+        while (queue.empty())
+        {
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        }
+        std::pop_heap(queue.begin(), queue.end(), job_before);
+        AnalysisJob *job = queue.back();
+        queue.pop_back();
+        job->queued = false;
+        pthread_mutex_unlock(&queue_lock);
+
+        if (!job->stop.load(std::memory_order_relaxed))
+        {
+            SearchLimits limits = {job->depth, ANALYSIS_MAX_NODES, 0, &job->stop, NULL};
+            uint64_t started = metrics_now_ns();
+            search(job->board, job->turn, limits, default_eval_params, job->result);
+            metrics_time(TIMER_ANALYSIS, started);
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        finished.push_back(job);
+        pthread_mutex_unlock(&queue_lock);
+        wake_hub();
+    }
+    return NULL;
+}
+
+static AnalysisClient *find_client(uint64_t id)
+{
+    for (AnalysisClient &client : clients)
+    {
+        if (client.id == id)
+        {
+            return &client;
+        }
+    }
+    return NULL;
+}
+
+static void reply(AnalysisClient &client, char status, uint32_t tag, int depth, uint16_t move, int32_t score,
+                  uint32_t nodes)
+{
+    AnalysisReply message = {status, (uint8_t)depth, move, tag, score, nodes};
+    const uint8_t *bytes = (const uint8_t *)&message;
+    client.out.insert(client.out.end(), bytes, bytes + sizeof(message));
+}
+
+static CachedAnalysis &cache_slot(uint64_t hash)
+{
+    return cache[hash % ANALYSIS_CACHE_ENTRIES];
+}
+
+static bool same_position(const Chessboard &a, char a_turn, const Chessboard &b, char b_turn)
+{
+    return a_turn == b_turn && memcmp(&a, &b, sizeof(Chessboard)) == 0;
+}
+
+// Takes the waiter of `tag` off its job; the job is stopped once nobody waits for it
+static bool drop_waiter(uint64_t client, uint32_t tag)
+{
+    for (auto &entry : inflight)
+    {
+        AnalysisJob *job = entry.second;
+        for (size_t i = 0; i < job->waiters.size(); i++)
+        {
+            if (job->waiters[i].client == client && job->waiters[i].tag == tag)
+            {
+                job->waiters.erase(job->waiters.begin() + i);
+                if (job->waiters.empty())
+                {
+                    job->stop.store(true, std::memory_order_relaxed);
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Only known pieces, empty squares without a color, and one king per side
+static bool valid_board(const Chessboard &board)
+{
+    int kings[2] = {0, 0};
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 8; x++)
+        {
+            const Piece &piece = board[y][x];
+            if (piece.type == 'e')
+            {
+                if (piece.color != 'n')
+                {
+                    return false;
+                }
+                continue;
+            }
+            if (piece.type == '\0' || !strchr("pkbrqK", piece.type) || (piece.color != 'w' && piece.color != 'b'))
+            {
+                return false;
+            }
+            if (piece.type == 'K')
+            {
+                kings[piece.color == 'w' ? 0 : 1]++;
+            }
+        }
+    }
+    return kings[0] == 1 && kings[1] == 1;
+}
+
+// Answers a query from the cache or an existing job if it can; otherwise returns a new job
+static AnalysisJob *submit(AnalysisClient &client, const AnalysisQuery &query)
+{
+    metrics_add(METRIC_ANALYSIS_REQUESTS);
+    if (query.depth < 1 || query.depth > ANALYSIS_MAX_DEPTH || (query.turn != 'w' && query.turn != 'b') ||
+        client.pending >= ANALYSIS_MAX_PENDING)
+    {
+        reply(client, ANALYSIS_REJECTED, query.tag, 0, 0, 0, 0);
+        return NULL;
+    }
+    Chessboard board;
+    deserializeChessboard(query.board, board);
+    if (!valid_board(board))
+    {
+        reply(client, ANALYSIS_REJECTED, query.tag, 0, 0, 0, 0);
+        return NULL;
+    }
+    uint64_t hash = position_hash(board, query.turn);
+
+    const CachedAnalysis &cached = cache_slot(hash);
+    if (cached.depth >= query.depth && cached.hash == hash && same_position(cached.board, cached.turn, board, query.turn))
+    {
+        metrics_add(METRIC_ANALYSIS_CACHED);
+        reply(client, ANALYSIS_DONE, query.tag, cached.depth, cached.move, cached.score, cached.nodes);
+        return NULL;
+    }
+
+    client.pending++;
+    auto range = inflight.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        AnalysisJob *job = it->second;
+        if (job->depth >= query.depth && !job->stop.load(std::memory_order_relaxed) &&
+            same_position(job->board, job->turn, board, query.turn))
+        {
+            metrics_add(METRIC_ANALYSIS_COALESCED);
+            job->waiters.push_back({client.id, query.tag});
+            if (query.priority > job->priority)
+            {
+                pthread_mutex_lock(&queue_lock);
+                job->priority = query.priority;
+                if (job->queued)
+                {
+                    std::make_heap(queue.begin(), queue.end(), job_before);
+                }
+                pthread_mutex_unlock(&queue_lock);
+            }
+            return NULL;
+        }
+    }
+
+    AnalysisJob *job = new AnalysisJob;
+    job->board = board;
+    job->turn = query.turn;
+    job->depth = query.depth;
+    job->priority = query.priority;
+    job->sequence = next_sequence++;
+    job->hash = hash;
+    job->queued = true;
+    job->stop.store(false, std::memory_order_relaxed);
+    job->result.has_move = false; // Left as is when the job is stopped before it runs
+    job->result.depth = 0;
+    job->result.score = 0;
+    job->result.nodes = 0;
+    job->waiters.push_back({client.id, query.tag});
+    inflight.emplace(hash, job);
+    return job;
+}
+
+// Parses the complete messages in the client's input
+static void read_client(AnalysisClient &client, std::vector<AnalysisJob *> &batch)
+{
+    uint8_t buffer[16 * 1024];
+    while (1)
+    {
+        ssize_t n = recv(client.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            client.done = true;
+            return;
+        }
+        if (n < 0)
+        {
+            break;
+        }
+        metrics_add(METRIC_BYTES_IN, n);
+        client.in.insert(client.in.end(), buffer, buffer + n);
+    }
+
+    size_t offset = 0;
+    while (offset < client.in.size())
+    {
+        uint8_t type = client.in[offset];
+        size_t left = client.in.size() - offset - 1;
+        if (type == ANALYSIS_QUERY && left >= sizeof(AnalysisQuery))
+        {
+            AnalysisQuery query;
+            memcpy(&query, client.in.data() + offset + 1, sizeof(query));
+            offset += 1 + sizeof(query);
+            AnalysisJob *job = submit(client, query);
+            if (job)
+            {
+                batch.push_back(job);
+            }
+        }
+        else if (type == ANALYSIS_CANCEL && left >= sizeof(uint32_t))
+        {
+            uint32_t tag;
+            memcpy(&tag, client.in.data() + offset + 1, sizeof(tag));
+            offset += 1 + sizeof(tag);
+            if (drop_waiter(client.id, tag))
+            {
+                metrics_add(METRIC_ANALYSIS_CANCELLED);
+                client.pending--;
+                reply(client, ANALYSIS_CANCELLED, tag, 0, 0, 0, 0);
+            }
+        }
+        else if (type != ANALYSIS_QUERY && type != ANALYSIS_CANCEL)
+        {
+            client.done = true; // Not speaking the protocol
+            break;
+        }
+        else
+        {
+            break; // Wait for the rest of the message
+        }
+    }
+    client.in.erase(client.in.begin(), client.in.begin() + offset);
+}
+
+// Delivers a finished job to whoever still waits for it
+static void complete(AnalysisJob *job)
+{
+    auto range = inflight.equal_range(job->hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == job)
+        {
+            inflight.erase(it);
+            break;
+        }
+    }
+
+    // Only full results are cached; a position without a legal move is final at depth 0
+    const SearchResult &result = job->result;
+    uint16_t move = result.has_move ? pack_move(result.move) : 0;
+    if (!job->stop.load(std::memory_order_relaxed) && (result.depth >= job->depth || !result.has_move))
+    {
+        CachedAnalysis &slot = cache_slot(job->hash);
+        if (slot.depth <= job->depth)
+        {
+            slot = {job->hash, job->board, job->turn, (uint8_t)job->depth, move, result.score, (uint32_t)result.nodes};
+        }
+    }
+    for (const AnalysisWaiter &waiter : job->waiters)
+    {
+        AnalysisClient *client = find_client(waiter.client);
+        if (client)
+        {
+            client->pending--;
+            reply(*client, ANALYSIS_DONE, waiter.tag, result.depth, move, result.score, (uint32_t)result.nodes);
+        }
+    }
+    delete job;
+}
+
+static void write_client(AnalysisClient &client)
+{
+    while (!client.out.empty())
+    {
+        ssize_t n = send(client.socket, client.out.data(), client.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                client.done = true;
+            }
+            break;
+        }
+        metrics_add(METRIC_BYTES_OUT, n);
+        client.out.erase(client.out.begin(), client.out.begin() + n);
+    }
+    if (client.out.size() > ANALYSIS_MAX_OUTPUT)
+    {
+        client.done = true;
+    }
+}
+
+static void *hubThread(void *)
+{
+    std::vector<struct pollfd> fds;
+    std::vector<AnalysisJob *> batch;
+    std::vector<AnalysisJob *> done_jobs;
+    while (1)
+    {
+        pthread_mutex_lock(&queue_lock);
+        for (int socket : new_clients)
+        {
+            clients.push_back({socket, next_client++, {}, {}, 0, false});
+        }
+        new_clients.clear();
+        done_jobs.swap(finished);
+        pthread_mutex_unlock(&queue_lock);
+
+        for (AnalysisJob *job : done_jobs)
+        {
+            complete(job);
+        }
+        done_jobs.clear();
+
+        // fds[i + 1] belongs to clients[i] as long as no client is added or removed
+        for (size_t i = 0; i + 1 < fds.size() && i < clients.size(); i++)
+        {
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                read_client(clients[i], batch);
+            }
+        }
+
+        // New jobs of this round go to the workers under one lock
+        if (!batch.empty())
+        {
+            pthread_mutex_lock(&queue_lock);
+            for (AnalysisJob *job : batch)
+            {
+                queue.push_back(job);
+                std::push_heap(queue.begin(), queue.end(), job_before);
+            }
+            pthread_mutex_unlock(&queue_lock);
+            pthread_cond_broadcast(&queue_ready);
+            batch.clear();
+        }
+
+        for (size_t i = 0; i < clients.size();)
+        {
+            AnalysisClient &client = clients[i];
+            if (!client.done)
+            {
+                write_client(client);
+            }
+            if (!client.done)
+            {
+                i++;
+                continue;
+            }
+            // Queries of a closed connection are cancelled
+            for (auto &entry : inflight)
+            {
+                AnalysisJob *job = entry.second;
+                size_t before = job->waiters.size();
+                job->waiters.erase(std::remove_if(job->waiters.begin(), job->waiters.end(),
+                                                  [&](const AnalysisWaiter &w) { return w.client == client.id; }),
+                                   job->waiters.end());
+                if (before > 0 && job->waiters.empty())
+                {
+                    job->stop.store(true, std::memory_order_relaxed);
+                }
+            }
+            close(client.socket);
+            client = std::move(clients.back());
+            clients.pop_back();
+        }
+
+        fds.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        for (const AnalysisClient &client : clients)
+        {
+            fds.push_back({client.socket, (short)(POLLIN | (client.out.empty() ? 0 : POLLOUT)), 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+        {
+            perror("Analysis poll error");
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0)
+            {
+                perror("Analysis wakeup read failed");
+            }
+        }
+    }
+    return NULL;
+}
+
+bool analysis_start(int workers)
+{
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+        return false;
+    }
+    cache.assign(ANALYSIS_CACHE_ENTRIES, CachedAnalysis());
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, hubThread, NULL) != 0)
+    {
+        return false;
+    }
+    pthread_detach(thread_id);
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&thread_id, NULL, workerThread, NULL) != 0)
+        {
+            return false;
+        }
+        pthread_detach(thread_id);
+    }
+    return true;
+}
+
+bool analysis_serve(int socket)
+{
+    if (wake_fd < 0)
+    {
+        return false;
+    }
+    pthread_mutex_lock(&queue_lock);
+    new_clients.push_back(socket);
+    pthread_mutex_unlock(&queue_lock);
+    wake_hub();
+    return true;
+}
+
+size_t analysis_queue_length()
+{
+    pthread_mutex_lock(&queue_lock);
+    size_t length = queue.size();
+    pthread_mutex_unlock(&queue_lock);
+    return length;
+}
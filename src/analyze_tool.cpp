@@ -0,0 +1,180 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "analysis.h"
+#include "protocol.h"
+#include "session.h"
+
+// Sends positions to the server's analysis service and prints the best
+// moves as the replies arrive. Positions are FEN strings given as
+// arguments, or one per line on standard input. Queries are pipelined over
+// one connection, so a long list also measures the service's throughput.
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool send_all(int socket, const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    int depth = 4;
+    int priority = 0;
+    int repeat = 1;
+    bool quiet = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:p:r:q")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': host = optarg; break;
+        case 'd': depth = atoi(optarg); break;
+        case 'p': priority = atoi(optarg); break;
+        case 'r': repeat = atoi(optarg); break; // Every position this many times
+        case 'q': quiet = true; break;          // Summary only
+        default:
+            fprintf(stderr, "Usage: %s [-s server] [-d depth] [-p priority] [-r repeat] [-q] [FEN...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<std::string> fens;
+    for (int i = optind; i < argc; i++)
+    {
+        fens.push_back(argv[i]);
+    }
+    if (fens.empty())
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), stdin))
+        {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[0])
+            {
+                fens.push_back(line);
+            }
+        }
+    }
+
+    std::vector<uint8_t> queries;
+    for (int r = 0; r < repeat; r++)
+    {
+        for (size_t i = 0; i < fens.size(); i++)
+        {
+            Chessboard board;
+            AnalysisQuery query;
+            memset(&query, 0, sizeof(query));
+            if (!boardFromFen(fens[i].c_str(), board, query.turn))
+            {
+                fprintf(stderr, "Invalid FEN: %s\n", fens[i].c_str());
+                return 1;
+            }
+            query.tag = (uint32_t)i;
+            query.depth = (uint8_t)depth;
+            query.priority = (uint8_t)priority;
+            serializeChessboard(board, query.board);
+            queries.push_back(ANALYSIS_QUERY);
+            queries.insert(queries.end(), (uint8_t *)&query, (uint8_t *)&query + sizeof(query));
+        }
+    }
+    size_t total = fens.size() * repeat;
+
+    int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ATTACH_PORT);
+    addr.sin_addr.s_addr = inet_addr(host);
+    char request = REQUEST_ANALYSIS;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || !send_all(sock, &request, 1))
+    {
+        perror("Cannot reach the analysis service");
+        return 1;
+    }
+
+    // At most ANALYSIS_MAX_PENDING queries are outstanding, the server rejects more
+    double started = now_s();
+    const size_t query_size = 1 + sizeof(AnalysisQuery);
+    size_t sent = 0, received = 0;
+    uint64_t nodes = 0;
+    std::vector<uint8_t> in;
+    while (received < total)
+    {
+        size_t window = std::min(total - sent, ANALYSIS_MAX_PENDING - (sent - received));
+        if (window > 0 && !send_all(sock, queries.data() + sent * query_size, window * query_size))
+        {
+            perror("Send failed");
+            return 1;
+        }
+        sent += window;
+        uint8_t buffer[4096];
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+        {
+            fprintf(stderr, "Connection closed after %zu of %zu replies\n", received, total);
+            return 1;
+        }
+        in.insert(in.end(), buffer, buffer + n);
+        size_t offset = 0;
+        for (; in.size() - offset >= sizeof(AnalysisReply); offset += sizeof(AnalysisReply))
+        {
+            AnalysisReply reply;
+            memcpy(&reply, in.data() + offset, sizeof(reply));
+            received++;
+            nodes += reply.nodes;
+            if (quiet)
+            {
+                continue;
+            }
+            if (reply.status != ANALYSIS_DONE)
+            {
+                printf("%u: %c\n", reply.tag, reply.status);
+            }
+            else if (reply.move == 0)
+            {
+                printf("%u: no legal move, score %d\n", reply.tag, reply.score);
+            }
+            else
+            {
+                int move[4];
+                unpack_move(reply.move, move);
+                printf("%u: %c%c%c%c score %d depth %u nodes %u (%.1f ms)\n", reply.tag, 'a' + 7 - move[0],
+                       '1' + move[1], 'a' + 7 - move[2], '1' + move[3], reply.score, reply.depth, reply.nodes,
+                       (now_s() - started) * 1e3);
+            }
+        }
+        in.erase(in.begin(), in.begin() + offset);
+    }
+    double elapsed = now_s() - started;
+    printf("%zu replies in %.1f ms (%.1f per second), %llu nodes searched\n", received, elapsed * 1e3,
+           received / elapsed, (unsigned long long)nodes);
+    close(sock);
+    return 0;
+}
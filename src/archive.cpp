@@ -0,0 +1,562 @@
+#include "archive.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+#include <deque>
+
+#define MAX_LEGAL_MOVES 256
+
+// Games of a block that is full or old enough, waiting to be compressed
+struct SealedBlock {
+    uint64_t first_game;
+    uint32_t games;
+    std::vector<uint8_t> raw;
+};
+
+// Appends seal full blocks and signal `archive_sealed`; the writer thread
+// compresses and writes them without holding the lock.
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t archive_sealed = PTHREAD_COND_INITIALIZER;  // Blocks sealed or stopping
+static pthread_cond_t archive_written = PTHREAD_COND_INITIALIZER; // The writer finished a block
+static pthread_t writer_thread;
+static bool writer_busy = false;   // A block is being written
+static bool writer_stalled = false; // The front block failed; retried on the next tick or flush
+static bool stopping = false;
+static int archive_fd = -1;
+static int index_fd = -1;
+static uint64_t archive_end = 0;   // Offset the next block is written at, writer thread only
+static uint64_t next_game = 0;     // Number of the first game in `pending`
+static uint32_t pending_games = 0;
+static time_t pending_since = 0;   // When the first game of `pending` arrived
+static std::vector<uint8_t> pending; // Games of the block being filled, uncompressed
+static std::deque<SealedBlock> sealed; // Oldest first
+
+// Bits needed to store an index into a list of `count` moves
+static int index_bits(int count)
+{
+    return count <= 1 ? 0 : 32 - __builtin_clz((unsigned)(count - 1));
+}
+
+bool archive_encode(const uint16_t *moves, int ply, std::vector<uint8_t> &bits)
+{
+    Chessboard board = initializeBoard();
+    char turn = 'w';
+    uint64_t acc = 0;
+    int filled = 0;
+    bits.clear();
+    for (int i = 0; i < ply; i++)
+    {
+        int move[4];
+        int legal[MAX_LEGAL_MOVES][4];
+        unpack_move(moves[i], move);
+        int count = legal_moves(board, turn, legal, MAX_LEGAL_MOVES);
+        int index = 0;
+        while (index < count && memcmp(legal[index], move, sizeof(move)) != 0)
+        {
+            index++;
+        }
+        if (index == count)
+        {
+            return false;
+        }
+
+        acc |= (uint64_t)index << filled;
+        filled += index_bits(count);
+        while (filled >= 8)
+        {
+            bits.push_back((uint8_t)acc);
+            acc >>= 8;
+            filled -= 8;
+        }
+        can_move(board, move, turn);
+        turn = (turn == 'w') ? 'b' : 'w';
+    }
+    if (filled > 0)
+    {
+        bits.push_back((uint8_t)acc);
+    }
+    return true;
+}
+
+bool archive_decode(const ArchivedGame &game, uint16_t *moves)
+{
+    Chessboard board = initializeBoard();
+    char turn = 'w';
+    uint64_t acc = 0;
+    int filled = 0;
+    size_t next = 0;
+    for (int i = 0; i < game.header.ply; i++)
+    {
+        int legal[MAX_LEGAL_MOVES][4];
+        int count = legal_moves(board, turn, legal, MAX_LEGAL_MOVES);
+        int width = index_bits(count);
+        while (filled < width)
+        {
+            if (next == game.header.bytes)
+            {
+                return false;
+            }
+            acc |= (uint64_t)game.bits[next++] << filled;
+            filled += 8;
+        }
+        int index = (int)(acc & ((1ULL << width) - 1));
+        acc >>= width;
+        filled -= width;
+        if (index >= count)
+        {
+            return false;
+        }
+        moves[i] = pack_move(legal[index]);
+        can_move(board, legal[index], turn);
+        turn = (turn == 'w') ? 'b' : 'w';
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Hands the pending games to the writer; called with archive_lock held
+static void seal_block()
+{
+    if (pending_games == 0)
+    {
+        return;
+    }
+    sealed.push_back({next_game, pending_games, std::move(pending)});
+    next_game += pending_games;
+    pending_games = 0;
+    pending.clear();
+}
+
+// Compresses a block and appends it, synced, before its synced index entry
+static bool write_block(const SealedBlock &block, int fd, int ifd)
+{
+    uLongf compressed_size = compressBound(block.raw.size());
+    std::vector<uint8_t> out(sizeof(ArchiveBlockHeader) + compressed_size);
+    if (compress2(out.data() + sizeof(ArchiveBlockHeader), &compressed_size, block.raw.data(), block.raw.size(),
+                  Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        return false;
+    }
+    ArchiveBlockHeader header = {ARCHIVE_MAGIC, block.games, (uint32_t)block.raw.size(), (uint32_t)compressed_size,
+                                 block.first_game};
+    memcpy(out.data(), &header, sizeof(header));
+    size_t size = sizeof(header) + compressed_size;
+
+    // The block goes first: an index entry never points past the archive's end
+    ArchiveIndexEntry entry = {block.first_game, archive_end, block.games, (uint32_t)size};
+    off_t index_end = lseek(ifd, 0, SEEK_CUR);
+    if (index_end < 0 || !write_all(fd, out.data(), size) || fdatasync(fd) != 0 ||
+        !write_all(ifd, &entry, sizeof(entry)) || fdatasync(ifd) != 0)
+    {
+        perror("Archive write failed");
+        // Cut off the partial write so a retry lands where the index expects it
+        if (ftruncate(fd, archive_end) != 0 || ftruncate(ifd, index_end) != 0)
+        {
+            perror("Archive truncate failed");
+        }
+        lseek(fd, archive_end, SEEK_SET);
+        lseek(ifd, index_end, SEEK_SET);
+        return false;
+    }
+    archive_end += size;
+    return true;
+}
+
+static void *writerThread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&archive_lock);
+    while (1)
+    {
+        while ((sealed.empty() || writer_stalled) && !stopping)
+        {
+            pthread_cond_wait(&archive_sealed, &archive_lock);
+        }
+        if (sealed.empty() || writer_stalled)
+        {
+            break; // Stopping; archive_close flushed what it could
+        }
+
+        SealedBlock block = std::move(sealed.front());
+        sealed.pop_front();
+        writer_busy = true;
+        pthread_mutex_unlock(&archive_lock);
+
+        bool written = write_block(block, archive_fd, index_fd);
+
+        pthread_mutex_lock(&archive_lock);
+        writer_busy = false;
+        if (!written)
+        {
+            sealed.push_front(std::move(block));
+            writer_stalled = true;
+        }
+        pthread_cond_broadcast(&archive_written);
+    }
+    pthread_mutex_unlock(&archive_lock);
+    return NULL;
+}
+
+bool archive_open(const char *path)
+{
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    int ifd = open(index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat archive_st, index_st;
+    if (fd < 0 || ifd < 0 || fstat(fd, &archive_st) != 0 || fstat(ifd, &index_st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        if (ifd >= 0)
+            close(ifd);
+        return false;
+    }
+
+    // Drop whatever a crash left half written: index entries whose block is
+    // incomplete, then archive bytes no entry points to
+    std::vector<ArchiveIndexEntry> entries(index_st.st_size / sizeof(ArchiveIndexEntry));
+    if (!entries.empty() && pread(ifd, entries.data(), entries.size() * sizeof(ArchiveIndexEntry), 0) < 0)
+    {
+        close(fd);
+        close(ifd);
+        return false;
+    }
+    while (!entries.empty() && entries.back().offset + entries.back().size > (uint64_t)archive_st.st_size)
+    {
+        entries.pop_back();
+    }
+    uint64_t end = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+    if (ftruncate(ifd, entries.size() * sizeof(ArchiveIndexEntry)) != 0 || ftruncate(fd, end) != 0 ||
+        lseek(fd, 0, SEEK_END) < 0 || lseek(ifd, 0, SEEK_END) < 0)
+    {
+        close(fd);
+        close(ifd);
+        return false;
+    }
+
+    pthread_mutex_lock(&archive_lock);
+    archive_end = end;
+    next_game = entries.empty() ? 0 : entries.back().first_game + entries.back().game_count;
+    pending_games = 0;
+    pending.clear();
+    sealed.clear();
+    writer_busy = writer_stalled = stopping = false;
+    archive_fd = fd;
+    index_fd = ifd;
+    pthread_mutex_unlock(&archive_lock);
+    if (pthread_create(&writer_thread, NULL, writerThread, NULL) != 0)
+    {
+        pthread_mutex_lock(&archive_lock);
+        archive_fd = index_fd = -1;
+        pthread_mutex_unlock(&archive_lock);
+        close(fd);
+        close(ifd);
+        return false;
+    }
+    return true;
+}
+
+uint64_t archive_append(const GameSession *session, uint8_t end_reason)
+{
+    if (archive_fd < 0)
+    {
+        return UINT64_MAX; // Archiving is off, skip the replay
+    }
+
+    // Encoding replays the game, done before taking the lock
+    std::vector<uint8_t> bits;
+    int ply = session->ply;
+    if (!archive_encode(session->moves, ply, bits))
+    {
+        return UINT64_MAX;
+    }
+    ArchiveGameHeader header = {session->id, (uint16_t)ply, (uint16_t)bits.size(), end_reason, session->turn};
+
+    pthread_mutex_lock(&archive_lock);
+    if (archive_fd < 0)
+    {
+        pthread_mutex_unlock(&archive_lock);
+        return UINT64_MAX;
+    }
+    uint64_t number = next_game + pending_games;
+    const uint8_t *raw = (const uint8_t *)&header;
+    if (pending_games == 0)
+    {
+        pending_since = time(NULL);
+    }
+    pending.insert(pending.end(), raw, raw + sizeof(header));
+    pending.insert(pending.end(), bits.begin(), bits.end());
+    pending_games++;
+    if (pending_games == ARCHIVE_BLOCK_GAMES)
+    {
+        seal_block();
+        pthread_cond_signal(&archive_sealed);
+    }
+    pthread_mutex_unlock(&archive_lock);
+    return number;
+}
+
+bool archive_flush()
+{
+    pthread_mutex_lock(&archive_lock);
+    bool open = archive_fd >= 0;
+    seal_block();
+    writer_stalled = false;
+    pthread_cond_signal(&archive_sealed);
+    while (open && (writer_busy || (!sealed.empty() && !writer_stalled)))
+    {
+        pthread_cond_wait(&archive_written, &archive_lock);
+    }
+    bool written = open && sealed.empty();
+    pthread_mutex_unlock(&archive_lock);
+    return written;
+}
+
+void archive_tick()
+{
+    pthread_mutex_lock(&archive_lock);
+    if (archive_fd >= 0 && pending_games > 0 && time(NULL) - pending_since >= ARCHIVE_FLUSH_SECONDS)
+    {
+        seal_block();
+    }
+    if (!sealed.empty())
+    {
+        writer_stalled = false; // A failed block is retried about once a second
+        pthread_cond_signal(&archive_sealed);
+    }
+    pthread_mutex_unlock(&archive_lock);
+}
+
+void archive_close()
+{
+    if (archive_fd < 0)
+    {
+        return;
+    }
+    archive_flush();
+    pthread_mutex_lock(&archive_lock);
+    stopping = true;
+    pthread_cond_signal(&archive_sealed);
+    pthread_mutex_unlock(&archive_lock);
+    pthread_join(writer_thread, NULL);
+
+    pthread_mutex_lock(&archive_lock);
+    close(archive_fd);
+    close(index_fd);
+    archive_fd = index_fd = -1;
+    pthread_mutex_unlock(&archive_lock);
+}
+
+// Maps a whole file read-only; an empty file maps to NULL
+static bool map_file(const char *path, int &fd, const uint8_t *&data, size_t &size)
+{
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        return false;
+    }
+    size = st.st_size;
+    data = NULL;
+    if (size > 0)
+    {
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+        data = (const uint8_t *)mapped;
+    }
+    return true;
+}
+
+bool archive_reader_open(ArchiveReader &reader, const char *path)
+{
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    const uint8_t *index_data = NULL;
+    reader.data = NULL;
+    reader.index = NULL;
+    reader.fd = reader.index_fd = -1;
+    if (!map_file(path, reader.fd, reader.data, reader.size) ||
+        !map_file(index_path, reader.index_fd, index_data, reader.index_size))
+    {
+        reader.index = (const ArchiveIndexEntry *)index_data;
+        archive_reader_close(reader);
+        return false;
+    }
+    reader.index = (const ArchiveIndexEntry *)index_data;
+    reader.blocks = reader.index_size / sizeof(ArchiveIndexEntry);
+
+    // Blocks still being written when the archive was mapped are left out
+    while (reader.blocks > 0 &&
+           reader.index[reader.blocks - 1].offset + reader.index[reader.blocks - 1].size > reader.size)
+    {
+        reader.blocks--;
+    }
+    reader.games = 0;
+    if (reader.blocks > 0)
+    {
+        reader.games = reader.index[reader.blocks - 1].first_game + reader.index[reader.blocks - 1].game_count;
+    }
+    reader.cached = reader.blocks;
+    archive_rewind(reader);
+    return true;
+}
+
+void archive_reader_close(ArchiveReader &reader)
+{
+    if (reader.data)
+    {
+        munmap((void *)reader.data, reader.size);
+    }
+    if (reader.index)
+    {
+        munmap((void *)reader.index, reader.index_size);
+    }
+    if (reader.fd >= 0)
+    {
+        close(reader.fd);
+    }
+    if (reader.index_fd >= 0)
+    {
+        close(reader.index_fd);
+    }
+    reader.data = NULL;
+    reader.index = NULL;
+    reader.fd = reader.index_fd = -1;
+    reader.block.clear();
+}
+
+// Inflates block `i` into reader.block
+static bool load_block(ArchiveReader &reader, size_t i)
+{
+    if (reader.cached == i)
+    {
+        return true;
+    }
+    const ArchiveIndexEntry &entry = reader.index[i];
+    ArchiveBlockHeader header;
+    memcpy(&header, reader.data + entry.offset, sizeof(header));
+    if (header.magic != ARCHIVE_MAGIC || sizeof(header) + header.compressed_size > entry.size)
+    {
+        return false;
+    }
+    reader.block.resize(header.raw_size);
+    uLongf raw_size = header.raw_size;
+    if (uncompress(reader.block.data(), &raw_size, reader.data + entry.offset + sizeof(header),
+                   header.compressed_size) != Z_OK ||
+        raw_size != header.raw_size)
+    {
+        reader.cached = reader.blocks;
+        return false;
+    }
+    reader.cached = i;
+    return true;
+}
+
+// Reads the game at `offset` of the inflated block and moves past it
+static bool parse_game(const ArchiveReader &reader, size_t &offset, ArchivedGame &game)
+{
+    if (offset + sizeof(ArchiveGameHeader) > reader.block.size())
+    {
+        return false;
+    }
+    memcpy(&game.header, reader.block.data() + offset, sizeof(game.header));
+    offset += sizeof(game.header);
+    if (offset + game.header.bytes > reader.block.size())
+    {
+        return false;
+    }
+    game.bits = reader.block.data() + offset;
+    offset += game.header.bytes;
+    return true;
+}
+
+bool archive_read(ArchiveReader &reader, uint64_t number, ArchivedGame &game)
+{
+    if (number >= reader.games)
+    {
+        return false;
+    }
+    // Last block starting at or before the game
+    size_t low = 0, high = reader.blocks;
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+        if (reader.index[middle].first_game <= number)
+            low = middle;
+        else
+            high = middle;
+    }
+    if (!load_block(reader, low))
+    {
+        return false;
+    }
+
+    // Headers carry the length of the move bits, so skipping needs no replay
+    size_t offset = 0;
+    for (uint64_t i = reader.index[low].first_game; i <= number; i++)
+    {
+        if (!parse_game(reader, offset, game))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void archive_rewind(ArchiveReader &reader, size_t block)
+{
+    reader.stream_block = block;
+    reader.stream_offset = 0;
+    reader.stream_left = 0;
+}
+
+bool archive_next(ArchiveReader &reader, ArchivedGame &game)
+{
+    while (reader.stream_left == 0)
+    {
+        if (reader.stream_block >= reader.blocks || !load_block(reader, reader.stream_block))
+        {
+            return false;
+        }
+        reader.stream_left = reader.index[reader.stream_block].game_count;
+        reader.stream_offset = 0;
+        reader.stream_block++;
+    }
+    // archive_read() may have inflated another block in between
+    if (!load_block(reader, reader.stream_block - 1))
+    {
+        return false;
+    }
+    reader.stream_left--;
+    return parse_game(reader, reader.stream_offset, game);
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "archive.h"
+#include "metrics.h"
+
+// Reads a game archive written by the server (-a). Without a game number it
+// streams every game and prints totals; with one it prints that game's moves.
+// Streaming walks the game headers only. -d also decodes every game's moves,
+// which replays the game through legal_moves() at every ply and so runs at
+// thousands, not millions, of games per second; both rates are printed.
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Coordinate notation such as "e2e4", files are mirrored on this board
+static void print_move(uint16_t packed)
+{
+    int move[4];
+    unpack_move(packed, move);
+    printf("%c%c%c%c", 'a' + 7 - move[0], '1' + move[1], 'a' + 7 - move[2], '1' + move[3]);
+}
+
+static int print_game(ArchiveReader &reader, uint64_t number)
+{
+    ArchivedGame game;
+    uint16_t moves[UINT16_MAX];
+    if (!archive_read(reader, number, game) || !archive_decode(game, moves))
+    {
+        fprintf(stderr, "Game %llu not found or damaged\n", (unsigned long long)number);
+        return 1;
+    }
+    printf("Game %u: %d moves, ended by %s with %c to move\n", game.header.id, game.header.ply,
+           game.header.end_reason < DISCONNECT_REASONS ? disconnect_reason_name((DisconnectReason)game.header.end_reason) : "?",
+           game.header.turn);
+    for (int i = 0; i < game.header.ply; i++)
+    {
+        if (i % 2 == 0)
+        {
+            printf("%s%d. ", i ? " " : "", i / 2 + 1);
+        }
+        else
+        {
+            printf(" ");
+        }
+        print_move(moves[i]);
+    }
+    printf("\n");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <archive> [game-number | -d]\n", argv[0]);
+        return 1;
+    }
+    bool decode = argc == 3 && strcmp(argv[2], "-d") == 0;
+    ArchiveReader reader;
+    if (!archive_reader_open(reader, argv[1]))
+    {
+        perror("Cannot open archive");
+        return 1;
+    }
+    if (argc == 3 && !decode)
+    {
+        int status = print_game(reader, strtoull(argv[2], NULL, 10));
+        archive_reader_close(reader);
+        return status;
+    }
+
+    // Headers only: lengths and results need no replay
+    double started = now_s();
+    uint64_t games = 0, plies = 0, bytes = 0;
+    uint64_t reasons[DISCONNECT_REASONS + 1] = {};
+    ArchivedGame game;
+    while (archive_next(reader, game))
+    {
+        games++;
+        plies += game.header.ply;
+        bytes += sizeof(game.header) + game.header.bytes;
+        reasons[game.header.end_reason < DISCONNECT_REASONS ? (int)game.header.end_reason : (int)DISCONNECT_REASONS]++;
+    }
+    double elapsed = now_s() - started;
+
+    printf("Games: %llu in %zu blocks, %zu bytes on disk\n", (unsigned long long)games, reader.blocks, reader.size);
+    if (games > 0)
+    {
+        printf("Moves per game: %.1f, bytes per game: %.1f packed, %.1f compressed\n", (double)plies / games,
+               (double)bytes / games, (double)reader.size / games);
+        printf("Headers streamed in %.1f ms (%.1f M games/s)\n", elapsed * 1e3, games / elapsed / 1e6);
+    }
+
+    // Moves: every ply regenerates the legal move list its index points into
+    if (decode && games > 0)
+    {
+        std::vector<uint16_t> moves(UINT16_MAX);
+        uint64_t damaged = 0;
+        archive_rewind(reader);
+        started = now_s();
+        while (archive_next(reader, game))
+        {
+            damaged += !archive_decode(game, moves.data());
+        }
+        elapsed = now_s() - started;
+        printf("Moves decoded in %.1f ms (%.0f games/s, %.2f M moves/s)", elapsed * 1e3, games / elapsed,
+               plies / elapsed / 1e6);
+        if (damaged)
+        {
+            printf(", %llu games damaged", (unsigned long long)damaged);
+        }
+        printf("\n");
+    }
+    for (int i = 0; i < DISCONNECT_REASONS; i++)
+    {
+        if (reasons[i])
+        {
+            printf("  %-14s %llu\n", disconnect_reason_name((DisconnectReason)i), (unsigned long long)reasons[i]);
+        }
+    }
+    archive_reader_close(reader);
+    return 0;
+}
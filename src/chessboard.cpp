@@ -1,9 +1,10 @@
 #include "chessboard.h"
+#include "trace.h"
 #include <stdio.h>
+#include <ctype.h>
 
 // Type definition for the chessboard
-// Chessboard is represented as a 2D vector of `Piece` objects.
-using Chessboard = std::vector<std::vector<Piece>>;
+// Chessboard is represented as a fixed 8x8 array of `Piece` objects.
 
 // Function declarations for checking moves and game state
 bool check(Chessboard& board, char turn, int king_pos[2]); // Check if the current player's king is in check
@@ -17,7 +18,7 @@ bool can_king_move(const Chessboard &board, const int move[4]);   // Check if a
 // Function to initialize the chessboard with pieces in their starting positions
 Chessboard initializeBoard()
 {
-    Chessboard board(8, std::vector<Piece>(8, Piece())); // Create an 8x8 chessboard initialized with empty pieces
+    Chessboard board; // Create an 8x8 chessboard initialized with empty pieces
 
     // Set pawns
     for (int i = 0; i < 8; i++)
@@ -44,7 +45,7 @@ Chessboard initializeBoard()
 }
 Chessboard initializeEndgameBoard()
 {
-    Chessboard board(8, std::vector<Piece>(8, Piece())); // Create an 8x8 chessboard initialized with empty pieces
+    Chessboard board; // Create an 8x8 chessboard initialized with empty pieces
 
     // Set white pieces
     board[0][3] = Piece('K', 'w'); // White king
@@ -56,9 +57,106 @@ Chessboard initializeEndgameBoard()
     return board; // Return the initialized chessboard
 }
 
+// Function to load a position from FEN (piece placement and side to move)
+// Castling rights, en passant and move counters are ignored, the rules don't model them
+bool boardFromFen(const char *fen, Chessboard &board, char &turn)
+{
+    board = Chessboard();
+    int rank = 7, file = 0;
+    const char *p = fen;
+
+    for (; *p && *p != ' '; p++)
+    {
+        if (*p == '/')
+        {
+            if (file != 8 || rank == 0) return false; // Incomplete rank
+            rank--;
+            file = 0;
+            continue;
+        }
+        if (isdigit((unsigned char)*p))
+        {
+            file += *p - '0'; // Run of empty squares
+            if (file > 8) return false;
+            continue;
+        }
+        if (file >= 8) return false;
+
+        char type;
+        switch (tolower((unsigned char)*p))
+        {
+        case 'p': type = 'p'; break;
+        case 'n': type = 'k'; break; // Knights are 'k' on this board
+        case 'b': type = 'b'; break;
+        case 'r': type = 'r'; break;
+        case 'q': type = 'q'; break;
+        case 'k': type = 'K'; break;
+        default: return false;
+        }
+        // Files are mirrored: the a-file is column 7
+        board[rank][7 - file] = Piece(type, isupper((unsigned char)*p) ? 'w' : 'b');
+        file++;
+    }
+    if (rank != 0 || file != 8) return false;
+
+    turn = 'w';
+    if (*p == ' ' && (p[1] == 'w' || p[1] == 'b'))
+    {
+        turn = p[1];
+    }
+    return true;
+}
+
+void boardToFen(const Chessboard &board, char turn, char fen[FEN_SIZE])
+{
+    char *out = fen;
+    for (int rank = 7; rank >= 0; rank--)
+    {
+        int empty = 0;
+        for (int file = 0; file < 8; file++)
+        {
+            const Piece &piece = board[rank][7 - file];
+            if (piece.type == 'e')
+            {
+                empty++;
+                continue;
+            }
+            if (empty)
+            {
+                *out++ = '0' + empty;
+                empty = 0;
+            }
+            char letter = (piece.type == 'k') ? 'n' : (piece.type == 'K') ? 'k' : piece.type;
+            *out++ = (piece.color == 'w') ? toupper((unsigned char)letter) : letter;
+        }
+        if (empty)
+        {
+            *out++ = '0' + empty;
+        }
+        if (rank > 0)
+        {
+            *out++ = '/';
+        }
+    }
+    *out++ = ' ';
+    *out++ = turn;
+    *out = 0;
+}
+
+void moveToUci(const Chessboard &board, const int move[4], char text[UCI_MOVE_SIZE])
+{
+    text[0] = 'a' + 7 - move[0];
+    text[1] = '1' + move[1];
+    text[2] = 'a' + 7 - move[2];
+    text[3] = '1' + move[3];
+    bool promotes = board[move[1]][move[0]].type == 'p' && (move[3] == 0 || move[3] == 7);
+    text[4] = promotes ? 'q' : 0;
+    text[5] = 0;
+}
+
 // Function to create a deep copy of the chessboard
 Chessboard deepCopyBoard(const Chessboard &board) {
-    Chessboard newBoard(8, std::vector<Piece>(8, Piece())); // Create an 8x8 chessboard initialized with empty pieces
+    Chessboard newBoard; // Create an 8x8 chessboard initialized with empty pieces
 
     // Copy the state of each piece from the original board to the new board
     for (int row = 0; row < 8; ++row) {
@@ -386,6 +484,7 @@ bool stalemate(Chessboard &board, char turn, int king_pos[]) {
 }
 
 char gameDecider(Chessboard &board, char turn){
+    TRACE_SCOPE("gameDecider");
     int king_pos[2];
     king_position(board, turn, king_pos);
 
@@ -405,6 +504,7 @@ char gameDecider(Chessboard &board, char turn){
 
 bool can_move(Chessboard &board, int move[4], char turn)
 {
+    TRACE_SCOPE("can_move");
 
     bool state = false;
     int x1 = move[0];
@@ -473,3 +573,122 @@ bool can_move(Chessboard &board, int move[4], char turn)
 
     return state;
 }
+
+// Function to collect every legal move of `turn` as {startX, startY, targetX, targetY}
+// Returns the number of legal moves; at most `max_moves` of them are stored
+int legal_moves(const Chessboard &board, char turn, int moves[][4], int max_moves)
+{
+    TRACE_SCOPE("legal_moves");
+    Chessboard tempBoard = board;
+    int count = 0;
+
+    for (int y1 = 0; y1 < 8; y1++) {
+        for (int x1 = 0; x1 < 8; x1++) {
+            if (board[y1][x1].color != turn) continue;
+            for (int y2 = 0; y2 < 8; y2++) {
+                for (int x2 = 0; x2 < 8; x2++) {
+                    if (x1 == x2 && y1 == y2) continue;
+                    int move[4] = {x1, y1, x2, y2};
+                    if (can_move(tempBoard, move, turn)) {
+                        if (count < max_moves) {
+                            memcpy(moves[count], move, sizeof(move));
+                        }
+                        count++;
+                        tempBoard = board; // can_move applied the move, restore the position
+                    }
+                }
+            }
+        }
+    }
+
+    return count < max_moves ? count : max_moves;
+}
+
+void legal_move_set(const Chessboard &board, char turn, LegalMoves &legal)
+{
+    TRACE_SCOPE("legal_move_set");
+    Chessboard tempBoard = board;
+    memset(&legal, 0, sizeof(legal));
+    int pieces = 0;
+
+    for (int y1 = 0; y1 < 8; y1++) {
+        for (int x1 = 0; x1 < 8; x1++) {
+            if (board[y1][x1].color != turn) continue;
+            uint64_t targets = 0;
+            for (int y2 = 0; y2 < 8; y2++) {
+                for (int x2 = 0; x2 < 8; x2++) {
+                    if (x1 == x2 && y1 == y2) continue;
+                    int move[4] = {x1, y1, x2, y2};
+                    if (can_move(tempBoard, move, turn)) {
+                        targets |= 1ULL << (y2 * 8 + x2);
+                        tempBoard = board; // can_move applied the move, restore the position
+                    }
+                }
+            }
+            if (targets && pieces < 16) {
+                legal.from |= 1ULL << (y1 * 8 + x1);
+                legal.targets[pieces++] = targets;
+            }
+        }
+    }
+}
+
+uint64_t legal_targets(const LegalMoves &legal, int x, int y)
+{
+    if (x < 0 || x > 7 || y < 0 || y > 7) return 0;
+    uint64_t bit = 1ULL << (y * 8 + x);
+    if (!(legal.from & bit)) return 0;
+    // Index of the square among the movable ones
+    return legal.targets[__builtin_popcountll(legal.from & (bit - 1))];
+}
+
+bool legal_move_allowed(const LegalMoves &legal, const int move[4])
+{
+    if (move[2] < 0 || move[2] > 7 || move[3] < 0 || move[3] > 7) return false;
+    return (legal_targets(legal, move[0], move[1]) >> (move[3] * 8 + move[2])) & 1;
+}
+
+// Key index of a piece, -1 for empty squares
+static int zobrist_piece(const Piece &piece)
+{
+    const char *types = "pkbrqK";
+    const char *found = (piece.type != 'e' && piece.type != '\0') ? strchr(types, piece.type) : NULL;
+    if (!found || (piece.color != 'w' && piece.color != 'b')) return -1;
+    return (int)(found - types) + (piece.color == 'b' ? 6 : 0);
+}
+
+struct ZobristKeys {
+    uint64_t pieces[12][64];
+    uint64_t black_to_move;
+
+    ZobristKeys()
+    {
+        uint64_t state = 0x9E3779B97F4A7C15ULL;
+        for (int piece = 0; piece < 12; piece++)
+            for (int square = 0; square < 64; square++)
+                pieces[piece][square] = next(state);
+        black_to_move = next(state);
+    }
+
+    // splitmix64
+    static uint64_t next(uint64_t &state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+static const ZobristKeys zobrist_keys;
+
+uint64_t position_hash(const Chessboard &board, char turn)
+{
+    uint64_t hash = turn == 'b' ? zobrist_keys.black_to_move : 0;
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            int piece = zobrist_piece(board[y][x]);
+            if (piece >= 0) hash ^= zobrist_keys.pieces[piece][y * 8 + x];
+        }
+    }
+    return hash;
+}
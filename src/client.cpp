@@ -9,75 +9,149 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <time.h>
+#include <atomic>
 
 #include "interface.h"
+#include "protocol.h"
 
 // Function declarations
-int connect_to_server(struct sockaddr_in sa, int *SocketFD, char& side, const char* ip, int port);
+int connect_to_server(struct sockaddr_in sa, int *SocketFD, char& side, const char* ip, int port, long gameId);
 void disconnect(int &SocketFD);
 void *gameSessionThread(void *arg);
+void *atlasThread(void *arg);
 
 // Global variables to manage game state
-static char side, side_r; // Player's side ('w' for white, 'b' for black) and received turn
-static int turn;          // Current player's turn (1 if player's turn, 0 otherwise)
-static int w_open;        // Window open status
-static Chessboard board;  // Game board instance
+static char side;                // Player's side ('w' for white, 'b' for black, 'v' for spectator)
+static std::atomic<int> turn;    // Current player's turn (1 if player's turn, 0 otherwise, -1 when the game is over)
+static std::atomic<int> w_open;  // Window open status
+static std::atomic<int> server_fd(-1); // Connection moves are sent on, replaced when the network thread reattaches
+static const char *server_ip;    // Reattaching reconnects here, on ATTACH_PORT
+static uint64_t resume_token;    // Sent by the server after the initial board, 0 for spectators
+
+// One server update as the renderer sees it
+struct Snapshot {
+    Chessboard board;
+    LegalMoves legal;     // Moves the server accepts from the side to move
+    char status;          // Side to move, or 'c' / 's' once the game is decided
+    uint32_t generation;  // Number of updates published so far, 0 before the first
+};
+
+// Triple buffer between the network thread and the renderer. The network
+// thread fills its back slot and swaps it with the shared middle slot; the
+// renderer swaps its front slot with the middle one when a newer snapshot
+// is there. Neither side waits, and a slot is never written while read.
+#define SNAPSHOT_NEW 4 // Set in `snapshot_middle` when the middle slot holds an unread snapshot
+static Snapshot snapshots[3];
+static std::atomic<int> snapshot_middle(1);
+static int snapshot_back = 0;  // Network thread only
+static int snapshot_front = 2; // Renderer only
+
+// Network thread: makes the back slot visible to the renderer
+static void snapshot_publish()
+{
+    int previous = snapshot_middle.exchange(snapshot_back | SNAPSHOT_NEW, std::memory_order_acq_rel);
+    snapshot_back = previous & 3;
+}
+
+// Renderer: switches to the newest published snapshot, if there is one
+static const Snapshot &snapshot_latest()
+{
+    if (snapshot_middle.load(std::memory_order_relaxed) & SNAPSHOT_NEW)
+    {
+        int previous = snapshot_middle.exchange(snapshot_front, std::memory_order_acq_rel);
+        snapshot_front = previous & 3;
+    }
+    return snapshots[snapshot_front];
+}
+
+#define IDLE_POLL_US 10000        // Event and board polling interval while nothing changes
+#define PREDICTION_TIMEOUT_MS 3000 // Drop a predicted move the server has not answered by then
+#define REATTACH_ATTEMPTS 8         // Connection attempts before giving up on a dropped game
+#define REATTACH_BACKOFF_MS 100     // First retry delay, doubled after every failed attempt
+
+static double elapsed_ms(const struct timespec &since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since.tv_sec) * 1e3 + (now.tv_nsec - since.tv_nsec) / 1e6;
+}
 
 int main(int argc, char const *argv[])
 {
-    if (argc != 3) {
-        printf("Usage: %s <ip> <port>\n", argv[0]);
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    if (argc != 3 && argc != 4) {
+        printf("Usage: %s <ip> <port> [game-id]\n", argv[0]);
+        printf("With a game id the client watches that game through the server's attach port.\n");
         return 1;
     }
 
     const char* ip = argv[1];
+    server_ip = ip;
     int port = atoi(argv[2]);
+    long gameId = (argc == 4) ? atol(argv[3]) : -1; // Game to watch, -1 to play
 
-    board = initializeBoard(); // Initialize the chessboard
-    w_open = 1;                // Mark the window as open
+    w_open = 1; // Mark the window as open
     struct sockaddr_in *sa = (sockaddr_in *)malloc(sizeof(sockaddr_in));
     int *SocketFD = (int *)malloc(sizeof(int));
 
-    sf::Texture chessboardTexture;                   // Chessboard texture
-    std::map<std::string, sf::Texture> pieceTexture; // Textures for chess pieces
+    // Decode the embedded images while the window opens and the server pairs us
+    AtlasImage atlas;
+    pthread_t atlas_thread;
+    pthread_create(&atlas_thread, 0, atlasThread, &atlas);
+
+    BoardView view; // Atlas and vertices of the board
     sf::RenderWindow window;
-    window_init(window);                          // Initialize the SFML window
-    load_pieces(pieceTexture, chessboardTexture); // Load chess piece textures
+    window_init(window); // Initialize the SFML window
 
     sf::Vector2i clickPos(-1, -1);   // Position of mouse click
     sf::Vector2i releasePos(-1, -1); // Position of mouse release
+    uint64_t targets = 0;            // Legal destinations of the dragged piece
 
-    turn = connect_to_server(*sa, SocketFD, side, ip, port); // Connect to the server and determine player's side
+    turn = connect_to_server(*sa, SocketFD, side, ip, port, gameId); // Connect to the server and determine player's side
+    server_fd = *SocketFD;
     pthread_t thread_id;
-    pthread_create(&thread_id, 0, gameSessionThread, SocketFD); // Start a thread for managing game state
+    pthread_create(&thread_id, 0, gameSessionThread, SocketFD); // Receives the initial board and every later update
 
-    // Deserialize the initial board state
-    int data[128] = {0};
-    int bytesReceived = recv(*SocketFD, data, 128 * sizeof(int), 0);
-    if (bytesReceived < 0)
+    void *decoded;
+    pthread_join(atlas_thread, &decoded);
+    if (!decoded || !board_view_load(view, atlas))
     {
-        perror("Error receiving data");
-    }
-    else if (bytesReceived < 128 * sizeof(int))
-    {
-        printf("Partial data received: %d bytes\n", bytesReceived);
+        exit(EXIT_FAILURE);
     }
+    bool firstFrame = true;
 
-    deserializeChessboard(data, board); // Load board state from received data
+    uint32_t shownGeneration = 0; // Snapshot currently on screen
+    uint64_t shownTargets = 0;
+    bool shownPrediction = false;
 
+    // Our own move is shown as soon as it is dropped, on a copy of the board
+    // it was made on, until the server's next update replaces it
+    Chessboard predicted;
+    bool predicting = false;
+    uint32_t predictedFrom = 0; // Generation the predicted move was made on
+    struct timespec predictedAt;
+    bool redraw = false;
     while (window.isOpen())
     {
+        // The front snapshot stays put until the next call, no copy needed
+        const Snapshot &current = snapshot_latest();
         sf::Event event;
-        window_display(window, pieceTexture, chessboardTexture, board, side); // Display the game state
         while (window.pollEvent(event))
         {
+            if (event.type != sf::Event::MouseMoved)
+            {
+                redraw = true; // Input, resize or the window being uncovered
+            }
             if (event.type == sf::Event::Closed)
             {
-                // Handle window close event
-                if (turn != 1)
+                // Handle window close event, leave explicitly, a dropped connection keeps the seat for a while
+                if (turn != -1)
                 {
                     int msg[4] = {-1, -1, -1, -1};        // Disconnection message
-                    send(*SocketFD, &msg, sizeof msg, 0); // Notify server
+                    send(server_fd, &msg, sizeof msg, MSG_NOSIGNAL); // Notify server
                 }
                 w_open = 0; // Close the window
                 window.close();
@@ -91,7 +165,7 @@ int main(int argc, char const *argv[])
                 break;
             }
 
-            if (turn == 1)
+            if (current.status == side && !predicting)
             {
                 // Handle player's move
                 if (event.type == sf::Event::MouseButtonPressed)
@@ -99,6 +173,9 @@ int main(int argc, char const *argv[])
                     if (event.mouseButton.button == sf::Mouse::Left)
                     {
                         clickPos = pixelToGrid(sf::Mouse::getPosition(window)); // Record mouse click position
+                        int x = (side == 'w') ? 7 - clickPos.x : clickPos.x;
+                        int y = (side == 'w') ? 7 - clickPos.y : clickPos.y;
+                        targets = legal_targets(current.legal, x, y); // Highlight while dragging
                     }
                 }
                 if (event.type == sf::Event::MouseButtonReleased)
@@ -121,21 +198,79 @@ int main(int argc, char const *argv[])
                             msg[2] = releasePos.x;
                             msg[3] = releasePos.y;
                         }
-                        send(*SocketFD, &msg, sizeof msg, 0); // Send move to server
+                        targets = 0;
+                        // Illegal drops never leave the client
+                        if (legal_move_allowed(current.legal, msg))
+                        {
+                            send(server_fd, &msg, sizeof msg, MSG_NOSIGNAL); // Send move to server
+                            // Same rules as the server, so the result is known before it answers
+                            predicted = current.board;
+                            predicting = can_move(predicted, msg, side);
+                            predictedFrom = current.generation;
+                            clock_gettime(CLOCK_MONOTONIC, &predictedAt);
+                        }
                     }
                 }
             }
         }
-        window_display(window, pieceTexture, chessboardTexture, board, side); // Update display after events
+        if (!window.isOpen())
+        {
+            break;
+        }
+
+        // The server's update is authoritative: keep the prediction only until it arrives
+        if (predicting && current.generation != predictedFrom)
+        {
+            if (memcmp(&predicted, &current.board, sizeof(predicted)) != 0)
+            {
+                printf("Server position differs from the predicted move, rolled back.\n");
+            }
+            predicting = false;
+        }
+        else if (predicting && elapsed_ms(predictedAt) > PREDICTION_TIMEOUT_MS)
+        {
+            printf("Move not confirmed by the server, rolled back.\n");
+            predicting = false;
+        }
+
+        // Rebuild the vertices only when the shown position or the highlight changed
+        if (current.generation == 0)
+        {
+            redraw = false; // Nothing received yet
+        }
+        else if (shownGeneration != current.generation || shownTargets != targets || shownPrediction != predicting)
+        {
+            shownGeneration = current.generation;
+            shownTargets = targets;
+            shownPrediction = predicting;
+            board_view_update(view, predicting ? predicted : current.board, side, shownTargets);
+            redraw = true;
+        }
+        if (redraw)
+        {
+            board_view_draw(window, view); // Capped at FRAME_LIMIT
+            redraw = false;
+            if (firstFrame)
+            {
+                printf("First frame %.1f ms after start.\n", elapsed_ms(started));
+                firstFrame = false;
+            }
+        }
+        else
+        {
+            usleep(IDLE_POLL_US); // Nothing to draw, wait for input or a board update
+        }
     }
 
-    disconnect(*SocketFD); // Disconnect from server
+    w_open = 0;
+    int SocketFDNow = server_fd; // The network thread may have reattached meanwhile
+    disconnect(SocketFDNow); // Disconnect from server
 
     return 0;
 }
 
-// Connect to the server and retrieve the player's side
-int connect_to_server(struct sockaddr_in sa, int *SocketFD, char& side, const char* ip, int port){
+// Connect to the server and retrieve the player's side; a non-negative gameId subscribes as a spectator
+int connect_to_server(struct sockaddr_in sa, int *SocketFD, char& side, const char* ip, int port, long gameId){
     
     *SocketFD = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP); // Create socket
     if (*SocketFD == -1) {
@@ -158,8 +293,23 @@ int connect_to_server(struct sockaddr_in sa, int *SocketFD, char& side, const ch
         printf("Connection accepted \n");
     }
 
+    if (gameId >= 0) {
+        // Ask to watch the game instead of joining one
+        char request = REQUEST_SPECTATE;
+        uint32_t id = (uint32_t)gameId;
+        send(*SocketFD, &request, sizeof(request), 0);
+        send(*SocketFD, &id, sizeof(id), 0);
+    }
+
     recv(*SocketFD, &side, sizeof(char), 0); // Receive player side from server
-    if (side == 'w') {
+    if (side == REQUEST_SPECTATE) {
+        printf("Watching game %ld.\n", gameId);
+        return 0;
+    } else if (side == 'e') {
+        printf("Game not found or server full.\n");
+        close(*SocketFD);
+        exit(EXIT_FAILURE);
+    } else if (side == 'w') {
         printf("You play as White!\n");
         return 1;
     } else {
@@ -169,32 +319,120 @@ int connect_to_server(struct sockaddr_in sa, int *SocketFD, char& side, const ch
 }
 
 
+// Builds the atlas off the main thread, returns the atlas or NULL on failure
+void *atlasThread(void *arg)
+{
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    AtlasImage *atlas = (AtlasImage *)arg;
+    if (!atlas_build(*atlas))
+    {
+        return NULL;
+    }
+    printf("Images decoded in %.1f ms.\n", elapsed_ms(started));
+    return atlas;
+}
+
 // Disconnect from the server
 void disconnect(int &SocketFD)
 {
     close(SocketFD);
 }
 
+// Receive the rest of a frame: the board and the legal moves, into the back snapshot
+static bool receive_position(int SocketFD, char status, uint32_t generation)
+{
+    int data[128];
+    Snapshot &next = snapshots[snapshot_back];
+    if (recv(SocketFD, data, sizeof(data), MSG_WAITALL) != sizeof(data) ||
+        recv(SocketFD, &next.legal, sizeof(next.legal), MSG_WAITALL) != sizeof(next.legal))
+    {
+        return false;
+    }
+    deserializeChessboard(data, next.board);
+    next.status = status;
+    next.generation = generation;
+    snapshot_publish();
+    return true;
+}
+
+// Asks the server for our seat back after the connection dropped. On success
+// the snapshot is published, `status` holds the side to move and the new
+// socket is returned; -1 when the game is gone or the server unreachable.
+static int reattach(char &status, uint32_t generation)
+{
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sin_addr.s_addr = inet_addr(server_ip);
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(ATTACH_PORT);
+
+    int backoff = REATTACH_BACKOFF_MS;
+    for (int attempt = 0; resume_token != 0 && w_open && attempt < REATTACH_ATTEMPTS; attempt++)
+    {
+        int SocketFD = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (SocketFD >= 0 && connect(SocketFD, (struct sockaddr *)&sa, sizeof sa) == 0)
+        {
+            char request = REQUEST_RESUME;
+            char header[2] = {0, 0};
+            int32_t clocks[2];
+            send(SocketFD, &request, sizeof(request), MSG_NOSIGNAL);
+            send(SocketFD, &resume_token, sizeof(resume_token), MSG_NOSIGNAL);
+            if (recv(SocketFD, header, 1, MSG_WAITALL) == 1 && header[0] == 'e')
+            {
+                close(SocketFD);
+                return -1; // The game ended while we were away
+            }
+            if (header[0] == REQUEST_RESUME &&
+                recv(SocketFD, header + 1, 1, MSG_WAITALL) == 1 &&
+                recv(SocketFD, clocks, sizeof(clocks), MSG_WAITALL) == sizeof(clocks) &&
+                recv(SocketFD, &status, 1, MSG_WAITALL) == 1 &&
+                receive_position(SocketFD, status, generation))
+            {
+                printf("Reattached in %.1f ms.\n", elapsed_ms(started));
+                if (clocks[0] > 0 || clocks[1] > 0)
+                {
+                    printf("Clocks: White %.1f s, Black %.1f s.\n", clocks[0] / 1000.0, clocks[1] / 1000.0);
+                }
+                return SocketFD;
+            }
+        }
+        if (SocketFD >= 0)
+        {
+            close(SocketFD);
+        }
+        usleep(backoff * 1000);
+        backoff *= 2;
+    }
+    return -1;
+}
+
 // Thread function to handle incoming messages from the server
 void *gameSessionThread(void *arg)
 {
     int SocketFD = *((int *)(arg));
-    int data[128] = {0};
+    uint32_t generation = 1;
+    char side_r;       // Received turn
+    char toMove = 'w'; // Side to move before the latest update
+
+    // The initial board follows the side byte, White moves first; players
+    // also get the token that lets them reattach
+    if (!receive_position(SocketFD, 'w', generation++) ||
+        (side != REQUEST_SPECTATE &&
+         recv(SocketFD, &resume_token, sizeof(resume_token), MSG_WAITALL) != sizeof(resume_token)))
+    {
+        printf("Server disconnected! Exiting...\n");
+        turn = -1;
+        w_open = 0;
+        pthread_exit(NULL);
+    }
+
     while (w_open)
     {
-        memset(&side_r, 0, sizeof side_r);
-        memset(&data, 0, sizeof data);
         int n = recv(SocketFD, &side_r, sizeof side_r, 0);
-        if (n <= 0)
-        {
-            // Server disconnected
-            printf("Server disconnected! Exiting...\n");
-            turn = -1;  // Set turn to -1 to indicate disconnection
-            w_open = 0; // Close the window
-            pthread_exit(NULL);
-        }
-
-        if (side_r == 'e')
+        if (n > 0 && side_r == 'e')
         {
             // Server signaled end of session
             printf("Game session ended by server.\n");
@@ -202,7 +440,30 @@ void *gameSessionThread(void *arg)
             w_open = 0; // Close the window
             pthread_exit(NULL);
         }
-        else if (side_r == 'c')
+
+        // Receive updated board state and publish it to the renderer
+        if (n <= 0 || !receive_position(SocketFD, side_r, generation))
+        {
+            if (!w_open)
+            {
+                break; // Closed by the window
+            }
+            // Connection lost, the server keeps our seat for a while
+            close(SocketFD);
+            printf("Connection lost, reattaching...\n");
+            SocketFD = reattach(side_r, generation);
+            if (SocketFD < 0)
+            {
+                printf("Server disconnected! Exiting...\n");
+                turn = -1;  // Set turn to -1 to indicate disconnection
+                w_open = 0; // Close the window
+                pthread_exit(NULL);
+            }
+            server_fd = SocketFD;
+        }
+        generation++;
+
+        if (side_r == 'c')
         {
             // Checkmate signal
             printf("Checkmate!\n");
@@ -214,29 +475,23 @@ void *gameSessionThread(void *arg)
             printf("Stalemate!\n");
             w_open = 0; // Close the window
         }
+        else if (side_r == 't')
+        {
+            // The side to move ran out of time
+            printf("%s lost on time!\n", toMove == 'w' ? "White" : "Black");
+            w_open = 0; // Close the window
+        }
         else if (side == side_r)
         {
             turn = 1; // It's this client's turn
+            toMove = side_r;
         }
         else
         {
             turn = 0; // It's the other client's turn
+            toMove = side_r;
         }
-
-        // Receive updated board state
-        n = recv(SocketFD, data, 128 * sizeof(int), 0);
-        if (n <= 0)
-        {
-            // Server disconnected
-            printf("Server disconnected! Exiting...\n");
-            turn = -1;
-            w_open = 0; // Close the window
-            pthread_exit(NULL);
-        }
-
-        deserializeChessboard(data, board); // Update the board
     }
 
-    close(SocketFD);    // Close the socket
-    pthread_exit(NULL); // Exit the thread
+    pthread_exit(NULL); // Exit the thread, main closes the socket
 }
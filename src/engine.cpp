@@ -0,0 +1,426 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#include "chessboard.h"
+#include "search.h"
+
+// UCI front end of the project's search, so the engine can be run by
+// tournament managers and profiled offline. The search plays by the
+// server's rules only. Moves those rules lack (castling, en passant,
+// promotion) are still applied when a GUI sends them, so the position stays
+// in step with the game. Threads > 1 runs helper searches on the same
+// transposition table (lazy SMP); the main thread's result is played.
+// Tuned evaluation tables (chess_tune) are loaded with -e at startup or the
+// EvalFile option.
+
+#define ENGINE_NAME "chess_engine"
+#define DEFAULT_HASH_MB 16
+#define MAX_HASH_MB 65536
+#define MAX_THREADS 256
+#define BENCH_DEPTH 5
+#define MOVE_OVERHEAD_MS 30 // Kept back from the clock for the reply to reach the GUI
+
+// Positions searched by `bench`, a mix of openings, middlegames and endgames
+static const char *benchPositions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w",
+    "r2q1rk1/pp2bppp/2n1pn2/3p4/3P4/2NBPN2/PP3PPP/R2Q1RK1 b",
+    "2r3k1/1q1nbppp/r3p3/3pP3/pPpP4/P1Q2N2/2RN1PPP/2R4K b",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w",
+};
+
+struct Engine {
+    Chessboard board;
+    char turn;
+    EvalParams params;
+    SearchTable table;
+    int threads;
+    SearchLimits limits;
+    bool infinite;               // Keeps the result until `stop`
+    std::atomic<bool> stop;
+    pthread_t thread;
+    bool searching;
+};
+
+static Engine engine;
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Applies a move in coordinate notation (e2e4, e7e8q); false if it is malformed
+static bool apply_move(const char *text)
+{
+    if (strlen(text) < 4)
+    {
+        return false;
+    }
+    int move[4] = {7 - (text[0] - 'a'), text[1] - '1', 7 - (text[2] - 'a'), text[3] - '1'};
+    for (int k = 0; k < 4; k++)
+    {
+        if (move[k] < 0 || move[k] > 7)
+        {
+            return false;
+        }
+    }
+    Chessboard &board = engine.board;
+    Piece piece = board[move[1]][move[0]];
+    if (piece.color != engine.turn)
+    {
+        return false;
+    }
+    Chessboard next = board;
+    if (!can_move(next, move, engine.turn))
+    {
+        // Outside the server's rules: take the GUI's word for it
+        next = board;
+        if (piece.type == 'K' && abs(move[2] - move[0]) == 2)
+        {
+            int rook = (move[2] < move[0]) ? 0 : 7;
+            next[move[1]][(move[0] + move[2]) / 2] = next[move[1]][rook];
+            next[move[1]][rook] = Piece();
+        }
+        if (piece.type == 'p' && move[0] != move[2] && next[move[3]][move[2]].type == 'e')
+        {
+            next[move[1]][move[2]] = Piece(); // En passant
+        }
+        next[move[3]][move[2]] = piece;
+        next[move[1]][move[0]] = Piece();
+    }
+    if (piece.type == 'p' && text[4] && (move[3] == 0 || move[3] == 7))
+    {
+        char type = (text[4] == 'n') ? 'k' : text[4];
+        if (type == 'k' || type == 'b' || type == 'r' || type == 'q')
+        {
+            next[move[3]][move[2]].type = type;
+        }
+    }
+    board = next;
+    engine.turn = (engine.turn == 'w') ? 'b' : 'w';
+    return true;
+}
+
+static void print_score(int score)
+{
+    if (score > SEARCH_MATE - SEARCH_MAX_DEPTH - SEARCH_QUIESCENCE_DEPTH)
+    {
+        printf("score mate %d", (SEARCH_MATE - score + 1) / 2);
+    }
+    else if (score < -SEARCH_MATE + SEARCH_MAX_DEPTH + SEARCH_QUIESCENCE_DEPTH)
+    {
+        printf("score mate %d", -(SEARCH_MATE + score) / 2);
+    }
+    else
+    {
+        printf("score cp %d", score);
+    }
+}
+
+struct Helper {
+    pthread_t thread;
+    SearchResult result;
+};
+
+static void *helperThread(void *arg)
+{
+    Helper *helper = (Helper *)arg;
+    SearchLimits limits = engine.limits;
+    limits.nodes = 0;
+    limits.movetime_ms = 0; // The main search decides when all stop
+    search(engine.board, engine.turn, limits, engine.params, helper->result);
+    return NULL;
+}
+
+static void *searchThread(void *)
+{
+    int64_t started = now_ms();
+    std::vector<Helper> helpers(engine.threads - 1);
+    for (Helper &helper : helpers)
+    {
+        pthread_create(&helper.thread, NULL, helperThread, &helper);
+    }
+    SearchResult result;
+    search(engine.board, engine.turn, engine.limits, engine.params, result);
+    while (engine.infinite && !engine.stop.load())
+    {
+        usleep(1000);
+    }
+    engine.stop.store(true);
+    uint64_t nodes = result.nodes;
+    for (Helper &helper : helpers)
+    {
+        pthread_join(helper.thread, NULL);
+        nodes += helper.result.nodes;
+    }
+
+    int64_t elapsed = now_ms() - started;
+    printf("info depth %d ", result.depth);
+    print_score(result.score);
+    printf(" nodes %llu nps %llu time %lld", (unsigned long long)nodes,
+           (unsigned long long)(nodes * 1000 / (elapsed > 0 ? elapsed : 1)), (long long)elapsed);
+    char text[UCI_MOVE_SIZE] = "0000";
+    if (result.has_move)
+    {
+        moveToUci(engine.board, result.move, text);
+        printf(" pv %s", text);
+    }
+    printf("\nbestmove %s\n", text);
+    fflush(stdout);
+    return NULL;
+}
+
+static void stop_search()
+{
+    if (engine.searching)
+    {
+        engine.stop.store(true);
+        pthread_join(engine.thread, NULL);
+        engine.searching = false;
+    }
+}
+
+static void set_position(char **tokens, int count)
+{
+    int i = 1;
+    if (i < count && strcmp(tokens[i], "startpos") == 0)
+    {
+        engine.board = initializeBoard();
+        engine.turn = 'w';
+        i++;
+    }
+    else if (i < count && strcmp(tokens[i], "fen") == 0)
+    {
+        // boardFromFen reads the placement and the side to move of "<placement> <side> ..."
+        char fen[128] = "";
+        for (i++; i < count && strcmp(tokens[i], "moves") != 0; i++)
+        {
+            if (strlen(fen) + strlen(tokens[i]) + 2 < sizeof(fen))
+            {
+                strcat(fen, fen[0] ? " " : "");
+                strcat(fen, tokens[i]);
+            }
+        }
+        if (!boardFromFen(fen, engine.board, engine.turn))
+        {
+            printf("info string invalid fen %s\n", fen);
+            fflush(stdout);
+            return;
+        }
+    }
+    if (i < count && strcmp(tokens[i], "moves") == 0)
+    {
+        for (i++; i < count; i++)
+        {
+            if (!apply_move(tokens[i]))
+            {
+                printf("info string invalid move %s\n", tokens[i]);
+                fflush(stdout);
+                return;
+            }
+        }
+    }
+}
+
+static void go(char **tokens, int count)
+{
+    SearchLimits limits = {0, 0, 0, &engine.stop, &engine.table};
+    int64_t time_left = 0, increment = 0;
+    int moves_to_go = 30;
+    engine.infinite = false;
+    for (int i = 1; i < count; i++)
+    {
+        const char *name = tokens[i];
+        long long value = (i + 1 < count) ? atoll(tokens[i + 1]) : 0;
+        if (strcmp(name, "infinite") == 0)
+        {
+            engine.infinite = true;
+            continue;
+        }
+        if (strcmp(name, "depth") == 0) limits.depth = (int)value;
+        else if (strcmp(name, "nodes") == 0) limits.nodes = (uint64_t)value;
+        else if (strcmp(name, "movetime") == 0) limits.movetime_ms = value;
+        else if (strcmp(name, engine.turn == 'w' ? "wtime" : "btime") == 0) time_left = value;
+        else if (strcmp(name, engine.turn == 'w' ? "winc" : "binc") == 0) increment = value;
+        else if (strcmp(name, "movestogo") == 0 && value > 0) moves_to_go = (int)value;
+        else continue;
+        i++;
+    }
+    if (time_left > 0 && limits.movetime_ms == 0)
+    {
+        int64_t budget = time_left / moves_to_go + increment * 3 / 4;
+        int64_t most = time_left / 2 - MOVE_OVERHEAD_MS;
+        limits.movetime_ms = (budget < most) ? budget : most;
+        if (limits.movetime_ms < 1)
+        {
+            limits.movetime_ms = 1;
+        }
+    }
+    engine.limits = limits;
+    engine.stop.store(false);
+    engine.searching = pthread_create(&engine.thread, NULL, searchThread, NULL) == 0;
+}
+
+// Searches the bench positions to a fixed depth; the node count identifies the build's search
+static void bench(int depth)
+{
+    SearchLimits limits = {depth, 0, 0, NULL, &engine.table};
+    uint64_t nodes = 0;
+    int64_t started = now_ms();
+    for (const char *fen : benchPositions)
+    {
+        Chessboard board;
+        char turn;
+        boardFromFen(fen, board, turn);
+        search_table_clear(engine.table);
+        SearchResult result;
+        search(board, turn, limits, engine.params, result);
+        char text[UCI_MOVE_SIZE] = "0000";
+        if (result.has_move)
+        {
+            moveToUci(board, result.move, text);
+        }
+        printf("%-60s %s %6d %10llu\n", fen, text, result.score, (unsigned long long)result.nodes);
+        nodes += result.nodes;
+    }
+    int64_t elapsed = now_ms() - started;
+    printf("\nTotal time (ms) : %lld\nNodes searched  : %llu\nNodes/second    : %llu\n", (long long)elapsed,
+           (unsigned long long)nodes, (unsigned long long)(nodes * 1000 / (elapsed > 0 ? elapsed : 1)));
+    fflush(stdout);
+}
+
+static void set_option(char **tokens, int count)
+{
+    // setoption name <name> value <value>
+    if (count < 5 || strcmp(tokens[1], "name") != 0 || strcmp(tokens[3], "value") != 0)
+    {
+        return;
+    }
+    long value = atol(tokens[4]);
+    if (strcasecmp(tokens[2], "EvalFile") == 0)
+    {
+        if (!eval_params_load(tokens[4], engine.params))
+        {
+            printf("info string cannot load %s\n", tokens[4]);
+        }
+    }
+    else if (strcasecmp(tokens[2], "Hash") == 0 && value >= 1 && value <= MAX_HASH_MB)
+    {
+        search_table_free(engine.table);
+        if (!search_table_create(engine.table, (size_t)value) && !search_table_create(engine.table, DEFAULT_HASH_MB))
+        {
+            fprintf(stderr, "Cannot allocate the hash table\n");
+            exit(1);
+        }
+    }
+    else if (strcasecmp(tokens[2], "Threads") == 0 && value >= 1 && value <= MAX_THREADS)
+    {
+        engine.threads = (int)value;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    engine.board = initializeBoard();
+    engine.turn = 'w';
+    engine.threads = 1;
+    engine.params = default_eval_params;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:")) != -1)
+    {
+        if (opt != 'e' || !eval_params_load(optarg, engine.params))
+        {
+            fprintf(stderr, "Usage: %s [-e eval_params] [bench [depth]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!search_table_create(engine.table, DEFAULT_HASH_MB))
+    {
+        fprintf(stderr, "Cannot allocate the hash table\n");
+        return 1;
+    }
+    if (optind < argc && strcmp(argv[optind], "bench") == 0)
+    {
+        bench(optind + 1 < argc ? atoi(argv[optind + 1]) : BENCH_DEPTH);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, stdin) >= 0)
+    {
+        std::vector<char *> tokens;
+        char *saved = NULL;
+        for (char *token = strtok_r(line, " \t\r\n", &saved); token; token = strtok_r(NULL, " \t\r\n", &saved))
+        {
+            tokens.push_back(token);
+        }
+        if (tokens.empty())
+        {
+            continue;
+        }
+        const char *command = tokens[0];
+        int count = (int)tokens.size();
+        if (strcmp(command, "uci") == 0)
+        {
+            printf("id name " ENGINE_NAME "\nid author ChessApp\n");
+            printf("option name Hash type spin default %d min 1 max %d\n", DEFAULT_HASH_MB, MAX_HASH_MB);
+            printf("option name Threads type spin default 1 min 1 max %d\n", MAX_THREADS);
+            printf("option name EvalFile type string default <empty>\nuciok\n");
+        }
+        else if (strcmp(command, "isready") == 0)
+        {
+            printf("readyok\n");
+        }
+        else if (strcmp(command, "ucinewgame") == 0)
+        {
+            stop_search();
+            search_table_clear(engine.table);
+        }
+        else if (strcmp(command, "position") == 0)
+        {
+            stop_search();
+            set_position(tokens.data(), count);
+        }
+        else if (strcmp(command, "go") == 0)
+        {
+            stop_search();
+            go(tokens.data(), count);
+        }
+        else if (strcmp(command, "stop") == 0)
+        {
+            stop_search();
+        }
+        else if (strcmp(command, "setoption") == 0)
+        {
+            stop_search();
+            set_option(tokens.data(), count);
+        }
+        else if (strcmp(command, "bench") == 0)
+        {
+            stop_search();
+            bench(count > 1 ? atoi(tokens[1]) : BENCH_DEPTH);
+        }
+        else if (strcmp(command, "quit") == 0)
+        {
+            break;
+        }
+        fflush(stdout);
+    }
+    stop_search();
+    free(line);
+    search_table_free(engine.table);
+    return 0;
+}
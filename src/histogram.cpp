@@ -0,0 +1,79 @@
+#include "histogram.h"
+
+// Lowest value that falls into a bucket
+static uint64_t bucket_floor(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (uint64_t)bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t mantissa = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+    return mantissa << shift;
+}
+
+void histogram_reset(LatencyHistogram &h)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        h.counts[i].store(0, std::memory_order_relaxed);
+    }
+    h.total.store(0, std::memory_order_relaxed);
+    h.max.store(0, std::memory_order_relaxed);
+}
+
+void histogram_merge(LatencyHistogram &dst, const LatencyHistogram &src)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t count = src.counts[i].load(std::memory_order_relaxed);
+        if (count)
+        {
+            dst.counts[i].store(dst.counts[i].load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        }
+    }
+    dst.total.store(dst.total.load(std::memory_order_relaxed) + src.total.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+    uint64_t max = src.max.load(std::memory_order_relaxed);
+    if (max > dst.max.load(std::memory_order_relaxed))
+    {
+        dst.max.store(max, std::memory_order_relaxed);
+    }
+}
+
+uint64_t histogram_count(const LatencyHistogram &h)
+{
+    return h.total.load(std::memory_order_relaxed);
+}
+
+uint64_t histogram_percentile(const LatencyHistogram &h, double percentile)
+{
+    // Sum the buckets rather than trusting `total`, a concurrent writer may be mid-update
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        total += h.counts[i].load(std::memory_order_relaxed);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += h.counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t max = h.max.load(std::memory_order_relaxed);
+            uint64_t value = bucket_floor(i);
+            return value < max ? value : max;
+        }
+    }
+    return h.max.load(std::memory_order_relaxed);
+}
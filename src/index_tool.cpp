@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chessboard.h"
+#include "position_index.h"
+
+// Builds a position index over a game archive (see position_index.h) and
+// looks positions up in it. Matches are listed as archive game numbers,
+// which chess_archive prints.
+
+#define QUERY_LIST 20 // Matches printed by a query
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s build <archive> <index> [-j threads] [-m memory-MB]\n", name);
+    fprintf(stderr, "       %s query <index> <FEN>\n", name);
+    return 1;
+}
+
+static int build(int argc, char *argv[])
+{
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t memory_mb = POSITION_INDEX_MEMORY_MB;
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "j:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'm':
+            memory_mb = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+
+    double started = now_s();
+    if (!position_index_build(argv[2], argv[3], threads, memory_mb << 20))
+    {
+        perror("Cannot build index");
+        return 1;
+    }
+    double elapsed = now_s() - started;
+
+    PositionIndex index;
+    if (!position_index_open(index, argv[3]))
+    {
+        perror("Cannot open index");
+        return 1;
+    }
+    printf("Indexed %llu positions in %.1f ms with %d threads (%.1f M positions/s), %zu bytes\n",
+           (unsigned long long)index.count, elapsed * 1e3, threads, index.count / elapsed / 1e6, index.size);
+    position_index_close(index);
+    return 0;
+}
+
+static int query(const char *path, const char *fen)
+{
+    Chessboard board;
+    char turn;
+    if (!boardFromFen(fen, board, turn))
+    {
+        fprintf(stderr, "Invalid FEN\n");
+        return 1;
+    }
+    PositionIndex index;
+    if (!position_index_open(index, path))
+    {
+        perror("Cannot open index");
+        return 1;
+    }
+
+    // The first lookup faults the pages it touches in, a repeat shows the cached cost
+    uint64_t hash = position_hash(board, turn);
+    uint64_t first;
+    double started = now_s();
+    uint64_t count = position_index_find(index, hash, first);
+    double cold = now_s() - started;
+    started = now_s();
+    position_index_find(index, hash, first);
+    double warm = now_s() - started;
+
+    printf("Position %016llx: %llu occurrences, found in %.1f us (%.2f us cached)\n", (unsigned long long)hash,
+           (unsigned long long)count, cold * 1e6, warm * 1e6);
+    for (uint64_t i = first; i < first + count && i < first + QUERY_LIST; i++)
+    {
+        printf("  game %u ply %u\n", index.entries[i].game, index.entries[i].ply);
+    }
+    if (count > QUERY_LIST)
+    {
+        printf("  ...\n");
+    }
+    position_index_close(index);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 4 && strcmp(argv[1], "build") == 0)
+    {
+        return build(argc, argv);
+    }
+    if (argc == 4 && strcmp(argv[1], "query") == 0)
+    {
+        return query(argv[2], argv[3]);
+    }
+    return usage(argv[0]);
+}
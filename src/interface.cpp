@@ -1,130 +1,165 @@
 #include "interface.h"
+#include "assets.h"
+#include <algorithm>
+#include <stdio.h>
+
+static const char *piece_names[12] = {
+    "chess_piece_2_white_pawn", "chess_piece_2_white_knight", "chess_piece_2_white_bishop",
+    "chess_piece_2_white_rook", "chess_piece_2_white_queen",  "chess_piece_2_white_king",
+    "chess_piece_2_black_pawn", "chess_piece_2_black_knight", "chess_piece_2_black_bishop",
+    "chess_piece_2_black_rook", "chess_piece_2_black_queen",  "chess_piece_2_black_king",
+};
+
+// Decodes one of the images compiled into the binary
+static bool load_embedded(sf::Image &image, const char *name)
+{
+    for (size_t i = 0; i < embedded_asset_count; i++)
+    {
+        if (strcmp(embedded_assets[i].name, name) == 0)
+        {
+            return image.loadFromMemory(embedded_assets[i].data, embedded_assets[i].size);
+        }
+    }
+    return false;
+}
 
 void window_init(sf::RenderWindow &window)
 {
-    window.create(sf::VideoMode(800, 800), "Chess");
+    window.create(sf::VideoMode(WINDOW_SIZE, WINDOW_SIZE), "Chess");
+    window.setFramerateLimit(FRAME_LIMIT);
+}
+
+// Index into AtlasLayout::pieceRects, -1 for empty squares and unknown pieces
+static int piece_index(const Piece &piece)
+{
+    int type;
+    switch (piece.type) {
+        case 'p': type = 0; break;
+        case 'k': type = 1; break;
+        case 'b': type = 2; break;
+        case 'r': type = 3; break;
+        case 'q': type = 4; break;
+        case 'K': type = 5; break;
+        default: return -1; // Ignoruj nieznane typy i puste pola
+    }
+    if (piece.color == 'w') return type;
+    if (piece.color == 'b') return 6 + type;
+    return -1;
 }
 
-void load_pieces(std::map<std::string, sf::Texture> &pieceTextures, sf::Texture &chessboardTexture)
+bool atlas_build(AtlasImage &atlas)
 {
-    // Load the chessboard texture
-    std::string board = "resources/images/chessboard.png";
-    if (!chessboardTexture.loadFromFile(board))
+    sf::Image board;
+    sf::Image pieces[12];
+    if (!load_embedded(board, "chessboard"))
     {
-        perror("Error loading the chessboard file!\n");
-        return;
+        fprintf(stderr, "Error loading the chessboard image!\n");
+        return false;
+    }
+    for (int i = 0; i < 12; i++)
+    {
+        if (!load_embedded(pieces[i], piece_names[i]))
+        {
+            fprintf(stderr, "Error loading one or more chess pieces!\n");
+            return false;
+        }
     }
 
-    // Load textures for each piece
-    if (!pieceTextures["white_pawn"].loadFromFile("resources/images/chess_piece_2_white_pawn.png") ||
-        !pieceTextures["black_pawn"].loadFromFile("resources/images/chess_piece_2_black_pawn.png") ||
-        !pieceTextures["white_rook"].loadFromFile("resources/images/chess_piece_2_white_rook.png") ||
-        !pieceTextures["black_rook"].loadFromFile("resources/images/chess_piece_2_black_rook.png") ||
-        !pieceTextures["white_knight"].loadFromFile("resources/images/chess_piece_2_white_knight.png") ||
-        !pieceTextures["black_knight"].loadFromFile("resources/images/chess_piece_2_black_knight.png") ||
-        !pieceTextures["white_bishop"].loadFromFile("resources/images/chess_piece_2_white_bishop.png") ||
-        !pieceTextures["black_bishop"].loadFromFile("resources/images/chess_piece_2_black_bishop.png") ||
-        !pieceTextures["white_queen"].loadFromFile("resources/images/chess_piece_2_white_queen.png") ||
-        !pieceTextures["black_queen"].loadFromFile("resources/images/chess_piece_2_black_queen.png") ||
-        !pieceTextures["white_king"].loadFromFile("resources/images/chess_piece_2_white_king.png") ||
-        !pieceTextures["black_king"].loadFromFile("resources/images/chess_piece_2_black_king.png"))
+    // Board on the left, pieces stacked in a column to its right, then a white block
+    AtlasLayout &layout = atlas.layout;
+    sf::Vector2u boardSize = board.getSize();
+    unsigned columnX = boardSize.x + 1, columnWidth = 4, columnHeight = 0;
+    for (int i = 0; i < 12; i++)
     {
-        perror("Error loading one or more chess pieces!");
-        exit(EXIT_FAILURE);
+        sf::Vector2u size = pieces[i].getSize();
+        layout.pieceRects[i] = sf::IntRect(columnX, columnHeight, size.x, size.y);
+        columnWidth = std::max(columnWidth, size.x);
+        columnHeight += size.y + 1; // One pixel gap so smoothing does not bleed
+    }
+    layout.whiteRect = sf::IntRect(columnX, columnHeight, 4, 4);
+    layout.boardRect = sf::IntRect(0, 0, boardSize.x, boardSize.y);
+
+    atlas.image.create(columnX + columnWidth, std::max(boardSize.y, columnHeight + 4), sf::Color::Transparent);
+    atlas.image.copy(board, 0, 0);
+    for (int i = 0; i < 12; i++)
+    {
+        atlas.image.copy(pieces[i], layout.pieceRects[i].left, layout.pieceRects[i].top);
+    }
+    for (unsigned y = 0; y < 4; y++)
+    {
+        for (unsigned x = 0; x < 4; x++)
+        {
+            atlas.image.setPixel(columnX + x, columnHeight + y, sf::Color::White);
+        }
     }
+    return true;
 }
 
-void window_display(sf::RenderWindow &window, const std::map<std::string, sf::Texture> &pieceTextures, const sf::Texture &chessboardTexture, Chessboard board, char side)
+bool board_view_load(BoardView &view, const AtlasImage &atlas)
 {
-    // Ustawienie tekstury dla planszy szachowej i skalowanie jej do rozmiaru okna
-    sf::Sprite chessboardSprite;
-    chessboardSprite.setTexture(chessboardTexture);
-    sf::Vector2u textureSize = chessboardTexture.getSize();
-    sf::Vector2u windowSize = window.getSize();
-    chessboardSprite.setScale(
-        static_cast<float>(windowSize.x) / textureSize.x,
-        static_cast<float>(windowSize.y) / textureSize.y);
-
-    std::map<std::string, sf::Sprite> pieceSprites;
-
-    float spriteScaleX = static_cast<float>(windowSize.x) / 8.0f;
-    float spriteScaleY = static_cast<float>(windowSize.y) / 8.0f;
-
-    // Tworzenie i skalowanie sprite'ów
-    pieceSprites["white_pawn"].setTexture(pieceTextures.at("white_pawn"));
-    pieceSprites["black_pawn"].setTexture(pieceTextures.at("black_pawn"));
-    pieceSprites["white_rook"].setTexture(pieceTextures.at("white_rook"));
-    pieceSprites["black_rook"].setTexture(pieceTextures.at("black_rook"));
-    pieceSprites["white_knight"].setTexture(pieceTextures.at("white_knight"));
-    pieceSprites["black_knight"].setTexture(pieceTextures.at("black_knight"));
-    pieceSprites["white_bishop"].setTexture(pieceTextures.at("white_bishop"));
-    pieceSprites["black_bishop"].setTexture(pieceTextures.at("black_bishop"));
-    pieceSprites["white_queen"].setTexture(pieceTextures.at("white_queen"));
-    pieceSprites["black_queen"].setTexture(pieceTextures.at("black_queen"));
-    pieceSprites["white_king"].setTexture(pieceTextures.at("white_king"));
-    pieceSprites["black_king"].setTexture(pieceTextures.at("black_king"));
-
-    // Skalowanie sprite'ów do 1/8 rozmiaru okna
-    for (auto& piece : pieceSprites) {
-        piece.second.setScale(
-            spriteScaleX / piece.second.getTexture()->getSize().x,
-            spriteScaleY / piece.second.getTexture()->getSize().y
-        );
+    if (!view.atlas.loadFromImage(atlas.image))
+    {
+        return false;
     }
+    view.atlas.setSmooth(true);
+    view.layout = atlas.layout;
+    view.vertices.setPrimitiveType(sf::Quads);
+    return true;
+}
 
-    window.clear();
-    window.draw(chessboardSprite);
-    // Iteracja przez tablicę szachową i rysowanie figur
+// Appends one textured quad
+static void add_quad(sf::VertexArray &vertices, float x, float y, float size, const sf::IntRect &rect, sf::Color color)
+{
+    float u = rect.left, v = rect.top, w = rect.width, h = rect.height;
+    vertices.append(sf::Vertex(sf::Vector2f(x, y), color, sf::Vector2f(u, v)));
+    vertices.append(sf::Vertex(sf::Vector2f(x + size, y), color, sf::Vector2f(u + w, v)));
+    vertices.append(sf::Vertex(sf::Vector2f(x + size, y + size), color, sf::Vector2f(u + w, v + h)));
+    vertices.append(sf::Vertex(sf::Vector2f(x, y + size), color, sf::Vector2f(u, v + h)));
+}
+
+void board_view_update(BoardView &view, const Chessboard &board, char side, uint64_t highlight)
+{
+    const float square = WINDOW_SIZE / 8.0f;
+    view.vertices.clear();
+    add_quad(view.vertices, 0, 0, WINDOW_SIZE, view.layout.boardRect, sf::Color::White);
+
+    // Podświetlenie dozwolonych pól docelowych
+    for (int i = 0; highlight && i < 64; i++) {
+        if (!(highlight & (1ULL << i))) {
+            continue;
+        }
+        int row = side == 'b' ? i / 8 : 7 - i / 8;
+        int col = side == 'b' ? i % 8 : 7 - i % 8;
+        // Sample the middle of the white block so smoothing keeps the color flat
+        sf::IntRect center(view.layout.whiteRect.left + 1, view.layout.whiteRect.top + 1, 2, 2);
+        add_quad(view.vertices, col * square, row * square, square, center, sf::Color(90, 200, 90, 110));
+    }
+
+    // Iteracja przez tablicę szachową i dodawanie figur
     for (int row = 0; row < 8; row++) {
         for (int col = 0; col < 8; col++) {
             int drawRow = side == 'b' ? row : 7 - row;
             int drawCol = side == 'b' ? col : 7 - col;
 
-            const Piece& piece = board[drawRow][drawCol];
-
-            // Pomijanie pustych pól (typ 'e' oznacza puste pole)
-            if (piece.type == 'e') {
-                continue;
-            }
-
-            // Wybór odpowiedniego sprite'a na podstawie koloru i typu figury
-            std::string spriteKey;
-
-            if (piece.color == 'w') { // Białe figury
-                switch (piece.type) {
-                    case 'p': spriteKey = "white_pawn"; break;
-                    case 'k': spriteKey = "white_knight"; break;
-                    case 'b': spriteKey = "white_bishop"; break;
-                    case 'r': spriteKey = "white_rook"; break;
-                    case 'q': spriteKey = "white_queen"; break;
-                    case 'K': spriteKey = "white_king"; break;
-                    default: continue; // Ignoruj nieznane typy
-                }
-            } else if (piece.color == 'b') { // Czarne figury
-                switch (piece.type) {
-                    case 'p': spriteKey = "black_pawn"; break;
-                    case 'k': spriteKey = "black_knight"; break;
-                    case 'b': spriteKey = "black_bishop"; break;
-                    case 'r': spriteKey = "black_rook"; break;
-                    case 'q': spriteKey = "black_queen"; break;
-                    case 'K': spriteKey = "black_king"; break;
-                    default: continue; // Ignoruj nieznane typy
-                }
-            }
-            if (!spriteKey.empty()) {
-                pieceSprites[spriteKey].setPosition(col * spriteScaleX, row * spriteScaleY);
-                window.draw(pieceSprites[spriteKey]);
+            int index = piece_index(board[drawRow][drawCol]);
+            if (index >= 0) {
+                add_quad(view.vertices, col * square, row * square, square, view.layout.pieceRects[index], sf::Color::White);
             }
         }
     }
+}
 
+void board_view_draw(sf::RenderWindow &window, const BoardView &view)
+{
+    window.clear();
+    window.draw(view.vertices, &view.atlas);
     // Wyświetlenie zaktualizowanego okna
     window.display();
 }
 
 
 sf::Vector2i pixelToGrid(sf::Vector2i pixelPos) {
-    int gridSize = 800 / 8;
+    int gridSize = WINDOW_SIZE / 8;
     int x = pixelPos.x / gridSize;
     int y = pixelPos.y / gridSize;
     return sf::Vector2i(x, y);
@@ -0,0 +1,1027 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chessboard.h"
+#include "histogram.h"
+#include "multiplex.h"
+#include "protocol.h"
+#include "shm_ring.h"
+
+// Headless load generator. Every simulated player is an independent
+// connection that speaks the regular client protocol: it waits for its
+// side, mirrors the board from the server's frames and answers each of
+// its turns with a legal move. The server pairs connections as they come,
+// so players do not need to know their opponent.
+//
+// With -x a player sometimes drops its connection instead of moving and
+// reattaches with its resume token, which measures how fast the server
+// hands a running game back to a reconnecting player.
+//
+// With -M the players share a few multiplexed connections instead, each one
+// carrying the seats of many games, as a bot farm would.
+//
+// With -U every connection goes to the server's Unix sockets instead of
+// TCP, and with -S as well the multiplexed connections move onto
+// shared-memory rings.
+
+enum PlayerState { IDLE, CONNECTING, PLAYING };
+
+struct Player {
+    int socket;
+    PlayerState state;
+    char side;                      // 0 until the server assigned one
+    Chessboard board;               // Mirror of the server's board
+    char frame[RESUME_REPLY_SIZE];  // Message being received, the largest is the resume reply
+    size_t received;
+    size_t expected;                // Size of the message being received
+    uint64_t token;                 // Resume token of the current game
+    int game_ply;                   // Moves played in the current game by both sides
+    int64_t start_at;               // When to open the next connection
+    int64_t connect_started;
+    int64_t move_sent;              // 0 when no move awaits the server's answer
+    int64_t reattach_started;       // 0 unless the player is reattaching
+    unsigned seed;
+};
+
+// One seat of a multiplexed connection, indexed by the tag of its join
+struct Seat {
+    uint32_t game;                  // 0 while not in a game
+    char side;
+    Chessboard board;
+    int game_ply;
+    int64_t start_at;               // When to ask for the next game, 0 once asked
+    int64_t move_sent;
+};
+
+struct MuxLink {
+    int socket;
+    std::vector<Seat> seats;
+    std::unordered_map<uint64_t, uint32_t> by_game; // Game id << 1 | black to seat tag
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;       // Requests not yet sent
+    ShmEndpoint shm;                // Rings with -S, area NULL otherwise
+    unsigned seed;
+};
+
+struct Options {
+    const char *host = "127.0.0.1";
+    int port = SERVER_PORT;
+    int players = 100;              // Concurrent connections, two per game
+    int threads = 1;
+    double ramp_s = 1.0;            // Time to open all connections
+    double duration_s = 10.0;
+    int max_plies = 80;             // Game length before the player resigns by disconnecting
+    int drop_percent = 0;           // Chance per own move to drop the connection and reattach
+    int links = 0;                  // Multiplexed connections, 0 for one connection per player
+    uint8_t key[MUX_KEY_SIZE] = {}; // Presented by multiplexed connections
+    const char *unix_path = NULL;   // Server's Unix socket instead of TCP
+    bool shared = false;            // Multiplexed connections over shared memory
+    unsigned seed = 1;
+    std::vector<std::vector<int>> script; // Opening moves played before random ones
+};
+
+struct WorkerStats {
+    LatencyHistogram connect_ns;
+    LatencyHistogram move_rtt_ns;
+    LatencyHistogram reattach_ns;   // From dropping the connection to the resume reply
+    uint64_t moves;
+    uint64_t reattaches;
+    uint64_t games;
+    uint64_t errors;
+};
+
+struct Worker {
+    pthread_t thread;
+    int first_player;
+    int player_count;
+    int first_link;                 // Multiplexed connections of this worker
+    int link_count;
+    WorkerStats *stats;
+};
+
+static Options options;
+static struct sockaddr_storage serverAddr;
+static struct sockaddr_storage attachAddr;
+static socklen_t addrLength;
+static int64_t start_ns, end_ns;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// A socket of the transport under test, TCP unless -U was given
+static int transport_socket()
+{
+    if (options.unix_path)
+    {
+        return socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+    int s = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s >= 0)
+    {
+        int one = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return s;
+}
+
+// Parse a coordinate move such as "e2e4" into {startX, startY, targetX, targetY}
+static bool parse_coordinate_move(const char *text, int move[4])
+{
+    if (strlen(text) < 4)
+    {
+        return false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        char file = text[2 * i], rank = text[2 * i + 1];
+        if (file < 'a' || file > 'h' || rank < '1' || rank > '8')
+        {
+            return false;
+        }
+        move[2 * i] = 7 - (file - 'a'); // Files are mirrored on this board
+        move[2 * i + 1] = rank - '1';
+    }
+    return true;
+}
+
+static bool load_script(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror("Cannot open script");
+        return false;
+    }
+    char token[16];
+    while (fscanf(file, "%15s", token) == 1)
+    {
+        int move[4];
+        if (!parse_coordinate_move(token, move))
+        {
+            fprintf(stderr, "Invalid move in script: %s\n", token);
+            fclose(file);
+            return false;
+        }
+        options.script.push_back(std::vector<int>(move, move + 4));
+    }
+    fclose(file);
+    return true;
+}
+
+static void player_close(Player &p, int64_t now)
+{
+    if (p.socket >= 0)
+    {
+        close(p.socket);
+    }
+    p.socket = -1;
+    p.state = IDLE;
+    p.reattach_started = 0;
+    p.start_at = now; // Start the next game right away
+}
+
+// The connection is up: a reattaching player asks for its seat back
+static void player_connected(Player &p, WorkerStats &stats, int64_t now)
+{
+    p.state = PLAYING;
+    if (!p.reattach_started)
+    {
+        histogram_record(stats.connect_ns, now - p.connect_started);
+        return;
+    }
+    char request[1 + RESUME_TOKEN_SIZE];
+    request[0] = REQUEST_RESUME;
+    memcpy(request + 1, &p.token, RESUME_TOKEN_SIZE);
+    if (send(p.socket, request, sizeof(request), MSG_NOSIGNAL) != sizeof(request))
+    {
+        stats.errors++;
+        player_close(p, now);
+    }
+}
+
+// Opens a connection for a new game, or to the attach port while reattaching
+static void player_connect(Player &p, WorkerStats &stats, int64_t now)
+{
+    p.socket = transport_socket();
+    if (p.socket < 0)
+    {
+        stats.errors++;
+        p.start_at = now + 100000000; // Retry in 100 ms
+        return;
+    }
+    fcntl(p.socket, F_SETFL, O_NONBLOCK);
+
+    p.received = 0;
+    p.move_sent = 0;
+    p.connect_started = now;
+    const struct sockaddr_storage *addr = &attachAddr;
+    if (!p.reattach_started)
+    {
+        p.side = 0;
+        p.game_ply = 0;
+        p.expected = HELLO_SIZE;
+        addr = &serverAddr;
+    }
+    else
+    {
+        p.expected = RESUME_REPLY_SIZE;
+    }
+    if (connect(p.socket, (struct sockaddr *)addr, addrLength) == 0)
+    {
+        player_connected(p, stats, now);
+    }
+    else if (errno == EINPROGRESS)
+    {
+        p.state = CONNECTING;
+    }
+    else
+    {
+        stats.errors++;
+        player_close(p, now + 100000000);
+    }
+}
+
+// Picks a random legal move, or the script's move while the script is followed
+static bool choose_move(const Chessboard &board, char side, int game_ply, unsigned &seed, int msg[4])
+{
+    int moves[256][4];
+    int count = legal_moves(board, side, moves, 256);
+    if (count == 0)
+    {
+        return false;
+    }
+
+    memcpy(msg, moves[rand_r(&seed) % count], 4 * sizeof(int));
+    if (game_ply < (int)options.script.size())
+    {
+        // Follow the script as long as its moves are legal here
+        const std::vector<int> &scripted = options.script[game_ply];
+        for (int i = 0; i < count; i++)
+        {
+            if (memcmp(moves[i], scripted.data(), 4 * sizeof(int)) == 0)
+            {
+                memcpy(msg, moves[i], 4 * sizeof(int));
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// Choose and send the move for the player's turn; ends the game after max_plies
+static void player_move(Player &p, WorkerStats &stats, int64_t now)
+{
+    if (p.game_ply >= options.max_plies)
+    {
+        // Resign so the server ends the game instead of holding our seat
+        int resign[4] = {-1, -1, -1, -1};
+        send(p.socket, resign, sizeof(resign), MSG_NOSIGNAL);
+        stats.games++;
+        player_close(p, now);
+        return;
+    }
+
+    if (options.drop_percent > 0 && (int)(rand_r(&p.seed) % 100) < options.drop_percent)
+    {
+        // Drop the connection and reattach, the move is made once the snapshot arrives
+        close(p.socket);
+        p.reattach_started = now_ns();
+        player_connect(p, stats, now);
+        return;
+    }
+
+    int msg[4];
+    if (!choose_move(p.board, p.side, p.game_ply, p.seed, msg))
+    {
+        player_close(p, now);
+        return;
+    }
+
+    // Stamp before sending, the server may answer before send() returns
+    p.move_sent = now_ns();
+    if (send(p.socket, msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+    {
+        stats.errors++;
+        player_close(p, now);
+    }
+}
+
+// Handle one complete message from the server
+static void player_on_frame(Player &p, WorkerStats &stats, int64_t now)
+{
+    int data[128];
+    p.received = 0;
+    p.expected = FRAME_SIZE;
+
+    if (p.reattach_started)
+    {
+        // Resume reply: 'r', side and clocks, then a frame of the current position
+        histogram_record(stats.reattach_ns, now_ns() - p.reattach_started);
+        stats.reattaches++;
+        p.reattach_started = 0;
+        const char *frame = p.frame + RESUME_REPLY_SIZE - FRAME_SIZE;
+        memcpy(data, frame + 1, BOARD_DATA_SIZE);
+        deserializeChessboard(data, p.board);
+        if (frame[0] == p.side)
+        {
+            player_move(p, stats, now);
+        }
+        return;
+    }
+
+    char status = p.frame[0];
+    memcpy(data, p.frame + 1, BOARD_DATA_SIZE);
+
+    if (p.side == 0)
+    {
+        // First frame: our side and the initial board
+        if (status != 'w' && status != 'b')
+        {
+            stats.errors++; // Server full
+            player_close(p, now + 100000000);
+            return;
+        }
+        p.side = status;
+        memcpy(&p.token, p.frame + FRAME_SIZE, RESUME_TOKEN_SIZE);
+        deserializeChessboard(data, p.board);
+        if (p.side == 'w')
+        {
+            player_move(p, stats, now);
+        }
+        return;
+    }
+
+    deserializeChessboard(data, p.board);
+    p.game_ply++;
+    if (p.move_sent)
+    {
+        histogram_record(stats.move_rtt_ns, now_ns() - p.move_sent);
+        stats.moves++;
+        p.move_sent = 0;
+    }
+
+    if (status == 'c' || status == 's' || status == 't')
+    {
+        if (p.side == 'w')
+        {
+            stats.games++; // Count each game once
+        }
+        player_close(p, now);
+    }
+    else if (status == p.side)
+    {
+        player_move(p, stats, now);
+    }
+}
+
+static void player_on_readable(Player &p, WorkerStats &stats, int64_t now)
+{
+    while (p.state == PLAYING)
+    {
+        // A lone 'e' ends the session, every other message has the expected size
+        ssize_t n = recv(p.socket, p.frame + p.received, p.expected - p.received, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            player_close(p, now); // Opponent left or server closed the game
+            return;
+        }
+        if (n < 0)
+        {
+            return;
+        }
+        p.received += n;
+        if (p.frame[0] == 'e' && p.side != 0)
+        {
+            if (p.reattach_started)
+            {
+                stats.errors++; // The game did not survive the drop
+            }
+            player_close(p, now);
+            return;
+        }
+        if (p.received == p.expected)
+        {
+            player_on_frame(p, stats, now);
+        }
+    }
+}
+
+static void *workerThread(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    WorkerStats &stats = *worker->stats;
+    std::vector<Player> players(worker->player_count);
+    std::vector<struct pollfd> fds;
+    std::vector<int> owners;
+
+    int total = options.players;
+    for (int i = 0; i < worker->player_count; i++)
+    {
+        Player &p = players[i];
+        int index = worker->first_player + i;
+        p.socket = -1;
+        p.state = IDLE;
+        p.start_at = start_ns + (int64_t)(options.ramp_s * 1e9 * index / total);
+        p.seed = options.seed * 7919 + index;
+    }
+
+    while (1)
+    {
+        int64_t now = now_ns();
+        if (now >= end_ns)
+        {
+            break;
+        }
+
+        // Open connections that are due and find the next ramp-up deadline
+        int64_t next_start = end_ns;
+        fds.clear();
+        owners.clear();
+        for (int i = 0; i < worker->player_count; i++)
+        {
+            Player &p = players[i];
+            if (p.state == IDLE)
+            {
+                if (p.start_at <= now)
+                {
+                    player_connect(p, stats, now);
+                }
+                else if (p.start_at < next_start)
+                {
+                    next_start = p.start_at;
+                }
+            }
+            if (p.state != IDLE)
+            {
+                fds.push_back({p.socket, (short)(p.state == CONNECTING ? POLLOUT : POLLIN), 0});
+                owners.push_back(i);
+            }
+        }
+
+        int timeout_ms = (int)((next_start - now) / 1000000) + 1;
+        if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR)
+        {
+            perror("Poll error");
+            break;
+        }
+
+        now = now_ns();
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (!fds[i].revents)
+            {
+                continue;
+            }
+            Player &p = players[owners[i]];
+            if (p.state == CONNECTING)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(p.socket, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0)
+                {
+                    stats.errors++;
+                    player_close(p, now + 100000000);
+                    continue;
+                }
+                player_connected(p, stats, now);
+            }
+            else
+            {
+                player_on_readable(p, stats, now);
+            }
+        }
+    }
+
+    for (Player &p : players)
+    {
+        if (p.socket >= 0)
+        {
+            close(p.socket);
+        }
+    }
+    return NULL;
+}
+
+static void link_request(MuxLink &link, char type, uint32_t game, const int move[4])
+{
+    MuxRequest request;
+    memset(&request, 0, sizeof(request));
+    request.type = type;
+    request.game = game;
+    if (move)
+    {
+        memcpy(request.move, move, sizeof(request.move));
+    }
+    const uint8_t *bytes = (const uint8_t *)&request;
+    link.out.insert(link.out.end(), bytes, bytes + sizeof(request));
+}
+
+static uint64_t seat_key(uint32_t game, char side)
+{
+    return ((uint64_t)game << 1) | (side == 'b');
+}
+
+// The seat's game is over, it asks for the next one right away
+static void seat_finish(MuxLink &link, Seat &seat, int64_t now)
+{
+    link.by_game.erase(seat_key(seat.game, seat.side));
+    seat.game = 0;
+    seat.move_sent = 0;
+    seat.start_at = now;
+}
+
+static void seat_move(MuxLink &link, Seat &seat, WorkerStats &stats, int64_t now)
+{
+    int msg[4];
+    if (seat.game_ply >= options.max_plies || !choose_move(seat.board, seat.side, seat.game_ply, link.seed, msg))
+    {
+        link_request(link, MUX_LEAVE, seat.game, NULL);
+        stats.games++;
+        seat_finish(link, seat, now);
+        return;
+    }
+    seat.move_sent = now_ns();
+    link_request(link, MUX_MOVE, seat.game, msg);
+}
+
+// Handle one complete message from the server
+static void link_on_message(MuxLink &link, const MuxHeader &header, const uint8_t *frame, WorkerStats &stats,
+                            int64_t now)
+{
+    int data[128];
+    if (header.type == MUX_GAME)
+    {
+        if (header.tag >= link.seats.size())
+        {
+            stats.errors++;
+            return;
+        }
+        Seat &seat = link.seats[header.tag];
+        seat.game = header.game;
+        seat.side = header.side;
+        seat.game_ply = 0;
+        memcpy(data, frame + 1, BOARD_DATA_SIZE);
+        deserializeChessboard(data, seat.board);
+        link.by_game[seat_key(seat.game, seat.side)] = header.tag;
+        if (seat.side == 'w')
+        {
+            seat_move(link, seat, stats, now);
+        }
+        return;
+    }
+    if (header.type == MUX_END && header.game == 0)
+    {
+        stats.errors++; // Server full
+        if (header.tag < link.seats.size())
+        {
+            link.seats[header.tag].start_at = now + 100000000;
+        }
+        return;
+    }
+
+    auto it = link.by_game.find(seat_key(header.game, header.side));
+    if (it == link.by_game.end())
+    {
+        return; // This seat already left the game
+    }
+    Seat &seat = link.seats[it->second];
+    if (header.type == MUX_END)
+    {
+        seat_finish(link, seat, now); // Opponent left
+        return;
+    }
+
+    char status = frame[0];
+    memcpy(data, frame + 1, BOARD_DATA_SIZE);
+    deserializeChessboard(data, seat.board);
+    seat.game_ply++;
+    if (seat.move_sent)
+    {
+        histogram_record(stats.move_rtt_ns, now_ns() - seat.move_sent);
+        stats.moves++;
+        seat.move_sent = 0;
+    }
+    if (status == 'c' || status == 's' || status == 't')
+    {
+        if (seat.side == 'w')
+        {
+            stats.games++;
+        }
+        seat_finish(link, seat, now);
+    }
+    else if (status == seat.side)
+    {
+        seat_move(link, seat, stats, now);
+    }
+}
+
+// False when the connection closed
+static bool link_on_readable(MuxLink &link, WorkerStats &stats, int64_t now)
+{
+    uint8_t buffer[64 * 1024];
+    ssize_t n;
+    if (link.shm.area)
+    {
+        n = (ssize_t)shm_read(link.shm, buffer, sizeof(buffer));
+    }
+    else
+    {
+        n = recv(link.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            return false;
+        }
+    }
+    if (n <= 0)
+    {
+        return true;
+    }
+    link.in.insert(link.in.end(), buffer, buffer + n);
+
+    size_t offset = 0;
+    while (link.in.size() - offset >= sizeof(MuxHeader))
+    {
+        MuxHeader header;
+        memcpy(&header, link.in.data() + offset, sizeof(header));
+        size_t size = (header.type == MUX_GAME || header.type == MUX_FRAME) ? MUX_FRAME_SIZE : sizeof(header);
+        if (link.in.size() - offset < size)
+        {
+            break;
+        }
+        link_on_message(link, header, link.in.data() + offset + sizeof(header), stats, now);
+        offset += size;
+    }
+    link.in.erase(link.in.begin(), link.in.begin() + offset);
+    return true;
+}
+
+// Opens a multiplexed connection and presents the key
+static bool link_connect(MuxLink &link, WorkerStats &stats)
+{
+    int64_t started = now_ns();
+    link.shm.area = NULL;
+    link.socket = transport_socket();
+    if (link.socket < 0 || connect(link.socket, (struct sockaddr *)&attachAddr, addrLength) != 0)
+    {
+        return false;
+    }
+    char hello[1 + MUX_KEY_SIZE];
+    hello[0] = options.shared ? REQUEST_MULTIPLEX_SHM : REQUEST_MULTIPLEX;
+    memcpy(hello + 1, options.key, MUX_KEY_SIZE);
+    if (send(link.socket, hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello))
+    {
+        return false;
+    }
+    char reply = 0;
+    if (options.shared)
+    {
+        int fds[SHM_FDS];
+        if (!shm_receive_fds(link.socket, reply, fds) || reply != MUX_ACCEPTED || !shm_attach(link.shm, fds))
+        {
+            return false;
+        }
+    }
+    else if (recv(link.socket, &reply, 1, MSG_WAITALL) != 1 || reply != MUX_ACCEPTED)
+    {
+        return false;
+    }
+    histogram_record(stats.connect_ns, now_ns() - started);
+    return true;
+}
+
+static void *muxWorkerThread(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    WorkerStats &stats = *worker->stats;
+    std::vector<MuxLink> links(worker->link_count);
+    std::vector<struct pollfd> fds(2 * worker->link_count); // Socket, then the ring's eventfd
+
+    // Seats are spread evenly over all links and ramp up in player order
+    int total = options.players;
+    for (int i = 0; i < worker->link_count; i++)
+    {
+        MuxLink &link = links[i];
+        int index = worker->first_link + i;
+        int first_seat = total * index / options.links;
+        link.seats.resize(total * (index + 1) / options.links - first_seat);
+        for (size_t tag = 0; tag < link.seats.size(); tag++)
+        {
+            Seat &seat = link.seats[tag];
+            seat = Seat();
+            seat.start_at = start_ns + (int64_t)(options.ramp_s * 1e9 * (first_seat + tag) / total);
+        }
+        link.seed = options.seed * 7919 + index;
+        if (!link_connect(link, stats))
+        {
+            perror("Cannot open a multiplexed connection");
+            stats.errors++;
+            return NULL;
+        }
+    }
+
+    bool closed = false;
+    while (!closed)
+    {
+        int64_t now = now_ns();
+        if (now >= end_ns)
+        {
+            break;
+        }
+
+        // Ask for games that are due, then send everything queued in one call per link
+        int64_t next_start = end_ns;
+        for (int i = 0; i < worker->link_count; i++)
+        {
+            MuxLink &link = links[i];
+            for (size_t tag = 0; tag < link.seats.size(); tag++)
+            {
+                Seat &seat = link.seats[tag];
+                if (!seat.start_at)
+                {
+                    continue;
+                }
+                if (seat.start_at <= now)
+                {
+                    link_request(link, MUX_JOIN, (uint32_t)tag, NULL);
+                    seat.start_at = 0;
+                }
+                else if (seat.start_at < next_start)
+                {
+                    next_start = seat.start_at;
+                }
+            }
+            if (!link.out.empty())
+            {
+                ssize_t n = link.shm.area ? (ssize_t)shm_write(link.shm, link.out.data(), link.out.size())
+                                          : send(link.socket, link.out.data(), link.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n > 0)
+                {
+                    link.out.erase(link.out.begin(), link.out.begin() + n);
+                }
+            }
+            if (link.shm.area)
+            {
+                // Only the end of the connection arrives on the socket
+                fds[2 * i] = {link.socket, POLLIN, 0};
+                fds[2 * i + 1] = {shm_wait_fd(link.shm), POLLIN, 0};
+            }
+            else
+            {
+                fds[2 * i] = {link.socket, (short)(POLLIN | (link.out.empty() ? 0 : POLLOUT)), 0};
+                fds[2 * i + 1] = {-1, 0, 0};
+            }
+        }
+
+        int timeout_ms = (int)((next_start - now) / 1000000) + 1;
+        for (MuxLink &link : links)
+        {
+            uint32_t what = SHM_WAIT_DATA | (link.out.empty() ? 0 : SHM_WAIT_SPACE);
+            if (link.shm.area && !shm_prepare_wait(link.shm, what))
+            {
+                timeout_ms = 0;
+            }
+        }
+        if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR)
+        {
+            perror("Poll error");
+            break;
+        }
+
+        now = now_ns();
+        for (int i = 0; i < worker->link_count; i++)
+        {
+            MuxLink &link = links[i];
+            bool event = fds[2 * i].revents & (POLLIN | POLLHUP | POLLERR);
+            bool open = true;
+            if (link.shm.area)
+            {
+                // The rings are looked at every round, the socket only reports the end
+                shm_end_wait(link.shm);
+                open = !event && link_on_readable(link, stats, now);
+            }
+            else if (event)
+            {
+                open = link_on_readable(link, stats, now);
+            }
+            if (!open)
+            {
+                fprintf(stderr, "Multiplexed connection closed by the server\n");
+                stats.errors++;
+                closed = true;
+            }
+        }
+    }
+
+    for (MuxLink &link : links)
+    {
+        if (link.shm.area)
+        {
+            shm_close(link.shm);
+        }
+        close(link.socket);
+    }
+    return NULL;
+}
+
+static void print_histogram(const char *name, const LatencyHistogram &h)
+{
+    printf("%-18s n=%-9llu p50=%-9.1f p99=%-9.1f p999=%-9.1f max=%.1f (us)\n", name,
+           (unsigned long long)histogram_count(h),
+           histogram_percentile(h, 50.0) / 1000.0,
+           histogram_percentile(h, 99.0) / 1000.0,
+           histogram_percentile(h, 99.9) / 1000.0,
+           h.max.load() / 1000.0);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-h host] [-p port] [-c players] [-t threads] [-r ramp_s] [-d duration_s]\n"
+            "          [-m max_plies] [-s seed] [-f script] [-x drop_percent] [-M connections -k key_file]\n"
+            "          [-U unix_socket [-S]]\n"
+            "  -c  concurrent players (two per game), default 100\n"
+            "  -f  file with coordinate moves (e2e4 e7e5 ...) played before random moves\n"
+            "  -x  chance per move to drop the connection and reattach, default 0\n"
+            "  -M  share this many multiplexed connections between all players, using the key in -k\n"
+            "  -U  connect to the server's Unix socket instead of TCP\n"
+            "  -S  multiplexed connections over shared memory rings, needs -U and -M\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    const char *key_path = NULL;
+    while ((opt = getopt(argc, argv, "h:p:c:t:r:d:m:s:f:x:M:k:U:S")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': options.host = optarg; break;
+        case 'p': options.port = atoi(optarg); break;
+        case 'c': options.players = atoi(optarg); break;
+        case 't': options.threads = atoi(optarg); break;
+        case 'r': options.ramp_s = atof(optarg); break;
+        case 'd': options.duration_s = atof(optarg); break;
+        case 'm': options.max_plies = atoi(optarg); break;
+        case 's': options.seed = (unsigned)atoi(optarg); break;
+        case 'x': options.drop_percent = atoi(optarg); break;
+        case 'M': options.links = atoi(optarg); break;
+        case 'k': key_path = optarg; break;
+        case 'U': options.unix_path = optarg; break;
+        case 'S': options.shared = true; break;
+        case 'f':
+            if (!load_script(optarg))
+            {
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.players < 2 || options.threads < 1 || options.threads > options.players ||
+        (options.links > 0 && (options.threads > options.links || options.drop_percent > 0 || !key_path)) ||
+        (options.shared && (options.links == 0 || !options.unix_path)))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (key_path)
+    {
+        // Same rules as the server: at most MUX_KEY_SIZE bytes, without the line end
+        FILE *file = fopen(key_path, "r");
+        size_t length = file ? fread(options.key, 1, MUX_KEY_SIZE, file) : 0;
+        if (file)
+        {
+            fclose(file);
+        }
+        while (length > 0 && (options.key[length - 1] == '\n' || options.key[length - 1] == '\r'))
+        {
+            options.key[--length] = 0;
+        }
+        if (length == 0)
+        {
+            fprintf(stderr, "Cannot read key from %s\n", key_path);
+            return 1;
+        }
+    }
+
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    memset(&attachAddr, 0, sizeof(attachAddr));
+    if (options.unix_path)
+    {
+        struct sockaddr_un *player = (struct sockaddr_un *)&serverAddr;
+        struct sockaddr_un *attach = (struct sockaddr_un *)&attachAddr;
+        std::string attachPath = std::string(options.unix_path) + UNIX_ATTACH_SUFFIX;
+        if (attachPath.size() >= sizeof(attach->sun_path))
+        {
+            fprintf(stderr, "Unix socket path too long: %s\n", options.unix_path);
+            return 1;
+        }
+        player->sun_family = AF_UNIX;
+        attach->sun_family = AF_UNIX;
+        strcpy(player->sun_path, options.unix_path);
+        strcpy(attach->sun_path, attachPath.c_str());
+        addrLength = sizeof(struct sockaddr_un);
+    }
+    else
+    {
+        struct sockaddr_in *player = (struct sockaddr_in *)&serverAddr;
+        player->sin_family = AF_INET;
+        player->sin_port = htons(options.port);
+        if (inet_pton(AF_INET, options.host, &player->sin_addr) != 1)
+        {
+            fprintf(stderr, "Invalid server address: %s\n", options.host);
+            return 1;
+        }
+        memcpy(&attachAddr, player, sizeof(*player));
+        ((struct sockaddr_in *)&attachAddr)->sin_port = htons(ATTACH_PORT);
+        addrLength = sizeof(struct sockaddr_in);
+    }
+
+    char target[128];
+    if (options.unix_path)
+    {
+        snprintf(target, sizeof(target), "%s%s", options.unix_path, options.links > 0 ? UNIX_ATTACH_SUFFIX : "");
+    }
+    else
+    {
+        snprintf(target, sizeof(target), "%s:%d", options.host, options.links > 0 ? ATTACH_PORT : options.port);
+    }
+    if (options.links > 0)
+    {
+        printf("Simulating %d players (%d games) over %d multiplexed %sconnections on %d threads against %s for %.1f s\n",
+               options.players, options.players / 2, options.links, options.shared ? "shared memory " : "",
+               options.threads, target, options.duration_s);
+    }
+    else
+    {
+        printf("Simulating %d players (%d games) on %d threads against %s for %.1f s\n",
+               options.players, options.players / 2, options.threads, target, options.duration_s);
+    }
+
+    start_ns = now_ns();
+    end_ns = start_ns + (int64_t)(options.duration_s * 1e9);
+
+    std::vector<Worker> workers(options.threads);
+    std::vector<WorkerStats *> stats(options.threads);
+    for (int i = 0; i < options.threads; i++)
+    {
+        stats[i] = (WorkerStats *)calloc(1, sizeof(WorkerStats));
+        workers[i].first_player = options.players * i / options.threads;
+        workers[i].player_count = options.players * (i + 1) / options.threads - workers[i].first_player;
+        workers[i].first_link = options.links * i / options.threads;
+        workers[i].link_count = options.links * (i + 1) / options.threads - workers[i].first_link;
+        workers[i].stats = stats[i];
+        pthread_create(&workers[i].thread, NULL, options.links > 0 ? muxWorkerThread : workerThread, &workers[i]);
+    }
+
+    WorkerStats *total = (WorkerStats *)calloc(1, sizeof(WorkerStats));
+    for (int i = 0; i < options.threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        histogram_merge(total->connect_ns, stats[i]->connect_ns);
+        histogram_merge(total->move_rtt_ns, stats[i]->move_rtt_ns);
+        histogram_merge(total->reattach_ns, stats[i]->reattach_ns);
+        total->moves += stats[i]->moves;
+        total->reattaches += stats[i]->reattaches;
+        total->games += stats[i]->games;
+        total->errors += stats[i]->errors;
+        free(stats[i]);
+    }
+    double elapsed = (now_ns() - start_ns) / 1e9;
+
+    printf("Games finished: %llu, errors: %llu\n", (unsigned long long)total->games, (unsigned long long)total->errors);
+    printf("Moves: %llu (%.1f moves/s)\n", (unsigned long long)total->moves, total->moves / elapsed);
+    print_histogram("Connect latency", total->connect_ns);
+    print_histogram("Move round-trip", total->move_rtt_ns);
+    if (options.drop_percent > 0)
+    {
+        printf("Reattached: %llu\n", (unsigned long long)total->reattaches);
+        print_histogram("Reattach latency", total->reattach_ns);
+    }
+    free(total);
+    return 0;
+}
@@ -0,0 +1,322 @@
+#include "log.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+std::atomic<int> log_min_level(LOG_LEVEL_INFO);
+
+// Single-producer single-consumer ring of one thread
+struct LogRing {
+    LogRecord records[LOG_RING_SIZE];
+    std::atomic<uint64_t> head;    // Written by the producer
+    std::atomic<uint64_t> tail;    // Written by the writer thread
+    std::atomic<uint64_t> dropped; // Records lost to a full ring or the rate limit
+    double tokens;                 // Rate limiter state, producer only
+    uint64_t refilled_ns;
+    bool in_use;
+    LogRing *next;
+};
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static LogRing *rings = NULL;
+static int log_fd = STDOUT_FILENO;
+static uint64_t log_epoch_ns = 0;
+
+static const char *level_names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+static uint64_t log_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Hands the ring to the next new thread once its owner exits, pending records are still written
+struct LogRingOwner {
+    LogRing *ring = NULL;
+    ~LogRingOwner()
+    {
+        if (ring)
+        {
+            pthread_mutex_lock(&rings_lock);
+            ring->in_use = false;
+            pthread_mutex_unlock(&rings_lock);
+        }
+    }
+};
+static thread_local LogRingOwner ring_owner;
+
+static LogRing *log_acquire_ring()
+{
+    pthread_mutex_lock(&rings_lock);
+    LogRing *ring = rings;
+    while (ring && ring->in_use)
+    {
+        ring = ring->next;
+    }
+    if (!ring)
+    {
+        ring = (LogRing *)calloc(1, sizeof(LogRing));
+        if (!ring)
+        {
+            pthread_mutex_unlock(&rings_lock);
+            return NULL;
+        }
+        ring->next = rings;
+        rings = ring;
+    }
+    ring->in_use = true;
+    ring->tokens = LOG_RATE_PER_SEC;
+    ring->refilled_ns = log_now_ns();
+    pthread_mutex_unlock(&rings_lock);
+    return ring;
+}
+
+void log_push(LogLevel level, const char *format, const LogArg *args, int arg_count)
+{
+    LogRing *ring = ring_owner.ring;
+    if (!ring)
+    {
+        ring = ring_owner.ring = log_acquire_ring();
+        if (!ring)
+        {
+            return;
+        }
+    }
+    uint64_t now = log_now_ns();
+
+    // Token bucket: a chatty thread loses records instead of flooding the writer
+    ring->tokens += (now - ring->refilled_ns) * (LOG_RATE_PER_SEC / 1e9);
+    ring->refilled_ns = now;
+    if (ring->tokens > LOG_RATE_PER_SEC)
+    {
+        ring->tokens = LOG_RATE_PER_SEC;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (ring->tokens < 1.0 || head - ring->tail.load(std::memory_order_acquire) == LOG_RING_SIZE)
+    {
+        ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    ring->tokens -= 1.0;
+
+    LogRecord &record = ring->records[head % LOG_RING_SIZE];
+    record.time_ns = now;
+    record.format = format;
+    record.level = (uint8_t)level;
+    record.arg_count = (uint8_t)arg_count;
+    memcpy(record.args, args, arg_count * sizeof(LogArg));
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+// Batched output of the writer thread
+struct LogBuffer {
+    char data[64 * 1024];
+    size_t used;
+};
+
+static void buffer_flush(LogBuffer &buffer)
+{
+    size_t written = 0;
+    while (written < buffer.used)
+    {
+        ssize_t n = write(log_fd, buffer.data + written, buffer.used - written);
+        if (n <= 0)
+        {
+            break; // Nowhere to write, drop the batch
+        }
+        written += n;
+    }
+    buffer.used = 0;
+}
+
+static void buffer_append(LogBuffer &buffer, const char *text, size_t length)
+{
+    if (buffer.used + length > sizeof(buffer.data))
+    {
+        buffer_flush(buffer);
+    }
+    if (length > sizeof(buffer.data))
+    {
+        length = sizeof(buffer.data);
+    }
+    memcpy(buffer.data + buffer.used, text, length);
+    buffer.used += length;
+}
+
+// Expands one record. Each conversion is formatted on its own, with the
+// length modifier replaced to match how the argument was stored.
+static void format_record(LogBuffer &buffer, const LogRecord &record)
+{
+    char line[1024];
+    int length = snprintf(line, sizeof(line), "[%12.6f] %s ", (record.time_ns - log_epoch_ns) / 1e9,
+                          level_names[record.level & 3]);
+
+    int arg = 0;
+    for (const char *p = record.format; *p && length < (int)sizeof(line) - 1;)
+    {
+        if (*p != '%')
+        {
+            line[length++] = *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            line[length++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Copy flags, width and precision, skip length modifiers
+        char spec[32] = "%";
+        int spec_length = 1;
+        const char *q = p + 1;
+        while (*q && strchr("-+ #0123456789.", *q) && spec_length < 20)
+        {
+            spec[spec_length++] = *q++;
+        }
+        while (*q && strchr("hlLqjzt", *q))
+        {
+            q++;
+        }
+        char conversion = *q;
+        if (!conversion)
+        {
+            break;
+        }
+        p = q + 1;
+
+        LogArg value;
+        value.u = 0;
+        if (arg < record.arg_count)
+        {
+            value = record.args[arg];
+        }
+        arg++;
+
+        char *out = line + length;
+        size_t room = sizeof(line) - length;
+        int n = 0;
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+            memcpy(spec + spec_length, "lld", 4);
+            n = snprintf(out, room, spec, value.i);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec[spec_length] = 'l';
+            spec[spec_length + 1] = 'l';
+            spec[spec_length + 2] = conversion;
+            spec[spec_length + 3] = '\0';
+            n = snprintf(out, room, spec, value.u);
+            break;
+        case 'c':
+            memcpy(spec + spec_length, "c", 2);
+            n = snprintf(out, room, spec, (int)value.i);
+            break;
+        case 's':
+            memcpy(spec + spec_length, "s", 2);
+            n = snprintf(out, room, spec, value.s ? value.s : "(null)");
+            break;
+        case 'f':
+        case 'g':
+        case 'e':
+            spec[spec_length] = conversion;
+            spec[spec_length + 1] = '\0';
+            n = snprintf(out, room, spec, value.d);
+            break;
+        default:
+            n = snprintf(out, room, "?");
+            break;
+        }
+        length += (n < (int)room) ? n : (int)room - 1;
+    }
+    if (length > (int)sizeof(line) - 2)
+    {
+        length = sizeof(line) - 2;
+    }
+    line[length++] = '\n';
+    buffer_append(buffer, line, length);
+}
+
+// Drains every ring once; returns the number of records written
+static size_t log_drain(LogBuffer &buffer)
+{
+    size_t count = 0;
+    pthread_mutex_lock(&rings_lock);
+    for (LogRing *ring = rings; ring; ring = ring->next)
+    {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail < head; tail++)
+        {
+            format_record(buffer, ring->records[tail % LOG_RING_SIZE]);
+            count++;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped)
+        {
+            char line[96];
+            int n = snprintf(line, sizeof(line), "[%12.6f] WARN  %llu log messages dropped\n",
+                             (log_now_ns() - log_epoch_ns) / 1e9, (unsigned long long)dropped);
+            buffer_append(buffer, line, n);
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+    buffer_flush(buffer);
+    return count;
+}
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static LogBuffer writer_buffer;
+
+static void *logWriterThread(void *)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&writer_lock);
+        size_t count = log_drain(writer_buffer);
+        pthread_mutex_unlock(&writer_lock);
+
+        // Producers never signal, poll at a short interval while idle
+        if (count == 0)
+        {
+            struct timespec pause = {0, 5 * 1000 * 1000};
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+bool log_start(LogLevel min_level, int fd)
+{
+    log_min_level.store(min_level, std::memory_order_relaxed);
+    log_fd = fd;
+    log_epoch_ns = log_now_ns();
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, logWriterThread, NULL) != 0)
+    {
+        return false;
+    }
+    pthread_detach(thread_id);
+    atexit(log_flush); // Keep the last messages when the process exits
+    return true;
+}
+
+void log_flush()
+{
+    pthread_mutex_lock(&writer_lock);
+    log_drain(writer_buffer);
+    pthread_mutex_unlock(&writer_lock);
+}
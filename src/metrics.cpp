@@ -0,0 +1,214 @@
+#include "metrics.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+thread_local ThreadMetrics *metrics_tls = NULL;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadMetrics *registry = NULL; // All blocks ever created, owned or free
+
+static const char *counter_names[METRIC_COUNTERS] = {
+    "accepts", "sessions_started", "sessions_rejected", "moves_received", "moves_validated",
+    "moves_rejected", "bytes_in", "bytes_out", "spectators_joined", "spectators_dropped",
+    "sessions_resumed", "position_cache_hits", "position_cache_misses",
+    "analysis_requests", "analysis_cached", "analysis_coalesced", "analysis_cancelled",
+    "mux_connections", "mux_frames_replaced",
+};
+static const char *disconnect_names[DISCONNECT_REASONS] = {
+    "checkmate", "stalemate", "peer_closed", "resigned", "error", "time_forfeit", "idle",
+};
+static const char *timer_names[METRIC_TIMERS] = {
+    "can_move_ns", "game_decider_ns", "analysis_ns",
+};
+
+// Returns the thread's block to the registry when the thread exits
+struct MetricsRelease {
+    bool armed = false;
+    ~MetricsRelease()
+    {
+        if (metrics_tls)
+        {
+            pthread_mutex_lock(&registry_lock);
+            metrics_tls->in_use = false;
+            pthread_mutex_unlock(&registry_lock);
+            metrics_tls = NULL;
+        }
+    }
+};
+static thread_local MetricsRelease metrics_release;
+
+ThreadMetrics *metrics_acquire()
+{
+    metrics_release.armed = true; // Touching the guard registers its destructor for this thread
+
+    pthread_mutex_lock(&registry_lock);
+    ThreadMetrics *block = registry;
+    while (block && block->in_use)
+    {
+        block = block->next;
+    }
+    if (!block)
+    {
+        block = (ThreadMetrics *)calloc(1, sizeof(ThreadMetrics));
+        if (!block)
+        {
+            pthread_mutex_unlock(&registry_lock);
+            abort();
+        }
+        block->next = registry;
+        registry = block;
+    }
+    block->in_use = true;
+    pthread_mutex_unlock(&registry_lock);
+    return block;
+}
+
+// Sum of all blocks; `total` must be zeroed
+static void metrics_collect(ThreadMetrics *total)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (ThreadMetrics *block = registry; block; block = block->next)
+    {
+        for (int i = 0; i < METRIC_COUNTERS; i++)
+        {
+            total->counters[i].store(total->counters[i].load(std::memory_order_relaxed) +
+                                     block->counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        for (int i = 0; i < DISCONNECT_REASONS; i++)
+        {
+            total->disconnects[i].store(total->disconnects[i].load(std::memory_order_relaxed) +
+                                        block->disconnects[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        for (int i = 0; i < METRIC_TIMERS; i++)
+        {
+            histogram_merge(total->timers[i], block->timers[i]);
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+struct StatsEndpoint {
+    int socket;
+    MetricsGaugeFn gauges;
+};
+
+static void *statsThread(void *arg)
+{
+    StatsEndpoint *endpoint = (StatsEndpoint *)arg;
+    uint64_t started = metrics_now_ns();
+    uint64_t last_scrape = started;
+    uint64_t last_counters[METRIC_COUNTERS] = {0};
+    ThreadMetrics *total = (ThreadMetrics *)malloc(sizeof(ThreadMetrics));
+
+    while (1)
+    {
+        int peer = accept(endpoint->socket, NULL, NULL);
+        if (peer < 0)
+        {
+            continue;
+        }
+
+        // Plain TCP or HTTP GET both work, the request itself is not interpreted
+        struct timeval timeout = {1, 0};
+        setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        bool http = recv(peer, request, sizeof(request), 0) > 0 && strncmp(request, "GET ", 4) == 0;
+
+        memset((void *)total, 0, sizeof(ThreadMetrics));
+        metrics_collect(total);
+        uint64_t now = metrics_now_ns();
+        double since_last = (now - last_scrape) / 1e9;
+
+        char *body = NULL;
+        size_t body_size = 0;
+        FILE *out = open_memstream(&body, &body_size);
+        fprintf(out, "uptime_seconds %.3f\n", (now - started) / 1e9);
+        if (endpoint->gauges)
+        {
+            endpoint->gauges(out);
+        }
+        for (int i = 0; i < METRIC_COUNTERS; i++)
+        {
+            uint64_t value = total->counters[i].load();
+            fprintf(out, "%s_total %llu\n", counter_names[i], (unsigned long long)value);
+            fprintf(out, "%s_per_second %.1f\n", counter_names[i],
+                    since_last > 0 ? (value - last_counters[i]) / since_last : 0.0);
+            last_counters[i] = value;
+        }
+        uint64_t hits = total->counters[METRIC_POSITION_CACHE_HITS].load();
+        uint64_t lookups = hits + total->counters[METRIC_POSITION_CACHE_MISSES].load();
+        fprintf(out, "position_cache_hit_ratio %.4f\n", lookups > 0 ? (double)hits / lookups : 0.0);
+        for (int i = 0; i < DISCONNECT_REASONS; i++)
+        {
+            fprintf(out, "disconnects_total{reason=\"%s\"} %llu\n", disconnect_names[i],
+                    (unsigned long long)total->disconnects[i].load());
+        }
+        for (int i = 0; i < METRIC_TIMERS; i++)
+        {
+            const LatencyHistogram &h = total->timers[i];
+            fprintf(out, "%s{quantile=\"0.5\"} %llu\n", timer_names[i], (unsigned long long)histogram_percentile(h, 50.0));
+            fprintf(out, "%s{quantile=\"0.99\"} %llu\n", timer_names[i], (unsigned long long)histogram_percentile(h, 99.0));
+            fprintf(out, "%s{quantile=\"0.999\"} %llu\n", timer_names[i], (unsigned long long)histogram_percentile(h, 99.9));
+            fprintf(out, "%s_max %llu\n", timer_names[i], (unsigned long long)h.max.load());
+            fprintf(out, "%s_count %llu\n", timer_names[i], (unsigned long long)histogram_count(h));
+        }
+        fclose(out);
+        last_scrape = now;
+
+        if (http)
+        {
+            char header[128];
+            int n = snprintf(header, sizeof(header),
+                             "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n\r\n", body_size);
+            send(peer, header, n, MSG_NOSIGNAL);
+        }
+        send(peer, body, body_size, MSG_NOSIGNAL);
+        free(body);
+        close(peer);
+    }
+    return NULL;
+}
+
+const char *disconnect_reason_name(DisconnectReason reason)
+{
+    return disconnect_names[reason];
+}
+
+bool metrics_serve(int port, MetricsGaugeFn gauges)
+{
+    int statsSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (statsSocket == -1)
+    {
+        return false;
+    }
+    int opt = 1;
+    setsockopt(statsSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Loopback only, the stats are meant for local scrapers
+    struct sockaddr_in statsAddr;
+    memset(&statsAddr, 0, sizeof(statsAddr));
+    statsAddr.sin_family = AF_INET;
+    statsAddr.sin_port = htons(port);
+    statsAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(statsSocket, (struct sockaddr *)&statsAddr, sizeof(statsAddr)) == -1 || listen(statsSocket, 16) == -1)
+    {
+        close(statsSocket);
+        return false;
+    }
+
+    StatsEndpoint *endpoint = new StatsEndpoint{statsSocket, gauges};
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, statsThread, endpoint) != 0)
+    {
+        close(statsSocket);
+        delete endpoint;
+        return false;
+    }
+    pthread_detach(thread_id);
+    return true;
+}
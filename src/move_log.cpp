@@ -0,0 +1,428 @@
+#include "move_log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Appends fill `batch`; the writer thread swaps it with `flushing`, which it
+// writes and syncs without holding the lock.
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_pending = PTHREAD_COND_INITIALIZER; // Records appended or stopping
+static pthread_cond_t log_synced = PTHREAD_COND_INITIALIZER;  // `durable` advanced or room in `batch`
+static MoveLogRecord *batch = NULL;
+static MoveLogRecord *flushing = NULL;
+static size_t batch_count = 0;
+static uint64_t appended = 0; // Sequence number of the last appended record
+static uint64_t durable = 0;  // Sequence number of the last record on disk
+static bool stopping = false;
+static bool failed = false;   // A batch could not be made durable; nothing is acknowledged from then on
+static bool logging = false;  // Appends are taken
+static int log_fd = -1;       // Owned by the writer thread while it runs
+static pthread_t writer_thread;
+static char log_path[4096];
+
+// Records of the running games, in log order. The writer keeps them up to
+// date with what it writes, so it can checkpoint the log without looking at
+// the sessions, and a game past MAX_PLIES keeps every move.
+static std::unordered_map<uint32_t, std::vector<MoveLogRecord>> live_games;
+static size_t live_records = 0;
+static size_t log_records = 0;                        // Records in the file
+static size_t compact_floor = MOVE_LOG_COMPACT_MIN;   // Size the next checkpoint waits for
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Applies a record written to the log to the running games
+static void track(const MoveLogRecord &record)
+{
+    if (record.type == MOVE_LOG_START)
+    {
+        std::vector<MoveLogRecord> &records = live_games[record.game];
+        live_records -= records.size();
+        records.assign(1, record);
+        live_records++;
+        return;
+    }
+    auto game = live_games.find(record.game);
+    if (game == live_games.end())
+    {
+        return;
+    }
+    if (record.type == MOVE_LOG_MOVE)
+    {
+        game->second.push_back(record);
+        live_records++;
+    }
+    else if (record.type == MOVE_LOG_END)
+    {
+        live_records -= game->second.size();
+        live_games.erase(game);
+    }
+}
+
+// Writes the records of the running games to a fresh log and swaps it in;
+// the descriptor of the new log, -1 on failure
+static int compact(const char *path)
+{
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    std::vector<MoveLogRecord> records;
+    records.reserve(MOVE_LOG_BATCH);
+    bool written = true;
+    for (const auto &game : live_games)
+    {
+        records.insert(records.end(), game.second.begin(), game.second.end());
+        if (records.size() >= MOVE_LOG_BATCH)
+        {
+            written = written && write_all(fd, records.data(), records.size() * sizeof(MoveLogRecord));
+            records.clear();
+        }
+    }
+    written = written && write_all(fd, records.data(), records.size() * sizeof(MoveLogRecord)) && fdatasync(fd) == 0;
+    if (!written || rename(temporary, path) != 0)
+    {
+        close(fd);
+        unlink(temporary);
+        return -1;
+    }
+
+    // Make the rename itself durable
+    char directory[4096];
+    snprintf(directory, sizeof(directory), "%s", path);
+    int dir_fd = open(dirname(directory), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    log_records = live_records;
+    return fd;
+}
+
+// Replaces the log with the running games once ended games dominate it
+static void checkpoint()
+{
+    if (log_records < compact_floor || log_records <= MOVE_LOG_COMPACT_RATIO * live_records)
+    {
+        return;
+    }
+    int fd = compact(log_path);
+    if (fd < 0)
+    {
+        perror("Move log checkpoint failed");
+        compact_floor = log_records * 2; // Retry once the log has doubled
+        return;
+    }
+    close(log_fd);
+    log_fd = fd;
+    compact_floor = MOVE_LOG_COMPACT_MIN;
+}
+
+// Writes and syncs a batch at the end of the log. A failed attempt is cut
+// back off the file, so a retry never lands after a torn record.
+static bool write_batch(const MoveLogRecord *records, size_t count)
+{
+    off_t good = (off_t)(log_records * sizeof(MoveLogRecord));
+    for (int attempt = 0; attempt < MOVE_LOG_RETRIES; attempt++)
+    {
+        if (write_all(log_fd, records, count * sizeof(MoveLogRecord)) && fdatasync(log_fd) == 0)
+        {
+            return true;
+        }
+        perror("Move log write failed");
+        if (ftruncate(log_fd, good) != 0 || lseek(log_fd, good, SEEK_SET) < 0)
+        {
+            perror("Move log truncate failed");
+            return false;
+        }
+    }
+    return false;
+}
+
+static void *writerThread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&log_lock);
+    while (1)
+    {
+        while (batch_count == 0 && !stopping)
+        {
+            pthread_cond_wait(&log_pending, &log_lock);
+        }
+        if (batch_count == 0)
+        {
+            break; // Stopping with nothing left
+        }
+
+        // Everything appended so far goes out with the next sync
+        MoveLogRecord *full = batch;
+        size_t count = batch_count;
+        uint64_t target = appended;
+        batch = flushing;
+        flushing = full;
+        batch_count = 0;
+        pthread_cond_broadcast(&log_synced); // Appends blocked on a full batch can go on
+        pthread_mutex_unlock(&log_lock);
+
+        // Once a batch is lost, later ones could only be recovered without it
+        bool written = !failed && write_batch(full, count);
+        if (written)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                track(full[i]);
+            }
+            log_records += count;
+        }
+
+        pthread_mutex_lock(&log_lock);
+        if (written)
+        {
+            durable = target;
+        }
+        else if (!failed)
+        {
+            fprintf(stderr, "Move log: batch could not be synced, no further moves are acknowledged\n");
+            failed = true;
+        }
+        pthread_cond_broadcast(&log_synced);
+
+        // Appends go on into the other batch meanwhile
+        if (written)
+        {
+            pthread_mutex_unlock(&log_lock);
+            checkpoint();
+            pthread_mutex_lock(&log_lock);
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+    return NULL;
+}
+
+static uint64_t move_log_append(const MoveLogRecord &record)
+{
+    if (!logging)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&log_lock);
+    while (batch_count == MOVE_LOG_BATCH)
+    {
+        pthread_cond_wait(&log_synced, &log_lock); // The disk fell behind
+    }
+    batch[batch_count++] = record;
+    uint64_t sequence = ++appended;
+    if (batch_count == 1)
+    {
+        pthread_cond_signal(&log_pending);
+    }
+    pthread_mutex_unlock(&log_lock);
+    return sequence;
+}
+
+uint64_t move_log_start(const GameSession *session)
+{
+    MoveLogRecord record = {session->id, MOVE_LOG_START, 0, 0, session->resume_secret[0], session->resume_secret[1]};
+    return move_log_append(record);
+}
+
+uint64_t move_log_move(const GameSession *session, uint16_t move, int32_t remaining_ms)
+{
+    MoveLogRecord record = {session->id, MOVE_LOG_MOVE, 0, move, (uint32_t)remaining_ms, 0};
+    return move_log_append(record);
+}
+
+uint64_t move_log_end(const GameSession *session)
+{
+    MoveLogRecord record = {session->id, MOVE_LOG_END, 0, 0, 0, 0};
+    return move_log_append(record);
+}
+
+bool move_log_wait(uint64_t sequence)
+{
+    if (sequence == 0)
+    {
+        return true;
+    }
+    pthread_mutex_lock(&log_lock);
+    while (durable < sequence && !failed)
+    {
+        pthread_cond_wait(&log_synced, &log_lock);
+    }
+    bool synced = durable >= sequence;
+    pthread_mutex_unlock(&log_lock);
+    return synced;
+}
+
+// Replays the records into the session pool, collecting the games still running
+static void replay(const MoveLogRecord *records, size_t count, int32_t clock_base_ms, std::vector<GameSession *> &games)
+{
+    // Ended games are skipped entirely, so only running ones take a slot
+    std::unordered_set<uint32_t> ended;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (records[i].type == MOVE_LOG_END)
+        {
+            ended.insert(records[i].game);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const MoveLogRecord &record = records[i];
+        if (ended.count(record.game))
+        {
+            continue;
+        }
+        if (record.type == MOVE_LOG_START)
+        {
+            GameSession *session = session_restore(record.game);
+            if (!session)
+            {
+                fprintf(stderr, "Move log: no slot for game %u, dropped\n", record.game);
+                continue;
+            }
+            session->resume_secret[0] = record.a;
+            session->resume_secret[1] = record.b;
+            session->clock.remaining_ms[0] = session->clock.remaining_ms[1] = clock_base_ms;
+            games.push_back(session);
+            track(record);
+        }
+        else if (record.type == MOVE_LOG_MOVE)
+        {
+            GameSession *session = session_find(record.game);
+            if (!session)
+            {
+                continue;
+            }
+            int move[4];
+            unpack_move(record.move, move);
+            if (!can_move(session->board, move, session->turn))
+            {
+                fprintf(stderr, "Move log: illegal move in game %u, ignored\n", record.game);
+                continue;
+            }
+            session_record_move(session, move); // Only the board goes past MAX_PLIES
+            track(record);
+            if (clock_base_ms > 0)
+            {
+                session->clock.remaining_ms[session->turn == 'w' ? 0 : 1] = (int32_t)record.a;
+            }
+            session->turn = (session->turn == 'w') ? 'b' : 'w';
+        }
+    }
+}
+
+bool move_log_open(const char *path, int32_t clock_base_ms, void (*restored)(GameSession *session))
+{
+    std::vector<GameSession *> games;
+    live_games.clear();
+    live_records = 0;
+    snprintf(log_path, sizeof(log_path), "%s", path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        struct stat st;
+        // A record torn by a crash at the end is ignored
+        size_t count = (fstat(fd, &st) == 0) ? st.st_size / sizeof(MoveLogRecord) : 0;
+        if (count > 0)
+        {
+            void *mapped = mmap(NULL, count * sizeof(MoveLogRecord), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                close(fd);
+                return false;
+            }
+            madvise(mapped, count * sizeof(MoveLogRecord), MADV_SEQUENTIAL);
+            replay((const MoveLogRecord *)mapped, count, clock_base_ms, games);
+            munmap(mapped, count * sizeof(MoveLogRecord));
+        }
+        close(fd);
+    }
+    else if (errno != ENOENT)
+    {
+        return false;
+    }
+    session_pool_relink();
+
+    log_fd = compact(log_path);
+    if (log_fd < 0)
+    {
+        return false;
+    }
+    compact_floor = MOVE_LOG_COMPACT_MIN;
+    batch = (MoveLogRecord *)malloc(MOVE_LOG_BATCH * sizeof(MoveLogRecord));
+    flushing = (MoveLogRecord *)malloc(MOVE_LOG_BATCH * sizeof(MoveLogRecord));
+    batch_count = 0;
+    appended = durable = 0;
+    stopping = false;
+    failed = false;
+    if (!batch || !flushing || pthread_create(&writer_thread, NULL, writerThread, NULL) != 0)
+    {
+        free(batch);
+        free(flushing);
+        close(log_fd);
+        log_fd = -1;
+        return false;
+    }
+    logging = true;
+
+    for (GameSession *session : games)
+    {
+        restored(session);
+    }
+    return true;
+}
+
+void move_log_close()
+{
+    if (!logging)
+    {
+        return;
+    }
+    pthread_mutex_lock(&log_lock);
+    logging = false;
+    stopping = true;
+    pthread_cond_signal(&log_pending);
+    pthread_mutex_unlock(&log_lock);
+    pthread_join(writer_thread, NULL);
+
+    close(log_fd);
+    log_fd = -1;
+    free(batch);
+    free(flushing);
+    batch = flushing = NULL;
+    live_games.clear();
+    live_records = log_records = 0;
+}
@@ -0,0 +1,171 @@
+#include "position_cache.h"
+#include "metrics.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct CachedPosition {
+    uint64_t hash;
+    uint8_t placement[32]; // One nibble per square, see pack_placement()
+    LegalMoves legal;
+    char outcome;
+    uint8_t used;
+    uint8_t referenced;    // CLOCK mark, set by a hit
+};
+
+struct CacheSet {
+    CachedPosition ways[POSITION_CACHE_WAYS];
+    uint8_t hand;          // Next way the CLOCK hand looks at
+};
+
+static CacheSet *sets = NULL;
+static size_t set_mask = 0;
+static pthread_mutex_t locks[POSITION_CACHE_LOCKS];
+
+static void pack_placement(const Chessboard &board, uint8_t placement[32])
+{
+    const char *types = "pkbrqK";
+    memset(placement, 0, 32);
+    for (int square = 0; square < 64; square++)
+    {
+        const Piece &piece = board[square / 8][square % 8];
+        const char *found = (piece.type != 'e' && piece.type != '\0') ? strchr(types, piece.type) : NULL;
+        uint8_t code = found ? (uint8_t)(1 + (found - types) + (piece.color == 'b' ? 6 : 0)) : 0;
+        placement[square / 2] |= code << ((square % 2) * 4);
+    }
+}
+
+bool position_cache_init(size_t memory_bytes)
+{
+    position_cache_free();
+    if (memory_bytes < sizeof(CacheSet))
+    {
+        return true; // Disabled
+    }
+    size_t count = 1;
+    while (count * 2 * sizeof(CacheSet) <= memory_bytes)
+    {
+        count *= 2;
+    }
+    sets = (CacheSet *)calloc(count, sizeof(CacheSet));
+    if (!sets)
+    {
+        return false;
+    }
+    set_mask = count - 1;
+    for (int i = 0; i < POSITION_CACHE_LOCKS; i++)
+    {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    return true;
+}
+
+void position_cache_free()
+{
+    if (!sets)
+    {
+        return;
+    }
+    for (int i = 0; i < POSITION_CACHE_LOCKS; i++)
+    {
+        pthread_mutex_destroy(&locks[i]);
+    }
+    free(sets);
+    sets = NULL;
+    set_mask = 0;
+}
+
+size_t position_cache_capacity()
+{
+    return sets ? (set_mask + 1) * POSITION_CACHE_WAYS : 0;
+}
+
+static bool cache_lookup(uint64_t hash, const uint8_t placement[32], LegalMoves &legal, char &outcome)
+{
+    size_t index = hash & set_mask;
+    CacheSet &set = sets[index];
+    bool hit = false;
+    pthread_mutex_lock(&locks[index % POSITION_CACHE_LOCKS]);
+    for (CachedPosition &way : set.ways)
+    {
+        if (way.used && way.hash == hash && memcmp(way.placement, placement, 32) == 0)
+        {
+            legal = way.legal;
+            outcome = way.outcome;
+            way.referenced = 1;
+            hit = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&locks[index % POSITION_CACHE_LOCKS]);
+    return hit;
+}
+
+static void cache_insert(uint64_t hash, const uint8_t placement[32], const LegalMoves &legal, char outcome)
+{
+    size_t index = hash & set_mask;
+    CacheSet &set = sets[index];
+    pthread_mutex_lock(&locks[index % POSITION_CACHE_LOCKS]);
+    CachedPosition *victim = NULL;
+    for (CachedPosition &way : set.ways)
+    {
+        if (way.used && way.hash == hash && memcmp(way.placement, placement, 32) == 0)
+        {
+            victim = &way; // Another thread got here first
+            break;
+        }
+    }
+    while (!victim)
+    {
+        CachedPosition &way = set.ways[set.hand];
+        set.hand = (set.hand + 1) % POSITION_CACHE_WAYS;
+        if (!way.used || !way.referenced)
+        {
+            victim = &way;
+            victim->referenced = 0;
+        }
+        else
+        {
+            way.referenced = 0; // Second chance
+        }
+    }
+    victim->hash = hash;
+    memcpy(victim->placement, placement, 32);
+    victim->legal = legal;
+    victim->outcome = outcome;
+    victim->used = 1;
+    pthread_mutex_unlock(&locks[index % POSITION_CACHE_LOCKS]);
+}
+
+char position_cache_evaluate(Chessboard &board, char turn, LegalMoves &legal)
+{
+    uint64_t hash = 0;
+    uint8_t placement[32];
+    char outcome;
+    if (sets)
+    {
+        hash = position_hash(board, turn);
+        pack_placement(board, placement);
+        if (cache_lookup(hash, placement, legal, outcome))
+        {
+            metrics_add(METRIC_POSITION_CACHE_HITS);
+            return outcome;
+        }
+        metrics_add(METRIC_POSITION_CACHE_MISSES);
+    }
+
+    outcome = gameDecider(board, turn);
+    if (outcome == turn)
+    {
+        legal_move_set(board, turn, legal);
+    }
+    else
+    {
+        memset(&legal, 0, sizeof(legal)); // Nothing left to play
+    }
+    if (sets)
+    {
+        cache_insert(hash, placement, legal, outcome);
+    }
+    return outcome;
+}
@@ -0,0 +1,509 @@
+#include "position_index.h"
+#include "archive.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define MERGE_CHUNK 65536 // Entries a merge thread collects per pwrite()
+
+static bool entry_less(const PositionEntry &a, const PositionEntry &b)
+{
+    if (a.hash != b.hash)
+        return a.hash < b.hash;
+    if (a.game != b.game)
+        return a.game < b.game;
+    return a.ply < b.ply;
+}
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool pwrite_all(int fd, const void *data, size_t size, off_t offset)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, bytes, size, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Phase 1: one thread replays a range of archive blocks into sorted runs
+struct ReplayTask {
+    const char *archive_path;
+    const char *index_path;
+    int number;
+    size_t first_block;
+    size_t last_block;             // One past the range
+    size_t capacity;               // Entries per run
+    std::vector<std::string> runs; // Files written
+    uint64_t damaged;              // Games that did not decode, left out
+    bool ok;
+};
+
+static bool write_run(ReplayTask &task, std::vector<PositionEntry> &buffer)
+{
+    std::sort(buffer.begin(), buffer.end(), entry_less);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.run.%d.%zu", task.index_path, task.number, task.runs.size());
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    task.runs.push_back(path);
+    bool written = write_all(fd, buffer.data(), buffer.size() * sizeof(PositionEntry));
+    close(fd);
+    buffer.clear();
+    return written;
+}
+
+static void *replayThread(void *arg)
+{
+    ReplayTask &task = *(ReplayTask *)arg;
+    ArchiveReader reader;
+    if (!archive_reader_open(reader, task.archive_path))
+    {
+        return NULL;
+    }
+    std::vector<PositionEntry> buffer;
+    buffer.reserve(task.capacity);
+    std::vector<uint16_t> moves(UINT16_MAX);
+
+    uint64_t number = reader.index[task.first_block].first_game;
+    uint64_t left = 0;
+    for (size_t i = task.first_block; i < task.last_block; i++)
+    {
+        left += reader.index[i].game_count;
+    }
+    archive_rewind(reader, task.first_block);
+
+    bool ok = true;
+    ArchivedGame game;
+    for (; ok && left > 0; left--, number++)
+    {
+        if (!archive_next(reader, game))
+        {
+            ok = false;
+            break;
+        }
+        if (!archive_decode(game, moves.data()))
+        {
+            task.damaged++;
+            continue;
+        }
+        Chessboard board = initializeBoard();
+        char turn = 'w';
+        for (int ply = 0; ply <= game.header.ply; ply++)
+        {
+            if (ply > 0)
+            {
+                int move[4];
+                unpack_move(moves[ply - 1], move);
+                can_move(board, move, turn);
+                turn = (turn == 'w') ? 'b' : 'w';
+            }
+            buffer.push_back({position_hash(board, turn), (uint32_t)number, (uint16_t)ply, 0});
+            if (buffer.size() == task.capacity && !write_run(task, buffer))
+            {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (ok && !buffer.empty())
+    {
+        ok = write_run(task, buffer);
+    }
+    archive_reader_close(reader);
+    task.ok = ok;
+    return NULL;
+}
+
+struct Run {
+    const PositionEntry *entries;
+    size_t count;
+};
+
+// Phase 2: one thread merges the slice of the hash space starting at
+// `begin[i]` of every run and ending at `end[i]` into the output at `offset`
+struct MergeTask {
+    const std::vector<Run> *runs;
+    std::vector<size_t> begin;
+    std::vector<size_t> end;
+    int fd;
+    off_t offset;
+    bool ok;
+};
+
+struct MergeCursor {
+    PositionEntry entry;
+    size_t run;
+};
+
+// Heap ordering, smallest entry on top
+static bool cursor_after(const MergeCursor &a, const MergeCursor &b)
+{
+    return entry_less(b.entry, a.entry);
+}
+
+static void *mergeThread(void *arg)
+{
+    MergeTask &task = *(MergeTask *)arg;
+    const std::vector<Run> &runs = *task.runs;
+    std::vector<MergeCursor> heap;
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (task.begin[i] < task.end[i])
+        {
+            heap.push_back({runs[i].entries[task.begin[i]], i});
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), cursor_after);
+
+    std::vector<PositionEntry> chunk;
+    chunk.reserve(MERGE_CHUNK);
+    off_t offset = task.offset;
+    bool ok = true;
+    while (!heap.empty() && ok)
+    {
+        std::pop_heap(heap.begin(), heap.end(), cursor_after);
+        MergeCursor &top = heap.back();
+        chunk.push_back(top.entry);
+        if (++task.begin[top.run] < task.end[top.run])
+        {
+            top.entry = runs[top.run].entries[task.begin[top.run]];
+            std::push_heap(heap.begin(), heap.end(), cursor_after);
+        }
+        else
+        {
+            heap.pop_back();
+        }
+        if (chunk.size() == MERGE_CHUNK || heap.empty())
+        {
+            ok = pwrite_all(task.fd, chunk.data(), chunk.size() * sizeof(PositionEntry), offset);
+            offset += chunk.size() * sizeof(PositionEntry);
+            chunk.clear();
+        }
+    }
+    task.ok = ok;
+    return NULL;
+}
+
+// First entry of a run with a hash not below `hash`
+static size_t run_lower_bound(const Run &run, uint64_t hash)
+{
+    size_t low = 0, high = run.count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (run.entries[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+static bool merge_runs(const std::vector<std::string> &paths, const char *index_path, int threads)
+{
+    std::vector<Run> runs;
+    std::vector<int> fds;
+    uint64_t count = 0;
+    bool ok = true;
+    for (const std::string &path : paths)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            ok = false;
+            break;
+        }
+        fds.push_back(fd);
+        Run run = {NULL, (size_t)st.st_size / sizeof(PositionEntry)};
+        if (run.count > 0)
+        {
+            void *mapped = mmap(NULL, run.count * sizeof(PositionEntry), PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                ok = false;
+                break;
+            }
+            madvise(mapped, run.count * sizeof(PositionEntry), MADV_SEQUENTIAL);
+            run.entries = (const PositionEntry *)mapped;
+        }
+        runs.push_back(run);
+        count += run.count;
+    }
+
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", index_path);
+    int fd = ok ? open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    PositionIndexHeader header = {POSITION_INDEX_MAGIC, 0, count};
+    ok = fd >= 0 && ftruncate(fd, sizeof(header) + count * sizeof(PositionEntry)) == 0 &&
+         pwrite_all(fd, &header, sizeof(header), 0);
+
+    if (ok)
+    {
+        // Hashes are uniform, so equal slices of the hash space hold about
+        // equally many entries; where a slice starts in each run fixes where
+        // it goes in the output
+        std::vector<MergeTask> tasks(threads);
+        off_t offset = sizeof(header);
+        for (int t = 0; t < threads; t++)
+        {
+            uint64_t low = (uint64_t)(((unsigned __int128)t << 64) / threads);
+            uint64_t high = (uint64_t)(((unsigned __int128)(t + 1) << 64) / threads);
+            MergeTask &task = tasks[t];
+            task.runs = &runs;
+            task.fd = fd;
+            task.offset = offset;
+            task.ok = false;
+            for (const Run &run : runs)
+            {
+                task.begin.push_back(run_lower_bound(run, low));
+                task.end.push_back(t + 1 == threads ? run.count : run_lower_bound(run, high));
+                offset += (task.end.back() - task.begin.back()) * sizeof(PositionEntry);
+            }
+        }
+        std::vector<pthread_t> ids(threads);
+        int started = 0;
+        for (; started < threads; started++)
+        {
+            if (pthread_create(&ids[started], NULL, mergeThread, &tasks[started]) != 0)
+            {
+                ok = false;
+                break;
+            }
+        }
+        for (int t = 0; t < started; t++)
+        {
+            pthread_join(ids[t], NULL);
+            ok = ok && tasks[t].ok;
+        }
+    }
+    ok = ok && fdatasync(fd) == 0;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (!ok || rename(temporary, index_path) != 0)
+    {
+        unlink(temporary);
+        ok = false;
+    }
+
+    for (const Run &run : runs)
+    {
+        if (run.entries)
+        {
+            munmap((void *)run.entries, run.count * sizeof(PositionEntry));
+        }
+    }
+    for (int run_fd : fds)
+    {
+        close(run_fd);
+    }
+    return ok;
+}
+
+bool position_index_build(const char *archive_path, const char *index_path, int threads, size_t memory_bytes)
+{
+    ArchiveReader reader;
+    if (!archive_reader_open(reader, archive_path))
+    {
+        return false;
+    }
+    size_t blocks = reader.blocks;
+    archive_reader_close(reader);
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    // No point in more replay threads than blocks
+    int replayers = (size_t)threads < blocks ? threads : (blocks > 0 ? (int)blocks : 1);
+    size_t capacity = std::max(memory_bytes / threads / sizeof(PositionEntry), (size_t)1024);
+
+    std::vector<ReplayTask> tasks(replayers);
+    std::vector<pthread_t> ids(replayers);
+    bool ok = true;
+    int started = 0;
+    for (; started < replayers && blocks > 0; started++)
+    {
+        ReplayTask &task = tasks[started];
+        task.archive_path = archive_path;
+        task.index_path = index_path;
+        task.number = started;
+        task.first_block = blocks * started / replayers;
+        task.last_block = blocks * (started + 1) / replayers;
+        task.capacity = capacity;
+        task.damaged = 0;
+        task.ok = false;
+        if (pthread_create(&ids[started], NULL, replayThread, &task) != 0)
+        {
+            ok = false;
+            break;
+        }
+    }
+    std::vector<std::string> runs;
+    uint64_t damaged = 0;
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(ids[t], NULL);
+        ok = ok && tasks[t].ok;
+        runs.insert(runs.end(), tasks[t].runs.begin(), tasks[t].runs.end());
+        damaged += tasks[t].damaged;
+    }
+    if (damaged > 0)
+    {
+        fprintf(stderr, "Position index: %llu damaged games left out\n", (unsigned long long)damaged);
+    }
+
+    ok = ok && merge_runs(runs, index_path, threads);
+    for (const std::string &run : runs)
+    {
+        unlink(run.c_str());
+    }
+    return ok;
+}
+
+bool position_index_open(PositionIndex &index, const char *path)
+{
+    index.data = NULL;
+    index.entries = NULL;
+    index.count = 0;
+    index.fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (index.fd < 0 || fstat(index.fd, &st) != 0 || (size_t)st.st_size < sizeof(PositionIndexHeader))
+    {
+        position_index_close(index);
+        return false;
+    }
+    index.size = st.st_size;
+    void *mapped = mmap(NULL, index.size, PROT_READ, MAP_SHARED, index.fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        position_index_close(index);
+        return false;
+    }
+    index.data = (const uint8_t *)mapped;
+
+    PositionIndexHeader header;
+    memcpy(&header, index.data, sizeof(header));
+    if (header.magic != POSITION_INDEX_MAGIC ||
+        header.count > (index.size - sizeof(header)) / sizeof(PositionEntry))
+    {
+        position_index_close(index);
+        return false;
+    }
+    index.entries = (const PositionEntry *)(index.data + sizeof(header));
+    index.count = header.count;
+    return true;
+}
+
+void position_index_close(PositionIndex &index)
+{
+    if (index.data)
+    {
+        munmap((void *)index.data, index.size);
+    }
+    if (index.fd >= 0)
+    {
+        close(index.fd);
+    }
+    index.data = NULL;
+    index.entries = NULL;
+    index.fd = -1;
+    index.count = 0;
+}
+
+// First entry with a hash not below `hash`. Hashes are uniform, so
+// interpolating between the ends of the range lands close; a probe that
+// fails to halve the range is followed by a plain bisection, which keeps
+// the worst case logarithmic.
+static uint64_t lower_bound(const PositionIndex &index, uint64_t hash)
+{
+    const PositionEntry *entries = index.entries;
+    uint64_t low = 0, high = index.count;
+    bool bisect = false;
+    while (low < high)
+    {
+        uint64_t first = entries[low].hash, last = entries[high - 1].hash;
+        if (hash <= first)
+        {
+            return low;
+        }
+        if (hash > last)
+        {
+            return high;
+        }
+        uint64_t middle;
+        if (bisect)
+        {
+            middle = low + (high - low) / 2;
+        }
+        else
+        {
+            double fraction = (double)(hash - first) / (double)(last - first);
+            middle = low + (uint64_t)(fraction * (high - 1 - low));
+        }
+        uint64_t size = high - low;
+        if (entries[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+        bisect = !bisect && high - low > size / 2;
+    }
+    return low;
+}
+
+uint64_t position_index_find(const PositionIndex &index, uint64_t hash, uint64_t &first)
+{
+    first = lower_bound(index, hash);
+    if (first == index.count || index.entries[first].hash != hash)
+    {
+        return 0;
+    }
+    uint64_t end = (hash == UINT64_MAX) ? index.count : lower_bound(index, hash + 1);
+    return end - first;
+}
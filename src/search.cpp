@@ -0,0 +1,540 @@
+#include "search.h"
+#include <stdio.h>
+#include <new>
+#include <time.h>
+
+#define MAX_LEGAL_MOVES 256
+#define SEARCH_INFINITY (SEARCH_MATE + 1)
+#define SEARCH_CHECK_NODES 64 // Nodes between looks at the clock and the stop flag
+#define MATE_FOUND (SEARCH_MATE - SEARCH_MAX_DEPTH - SEARCH_QUIESCENCE_DEPTH) // Scores beyond this are mates
+
+// Table entry data: score in bits 0-31, depth 32-39, bound 40-41, move 42-53, has move 54
+enum TableBound { BOUND_EXACT, BOUND_LOWER, BOUND_UPPER };
+
+// Simplified evaluation tables, rank 8 first as seen from the owner's side
+const EvalParams default_eval_params = {
+    {100, 320, 330, 500, 900, 0},
+    {
+        {  0,   0,   0,   0,   0,   0,   0,   0,
+          50,  50,  50,  50,  50,  50,  50,  50,
+          10,  10,  20,  30,  30,  20,  10,  10,
+           5,   5,  10,  25,  25,  10,   5,   5,
+           0,   0,   0,  20,  20,   0,   0,   0,
+           5,  -5, -10,   0,   0, -10,  -5,   5,
+           5,  10,  10, -20, -20,  10,  10,   5,
+           0,   0,   0,   0,   0,   0,   0,   0},
+        {-50, -40, -30, -30, -30, -30, -40, -50,
+         -40, -20,   0,   0,   0,   0, -20, -40,
+         -30,   0,  10,  15,  15,  10,   0, -30,
+         -30,   5,  15,  20,  20,  15,   5, -30,
+         -30,   0,  15,  20,  20,  15,   0, -30,
+         -30,   5,  10,  15,  15,  10,   5, -30,
+         -40, -20,   0,   5,   5,   0, -20, -40,
+         -50, -40, -30, -30, -30, -30, -40, -50},
+        {-20, -10, -10, -10, -10, -10, -10, -20,
+         -10,   0,   0,   0,   0,   0,   0, -10,
+         -10,   0,   5,  10,  10,   5,   0, -10,
+         -10,   5,   5,  10,  10,   5,   5, -10,
+         -10,   0,  10,  10,  10,  10,   0, -10,
+         -10,  10,  10,  10,  10,  10,  10, -10,
+         -10,   5,   0,   0,   0,   0,   5, -10,
+         -20, -10, -10, -10, -10, -10, -10, -20},
+        {  0,   0,   0,   0,   0,   0,   0,   0,
+           5,  10,  10,  10,  10,  10,  10,   5,
+          -5,   0,   0,   0,   0,   0,   0,  -5,
+          -5,   0,   0,   0,   0,   0,   0,  -5,
+          -5,   0,   0,   0,   0,   0,   0,  -5,
+          -5,   0,   0,   0,   0,   0,   0,  -5,
+          -5,   0,   0,   0,   0,   0,   0,  -5,
+           0,   0,   0,   5,   5,   0,   0,   0},
+        {-20, -10, -10,  -5,  -5, -10, -10, -20,
+         -10,   0,   0,   0,   0,   0,   0, -10,
+         -10,   0,   5,   5,   5,   5,   0, -10,
+          -5,   0,   5,   5,   5,   5,   0,  -5,
+           0,   0,   5,   5,   5,   5,   0,  -5,
+         -10,   5,   5,   5,   5,   5,   0, -10,
+         -10,   0,   5,   0,   0,   0,   0, -10,
+         -20, -10, -10,  -5,  -5, -10, -10, -20},
+        {-30, -40, -40, -50, -50, -40, -40, -30,
+         -30, -40, -40, -50, -50, -40, -40, -30,
+         -30, -40, -40, -50, -50, -40, -40, -30,
+         -30, -40, -40, -50, -50, -40, -40, -30,
+         -20, -30, -30, -40, -40, -30, -30, -20,
+         -10, -20, -20, -20, -20, -20, -20, -10,
+          20,  20,   0,   0,   0,   0,  20,  20,
+          20,  30,  10,   0,   0,  10,  30,  20},
+    },
+};
+
+static const char *piece_names[EVAL_PIECES] = {"pawn", "knight", "bishop", "rook", "queen", "king"};
+
+bool eval_params_load(const char *path, EvalParams &params)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+    const int count = EVAL_PIECES * 65;
+    int32_t values[count];
+    int read = 0;
+    int c;
+    while (read < count && (c = fgetc(file)) != EOF)
+    {
+        if (c == '#')
+        {
+            while ((c = fgetc(file)) != EOF && c != '\n')
+            {
+            }
+        }
+        else if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            ungetc(c, file);
+            long value;
+            if (fscanf(file, "%ld", &value) != 1)
+            {
+                break;
+            }
+            values[read++] = (int32_t)value;
+        }
+    }
+    fclose(file);
+    if (read != count)
+    {
+        return false;
+    }
+    for (int i = 0; i < EVAL_PIECES; i++)
+    {
+        params.material[i] = values[i];
+        for (int square = 0; square < 64; square++)
+            params.pst[i][square] = values[EVAL_PIECES + i * 64 + square];
+    }
+    return true;
+}
+
+bool eval_params_save(const char *path, const EvalParams &params)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        return false;
+    }
+    fprintf(file, "# material: pawn knight bishop rook queen king\n");
+    for (int i = 0; i < EVAL_PIECES; i++)
+        fprintf(file, "%d%c", params.material[i], i + 1 < EVAL_PIECES ? ' ' : '\n');
+    for (int i = 0; i < EVAL_PIECES; i++)
+    {
+        fprintf(file, "# %s, rank 8 first from the owner's side\n", piece_names[i]);
+        for (int square = 0; square < 64; square++)
+            fprintf(file, "%4d%c", params.pst[i][square], square % 8 == 7 ? '\n' : ' ');
+    }
+    return fclose(file) == 0;
+}
+
+int eval_piece(char type)
+{
+    switch (type)
+    {
+    case 'p': return EVAL_PAWN;
+    case 'k': return EVAL_KNIGHT;
+    case 'b': return EVAL_BISHOP;
+    case 'r': return EVAL_ROOK;
+    case 'q': return EVAL_QUEEN;
+    case 'K': return EVAL_KING;
+    default: return -1;
+    }
+}
+
+// Table index of (x, y) for a piece of `color`; x = 0 is the h file on this board
+static int table_square(int x, int y, char color)
+{
+    int row = (color == 'w') ? 7 - y : y;
+    return row * 8 + (7 - x);
+}
+
+int evaluate(const Chessboard &board, char turn, const EvalParams &params)
+{
+    int score = 0;
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 8; x++)
+        {
+            const Piece &piece = board[y][x];
+            int kind = eval_piece(piece.type);
+            if (kind < 0)
+            {
+                continue;
+            }
+            int value = params.material[kind] + params.pst[kind][table_square(x, y, piece.color)];
+            score += (piece.color == 'w') ? value : -value;
+        }
+    }
+    return (turn == 'w') ? score : -score;
+}
+
+bool search_table_create(SearchTable &table, size_t mb)
+{
+    size_t count = 1;
+    while (count * 2 * 2 * sizeof(uint64_t) <= mb * 1024 * 1024)
+    {
+        count *= 2;
+    }
+    table.entries = new (std::nothrow) std::atomic<uint64_t>[2 * count];
+    if (!table.entries)
+    {
+        return false;
+    }
+    table.mask = count - 1;
+    search_table_clear(table);
+    return true;
+}
+
+void search_table_clear(SearchTable &table)
+{
+    for (size_t i = 0; i < 2 * (table.mask + 1); i++)
+    {
+        table.entries[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void search_table_free(SearchTable &table)
+{
+    delete[] table.entries;
+    table.entries = NULL;
+    table.mask = 0;
+}
+
+// Mate scores are stored as distance from the node, not from the root
+static void table_store(SearchTable &table, uint64_t hash, int score, int depth, int bound, const int *move, int ply)
+{
+    if (score > MATE_FOUND)
+    {
+        score += ply;
+    }
+    else if (score < -MATE_FOUND)
+    {
+        score -= ply;
+    }
+    uint64_t data = (uint32_t)score | (uint64_t)depth << 32 | (uint64_t)bound << 40;
+    if (move)
+    {
+        data |= (uint64_t)(move[0] | move[1] << 3 | move[2] << 6 | move[3] << 9) << 42 | (uint64_t)1 << 54;
+    }
+    std::atomic<uint64_t> *entry = &table.entries[2 * (hash & table.mask)];
+    entry[0].store(hash ^ data, std::memory_order_relaxed);
+    entry[1].store(data, std::memory_order_relaxed);
+}
+
+static bool table_probe(const SearchTable &table, uint64_t hash, int ply, int &score, int &depth, int &bound,
+                        int move[4], bool &has_move)
+{
+    const std::atomic<uint64_t> *entry = &table.entries[2 * (hash & table.mask)];
+    uint64_t key = entry[0].load(std::memory_order_relaxed);
+    uint64_t data = entry[1].load(std::memory_order_relaxed);
+    if ((key ^ data) != hash || data == 0)
+    {
+        return false;
+    }
+    score = (int32_t)(uint32_t)data;
+    if (score > MATE_FOUND)
+    {
+        score -= ply;
+    }
+    else if (score < -MATE_FOUND)
+    {
+        score += ply;
+    }
+    depth = (int)(data >> 32 & 0xff);
+    bound = (int)(data >> 40 & 3);
+    int packed = (int)(data >> 42 & 0xfff);
+    for (int k = 0; k < 4; k++)
+        move[k] = packed >> (3 * k) & 7;
+    has_move = data >> 54 & 1;
+    return true;
+}
+
+int eval_features(const Chessboard &board, uint16_t features[64])
+{
+    int count = 0;
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 8; x++)
+        {
+            const Piece &piece = board[y][x];
+            int kind = eval_piece(piece.type);
+            if (kind >= 0)
+            {
+                features[count++] = (uint16_t)((piece.color == 'w' ? 0 : EVAL_BLACK_FEATURES) + kind * 64 +
+                                               table_square(x, y, piece.color));
+            }
+        }
+    }
+    return count;
+}
+
+struct SearchState {
+    const SearchLimits *limits;
+    const EvalParams *params;
+    uint64_t nodes;
+    int64_t deadline_ms; // 0 without a time limit
+    bool can_abort;      // Off while the first iteration runs
+    bool aborted;
+};
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Counts a node; true once a limit says to stop
+static bool visit(SearchState &state)
+{
+    state.nodes++;
+    if (!state.can_abort || state.aborted)
+    {
+        return state.aborted;
+    }
+    const SearchLimits &limits = *state.limits;
+    if (limits.nodes && state.nodes >= limits.nodes)
+    {
+        state.aborted = true;
+    }
+    else if (state.nodes % SEARCH_CHECK_NODES == 0)
+    {
+        state.aborted = (limits.stop && limits.stop->load(std::memory_order_relaxed)) ||
+                        (state.deadline_ms && now_ms() >= state.deadline_ms);
+    }
+    return state.aborted;
+}
+
+static void make_move(const Chessboard &board, const int move[4], Chessboard &child)
+{
+    child = board;
+    child[move[3]][move[2]] = board[move[1]][move[0]];
+    child[move[1]][move[0]] = Piece();
+}
+
+static bool in_check(const Chessboard &board, char turn)
+{
+    Chessboard copy = board;
+    int king_pos[2] = {0};
+    king_position(copy, turn, king_pos);
+    return check(copy, turn, king_pos);
+}
+
+// Captures first, most valuable victim by least valuable attacker; a known
+// best move goes before everything. Returns the number of captures.
+static int order_moves(const Chessboard &board, int moves[][4], int count, const int *first)
+{
+    int keys[MAX_LEGAL_MOVES];
+    int captures = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const int *move = moves[i];
+        int victim = eval_piece(board[move[3]][move[2]].type);
+        int attacker = eval_piece(board[move[1]][move[0]].type);
+        keys[i] = (victim >= 0) ? 1000 + 10 * default_eval_params.material[victim] -
+                                      default_eval_params.material[attacker] / 10
+                                : 0;
+        captures += (victim >= 0);
+        if (first && move[0] == first[0] && move[1] == first[1] && move[2] == first[2] && move[3] == first[3])
+        {
+            keys[i] = 1 << 30;
+        }
+    }
+    // Insertion sort, the lists are short
+    for (int i = 1; i < count; i++)
+    {
+        int key = keys[i];
+        int move[4] = {moves[i][0], moves[i][1], moves[i][2], moves[i][3]};
+        int j = i - 1;
+        for (; j >= 0 && keys[j] < key; j--)
+        {
+            keys[j + 1] = keys[j];
+            for (int k = 0; k < 4; k++)
+                moves[j + 1][k] = moves[j][k];
+        }
+        keys[j + 1] = key;
+        for (int k = 0; k < 4; k++)
+            moves[j + 1][k] = move[k];
+    }
+    return captures;
+}
+
+static int quiesce(SearchState &state, const Chessboard &board, char turn, int alpha, int beta, int ply, int left)
+{
+    if (visit(state))
+    {
+        return 0;
+    }
+    int stand = evaluate(board, turn, *state.params);
+    if (left == 0 || stand >= beta)
+    {
+        return stand;
+    }
+    if (stand > alpha)
+    {
+        alpha = stand;
+    }
+
+    int moves[MAX_LEGAL_MOVES][4];
+    int count = legal_moves(board, turn, moves, MAX_LEGAL_MOVES);
+    if (count == 0)
+    {
+        return in_check(board, turn) ? -(SEARCH_MATE - ply) : 0;
+    }
+    int captures = order_moves(board, moves, count, NULL);
+    char next = (turn == 'w') ? 'b' : 'w';
+    for (int i = 0; i < captures; i++)
+    {
+        Chessboard child;
+        make_move(board, moves[i], child);
+        int score = -quiesce(state, child, next, -beta, -alpha, ply + 1, left - 1);
+        if (state.aborted)
+        {
+            return 0;
+        }
+        if (score >= beta)
+        {
+            return score;
+        }
+        if (score > alpha)
+        {
+            alpha = score;
+        }
+    }
+    return alpha;
+}
+
+static int negamax(SearchState &state, const Chessboard &board, char turn, int depth, int alpha, int beta, int ply)
+{
+    if (depth <= 0)
+    {
+        return quiesce(state, board, turn, alpha, beta, ply, SEARCH_QUIESCENCE_DEPTH);
+    }
+    if (visit(state))
+    {
+        return 0;
+    }
+    SearchTable *table = state.limits->table;
+    uint64_t hash = 0;
+    int hint[4];
+    bool has_hint = false;
+    if (table)
+    {
+        hash = position_hash(board, turn);
+        int stored, stored_depth, bound;
+        if (table_probe(*table, hash, ply, stored, stored_depth, bound, hint, has_hint) && stored_depth >= depth &&
+            (bound == BOUND_EXACT || (bound == BOUND_LOWER && stored >= beta) ||
+             (bound == BOUND_UPPER && stored <= alpha)))
+        {
+            return stored;
+        }
+    }
+    int moves[MAX_LEGAL_MOVES][4];
+    int count = legal_moves(board, turn, moves, MAX_LEGAL_MOVES);
+    if (count == 0)
+    {
+        return in_check(board, turn) ? -(SEARCH_MATE - ply) : 0;
+    }
+    order_moves(board, moves, count, has_hint ? hint : NULL);
+
+    char next = (turn == 'w') ? 'b' : 'w';
+    int original_alpha = alpha;
+    int best = -SEARCH_INFINITY;
+    int best_index = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Chessboard child;
+        make_move(board, moves[i], child);
+        int score = -negamax(state, child, next, depth - 1, -beta, -alpha, ply + 1);
+        if (state.aborted)
+        {
+            return 0;
+        }
+        if (score > best)
+        {
+            best = score;
+            best_index = i;
+        }
+        if (score > alpha)
+        {
+            alpha = score;
+        }
+        if (alpha >= beta)
+        {
+            break;
+        }
+    }
+    if (table)
+    {
+        int bound = (best >= beta) ? BOUND_LOWER : (best <= original_alpha) ? BOUND_UPPER : BOUND_EXACT;
+        table_store(*table, hash, best, depth, bound, moves[best_index], ply);
+    }
+    return best;
+}
+
+void search(const Chessboard &board, char turn, const SearchLimits &limits, const EvalParams &params,
+            SearchResult &result)
+{
+    SearchState state = {&limits, &params, 0, 0, false, false};
+    if (limits.movetime_ms > 0)
+    {
+        state.deadline_ms = now_ms() + limits.movetime_ms;
+    }
+    result.has_move = false;
+    result.score = 0;
+    result.depth = 0;
+
+    int moves[MAX_LEGAL_MOVES][4];
+    int count = legal_moves(board, turn, moves, MAX_LEGAL_MOVES);
+    if (count == 0)
+    {
+        result.score = in_check(board, turn) ? -SEARCH_MATE : 0;
+        result.nodes = 1;
+        return;
+    }
+
+    char next = (turn == 'w') ? 'b' : 'w';
+    int max_depth = (limits.depth > 0 && limits.depth < SEARCH_MAX_DEPTH) ? limits.depth : SEARCH_MAX_DEPTH;
+    for (int depth = 1; depth <= max_depth; depth++)
+    {
+        order_moves(board, moves, count, result.has_move ? result.move : NULL);
+        int alpha = -SEARCH_INFINITY;
+        int best = 0;
+        for (int i = 0; i < count; i++)
+        {
+            Chessboard child;
+            make_move(board, moves[i], child);
+            int score = -negamax(state, child, next, depth - 1, -SEARCH_INFINITY, -alpha, 1);
+            if (state.aborted)
+            {
+                break;
+            }
+            if (score > alpha)
+            {
+                alpha = score;
+                best = i;
+            }
+        }
+        if (state.aborted)
+        {
+            break; // The unfinished iteration is discarded
+        }
+        for (int k = 0; k < 4; k++)
+            result.move[k] = moves[best][k];
+        result.has_move = true;
+        result.score = alpha;
+        result.depth = depth;
+        state.can_abort = true;
+
+        // A forced mate does not get any better with depth
+        if (alpha > MATE_FOUND || alpha < -MATE_FOUND)
+        {
+            break;
+        }
+    }
+    result.nodes = state.nodes;
+}
@@ -1,6 +1,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,27 +11,150 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/un.h>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <vector>
 
 #include <SFML/Network.hpp>
 #include "chessboard.h"
+#include "session.h"
+#include "protocol.h"
+#include "spectator.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+#include "timer_wheel.h"
+#include "move_log.h"
+#include "archive.h"
+#include "position_cache.h"
+#include "analysis.h"
+#include "multiplex.h"
+#include "shm_ring.h"
 
 // Mutex and condition variable for thread synchronization
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t condition_var = PTHREAD_COND_INITIALIZER;
 
-// Struct to store game session data
-typedef struct {
-    int clientSocketWhite;
-    int clientSocketBlack;
-} GameSession;
+#define DEFAULT_MAX_SESSIONS 4096 // Default bound on concurrent games
+#define DEFAULT_IDLE_SECONDS 600  // A move not made within this time ends the game
+#define TIMER_TICK_MS 10          // Resolution of the timer wheel
+#define DEFAULT_GRACE_SECONDS 30  // How long a dropped player's seat is kept
+#define HANDSHAKE_TIMEOUT_MS 2000 // An attach peer must send its whole request within this time
+#define MAX_HANDSHAKES 1024       // Attach peers still sending their request
 
-// Function prototype for the game session thread
+// Time control, 0 disables the limit
+static int64_t clockBaseMs = 0;
+static int64_t clockIncrementMs = 0;
+static int64_t idleTimeoutMs = (int64_t)DEFAULT_IDLE_SECONDS * 1000;
+// 0 ends the game as soon as a player disconnects
+static int64_t resumeGraceMs = (int64_t)DEFAULT_GRACE_SECONDS * 1000;
+
+// Guards resume secrets and pending sockets, shared with the attach thread
+static pthread_mutex_t resumeLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_attr_t sessionThreadAttr;
+
+// Unix socket listeners next to the TCP ports, -1 unless enabled with -u
+static int unixPlayerSocket = -1;
+static int unixAttachSocket = -1;
+static size_t recoveredGames = 0;
+
+// All session deadlines live on one wheel driven by a single timer thread
+static TimerWheel timerWheel;
+static pthread_mutex_t timerLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function prototypes for the game session thread
 void *gameSessionThread(void *arg);
+void *attachListenerThread(void *);
+void endSession(GameSession *session, DisconnectReason reason);
+void reportGauges(FILE *out);
+void *timerThread(void *arg);
+void *muxHubThread(void *arg);
+static void startRecovered(GameSession *session);
+static bool muxStart(const char *keyPath);
+static int listenUnix(const char *path);
+static int acceptAny(const int listeners[2]);
+static int64_t clockNowMs();
 
-int main(void) {
-    struct sockaddr_in serverAddr, clientAddr;
+int main(int argc, char *argv[]) {
+    struct sockaddr_in serverAddr;
     int serverSocket;
-    socklen_t addr_size;
+
+    trace_init(); // No-op unless built with CHESS_TRACE
+
+    // Parse command line options
+    size_t maxSessions = DEFAULT_MAX_SESSIONS;
+    LogLevel logLevel = LOG_LEVEL_INFO;
+    const char *moveLogPath = NULL;
+    const char *archivePath = NULL;
+    size_t positionCacheMb = POSITION_CACHE_MB;
+    int analysisWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *muxKeyPath = NULL;
+    const char *unixPath = NULL;
+    int opt_c;
+    while ((opt_c = getopt(argc, argv, "n:vt:i:I:g:w:a:c:j:k:u:")) != -1) {
+        switch (opt_c) {
+            case 'n': maxSessions = strtoul(optarg, NULL, 10); break;
+            case 'v': logLevel = LOG_LEVEL_DEBUG; break; // Also log every move
+            case 't': clockBaseMs = (int64_t)(atof(optarg) * 1000); break;
+            case 'i': clockIncrementMs = (int64_t)(atof(optarg) * 1000); break;
+            case 'I': idleTimeoutMs = (int64_t)(atof(optarg) * 1000); break;
+            case 'g': resumeGraceMs = (int64_t)(atof(optarg) * 1000); break;
+            case 'w': moveLogPath = optarg; break;
+            case 'a': archivePath = optarg; break;
+            case 'c': positionCacheMb = strtoul(optarg, NULL, 10); break; // 0 disables the cache
+            case 'j': analysisWorkers = atoi(optarg); break; // 0 turns the analysis service off
+            case 'k': muxKeyPath = optarg; break; // Bots with this key may multiplex games
+            case 'u': unixPath = optarg; break;   // Co-located players connect here
+            default:
+                fprintf(stderr, "Usage: %s [-n max_sessions] [-v] [-t clock_seconds] [-i increment_seconds] [-I idle_seconds] [-g grace_seconds] [-w move_log] [-a archive] [-c cache_mb] [-j analysis_workers] [-k mux_key_file] [-u unix_socket]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // Session threads log through per-thread rings drained by a writer thread
+    if (!log_start(logLevel, STDOUT_FILENO)) {
+        perror("Cannot start logger");
+        return 1;
+    }
+
+    // Reserve all session records up front so games never allocate
+    if (maxSessions == 0 || !session_pool_init(maxSessions)) {
+        fprintf(stderr, "Cannot allocate session pool for %zu games\n", maxSessions);
+        return 1;
+    }
+    log_info("Session pool: %zu games x %zu bytes (+%d KiB stack per game thread)",
+             maxSessions, sizeof(GameSession), SESSION_STACK_SIZE / 1024);
+
+    // Rules results of positions seen by any game, shared by all session threads
+    if (!position_cache_init(positionCacheMb << 20)) {
+        fprintf(stderr, "Cannot allocate %zu MB position cache\n", positionCacheMb);
+        return 1;
+    }
+    log_info("Position cache: %zu positions", position_cache_capacity());
+
+    // Clocks and idle timeouts of all games run on one timer thread
+    timer_wheel_init(timerWheel, clockNowMs() / TIMER_TICK_MS);
+    pthread_t timer_thread;
+    if (pthread_create(&timer_thread, NULL, timerThread, NULL) != 0) {
+        perror("Cannot start timer thread");
+        return 1;
+    }
+    pthread_detach(timer_thread);
+    if (clockBaseMs > 0) {
+        log_info("Time control: %.1f s + %.1f s per move.", clockBaseMs / 1000.0, clockIncrementMs / 1000.0);
+    }
+
+    // Session threads only need a small stack, the board lives in the pool
+    pthread_attr_init(&sessionThreadAttr);
+    pthread_attr_setstacksize(&sessionThreadAttr, SESSION_STACK_SIZE);
+    pthread_attr_setdetachstate(&sessionThreadAttr, PTHREAD_CREATE_DETACHED); // Automatically release resources after the thread finishes
 
     // Create a TCP socket
     serverSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -48,7 +173,7 @@ int main(void) {
     // Configure the server address and port
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(1101);
+    serverAddr.sin_port = htons(SERVER_PORT);
     serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
 
     // Bind the socket to the specified address and port
@@ -65,182 +190,1487 @@ int main(void) {
         exit(EXIT_FAILURE);
     }
 
-    printf("Server listening on port 1101...\n");
+    log_info("Server listening on port %d...", SERVER_PORT);
 
-    while (1) {
-        memset(&clientAddr, 0, sizeof(clientAddr));
-        addr_size = sizeof(clientAddr);
+    // Local players and engines skip the TCP stack
+    if (unixPath) {
+        // The logger formats later on its own thread, so the path must outlive this block
+        static char attachPath[4096];
+        snprintf(attachPath, sizeof(attachPath), "%s%s", unixPath, UNIX_ATTACH_SUFFIX);
+        unixPlayerSocket = listenUnix(unixPath);
+        unixAttachSocket = listenUnix(attachPath);
+        if (unixPlayerSocket < 0 || unixAttachSocket < 0) {
+            perror("Cannot listen on Unix socket");
+            close(serverSocket);
+            exit(EXIT_FAILURE);
+        }
+        log_info("Server listening on %s and %s.", unixPath, attachPath);
+    }
+
+    // Recovered games publish their frames to the spectator hub
+    if (!spectator_hub_start()) {
+        perror("Cannot start spectator service");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    // Finished games are kept in a compressed archive
+    if (archivePath) {
+        if (!archive_open(archivePath)) {
+            perror("Cannot open game archive");
+            close(serverSocket);
+            exit(EXIT_FAILURE);
+        }
+        log_info("Archiving finished games to %s.", archivePath);
+    }
+
+    // Games that were running when the server stopped continue where they were
+    if (moveLogPath) {
+        int64_t started = clockNowMs();
+        if (!move_log_open(moveLogPath, (int32_t)clockBaseMs, startRecovered)) {
+            perror("Cannot open move log");
+            close(serverSocket);
+            exit(EXIT_FAILURE);
+        }
+        log_info("Move log %s: recovered %zu games in %lld ms.", moveLogPath, recoveredGames,
+                 (long long)(clockNowMs() - started));
+    }
+
+    // Spectators attach on a separate port and are served by their own thread.
+    // Mux hellos there take session slots, so it starts after recovery.
+    pthread_t attach_thread;
+    if (pthread_create(&attach_thread, NULL, attachListenerThread, NULL) != 0) {
+        perror("Cannot start spectator service");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(attach_thread);
+
+    // Position analysis runs on its own workers, away from the game threads
+    if (analysisWorkers > 0) {
+        if (!analysis_start(analysisWorkers)) {
+            perror("Cannot start analysis service");
+            close(serverSocket);
+            exit(EXIT_FAILURE);
+        }
+        log_info("Analysis service: %d workers.", analysisWorkers);
+    }
+
+    // Bot farms play many games over one connection, all served by one thread
+    if (muxKeyPath) {
+        if (!muxStart(muxKeyPath)) {
+            perror("Cannot start multiplexed connections");
+            close(serverSocket);
+            exit(EXIT_FAILURE);
+        }
+        log_info("Multiplexed connections enabled.");
+    }
 
+    // Plain-text stats for local scrapers
+    if (!metrics_serve(STATS_PORT, reportGauges)) {
+        perror("Cannot start stats endpoint");
+    } else {
+        log_info("Stats available on 127.0.0.1:%d.", STATS_PORT);
+    }
+
+    int playerListeners[2] = {serverSocket, unixPlayerSocket};
+    while (1) {
         // Accept connection from the first player (White)
-        int clientSocketWhite = accept(serverSocket, (struct sockaddr *)&clientAddr, &addr_size);
+        int clientSocketWhite = acceptAny(playerListeners);
         if (clientSocketWhite < 0) {
             perror("Accept failed");
             continue;
         }
-        printf("Client connected as White.\n");
+        metrics_add(METRIC_ACCEPTS);
+        log_info("Client connected as White.");
 
-        memset(&clientAddr, 0, sizeof(clientAddr));
         // Accept connection from the second player (Black)
-        int clientSocketBlack = accept(serverSocket, (struct sockaddr *)&clientAddr, &addr_size);
+        int clientSocketBlack = acceptAny(playerListeners);
         if (clientSocketBlack < 0) {
             perror("Accept failed");
             close(clientSocketWhite);
             continue;
         }
-        printf("Client connected as Black.\n");
+        metrics_add(METRIC_ACCEPTS);
+        log_info("Client connected as Black.");
 
-        // Allocate memory for the game session
-        GameSession *session = (GameSession *)malloc(sizeof(GameSession));
+        // Frames are small and latency bound, don't let Nagle hold them back
+        int noDelay = 1;
+        setsockopt(clientSocketWhite, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        setsockopt(clientSocketBlack, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        // Take a record for the game session from the pool
+        GameSession *session = session_acquire(clientSocketWhite, clientSocketBlack);
         if (!session) {
-            perror("Memory allocation failed");
+            log_warn("Session limit reached, rejecting players.");
+            metrics_add(METRIC_SESSIONS_REJECTED);
+            char endMsg = 'e';
+            send(clientSocketWhite, &endMsg, sizeof(endMsg), MSG_NOSIGNAL);
+            send(clientSocketBlack, &endMsg, sizeof(endMsg), MSG_NOSIGNAL);
             close(clientSocketWhite);
             close(clientSocketBlack);
             continue;
         }
 
-        session->clientSocketWhite = clientSocketWhite;
-        session->clientSocketBlack = clientSocketBlack;
-
         // Create a new thread to handle the game session
         pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, gameSessionThread, session) != 0) {
-            printf("Failed to create game session thread\n");
-            free(session);
+        if (pthread_create(&thread_id, &sessionThreadAttr, gameSessionThread, session) != 0) {
+            log_error("Failed to create game session thread");
+            session_release(session);
             close(clientSocketWhite);
             close(clientSocketBlack);
         }
-        pthread_detach(thread_id); // Automatically release resources after the thread finishes
     }
 
     // Close the server socket when done
+    pthread_attr_destroy(&sessionThreadAttr);
     close(serverSocket);
     return EXIT_SUCCESS;
 }
 
+// Binds a Unix stream socket at `path`, replacing a stale one left by an earlier run
+static int listenUnix(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listener, 64) == -1) {
+        if (listener >= 0) {
+            close(listener);
+        }
+        return -1;
+    }
+    return listener;
+}
+
+// Accepts the next connection on the TCP listener or its Unix counterpart (-1 if disabled)
+static int acceptAny(const int listeners[2]) {
+    if (listeners[1] < 0) {
+        return accept(listeners[0], NULL, NULL);
+    }
+    struct pollfd fds[2] = {{listeners[0], POLLIN, 0}, {listeners[1], POLLIN, 0}};
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return accept((fds[0].revents & POLLIN) ? listeners[0] : listeners[1], NULL, NULL);
+}
+
+// Called by move_log_open for every game found running in the log
+static void startRecovered(GameSession *session) {
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &sessionThreadAttr, gameSessionThread, session) != 0) {
+        log_error("Game %u: cannot restart recovered game", session->id);
+        session_release(session);
+        return;
+    }
+    recoveredGames++;
+}
+
+// Monotonic time in milliseconds, used for game clocks
+static int64_t clockNowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Advances the wheel every tick; expired deadlines wake their session thread
+void *timerThread(void *arg) {
+    (void)arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (1) {
+        next.tv_nsec += TIMER_TICK_MS * 1000000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        pthread_mutex_lock(&timerLock);
+        timer_wheel_advance(timerWheel, clockNowMs() / TIMER_TICK_MS);
+        pthread_mutex_unlock(&timerLock);
+
+        // Finished games don't wait in memory for a full block for long
+        if (next.tv_nsec < TIMER_TICK_MS * 1000000) {
+            archive_tick(); // About once a second
+        }
+    }
+    return NULL;
+}
+
+// Runs on the timer thread with timerLock held
+static void deadlineExpired(Timer *timer) {
+    GameSession *session = (GameSession *)timer->data;
+    uint64_t one = 1;
+    if (write(session->wake_fd, &one, sizeof(one)) < 0) {
+        log_error("Game %u: timer wakeup failed %d", session->id, errno);
+    }
+}
+
+// Arms the session's timer for whichever comes first: the mover's flag, the idle
+// timeout or the end of a dropped player's grace period
+static void armDeadline(GameSession *session) {
+    GameClock &clock = session->clock;
+    int64_t deadline = INT64_MAX;
+    if (idleTimeoutMs > 0) {
+        deadline = clock.turn_started_ms + idleTimeoutMs;
+    }
+    if (clockBaseMs > 0) {
+        int64_t flag = clock.turn_started_ms + clock.remaining_ms[session->turn == 'w' ? 0 : 1];
+        deadline = (flag < deadline) ? flag : deadline;
+    }
+    for (int side = 0; side < 2; side++) {
+        if (session->disconnected_ms[side] > 0) {
+            int64_t grace = session->disconnected_ms[side] + resumeGraceMs;
+            deadline = (grace < deadline) ? grace : deadline;
+        }
+    }
+
+    pthread_mutex_lock(&timerLock);
+    if (deadline == INT64_MAX) {
+        timer_cancel(&session->deadline);
+    } else {
+        // Round up so the timer never fires before the deadline
+        timer_add(timerWheel, &session->deadline, (deadline + TIMER_TICK_MS - 1) / TIMER_TICK_MS);
+    }
+    pthread_mutex_unlock(&timerLock);
+}
+
+// Send a status byte followed by the board and the legal moves to one peer with a single syscall
+static bool sendFrame(int socket, char status, const int data[128], const LegalMoves &legal) {
+    TRACE_SCOPE("send");
+    if (socket < 0) {
+        return false; // Player is away, it gets a snapshot when it reattaches
+    }
+    struct iovec iov[3] = {{&status, 1}, {(void *)data, BOARD_DATA_SIZE}, {(void *)&legal, LEGAL_DATA_SIZE}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    if (sent > 0) {
+        metrics_add(METRIC_BYTES_OUT, sent);
+    }
+    return sent == (ssize_t)FRAME_SIZE;
+}
+
+// First message to a player: its side, the initial position and its resume token
+static bool sendHello(int socket, char side, const int data[128], const LegalMoves &legal, uint64_t token) {
+    struct iovec iov[4] = {{&side, 1}, {(void *)data, BOARD_DATA_SIZE}, {(void *)&legal, LEGAL_DATA_SIZE},
+                           {&token, RESUME_TOKEN_SIZE}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 4;
+    ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    if (sent > 0) {
+        metrics_add(METRIC_BYTES_OUT, sent);
+    }
+    return sent == (ssize_t)HELLO_SIZE;
+}
+
+// Snapshot for a reattached player: side, both clocks and the current frame in one message
+static bool sendResume(GameSession *session, int socket, char side, const int data[128]) {
+    char header[2] = {REQUEST_RESUME, side};
+    int32_t clocks[2] = {0, 0};
+    if (clockBaseMs > 0) {
+        int64_t spent = clockNowMs() - session->clock.turn_started_ms;
+        int mover = session->turn == 'w' ? 0 : 1;
+        for (int i = 0; i < 2; i++) {
+            int64_t remaining = session->clock.remaining_ms[i] - (i == mover ? spent : 0);
+            clocks[i] = (int32_t)(remaining > 0 ? remaining : 0);
+        }
+    }
+    char status = session->turn;
+    struct iovec iov[5] = {{header, sizeof(header)}, {clocks, sizeof(clocks)}, {&status, 1},
+                           {(void *)data, BOARD_DATA_SIZE}, {(void *)&session->legal, LEGAL_DATA_SIZE}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 5;
+    ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    if (sent > 0) {
+        metrics_add(METRIC_BYTES_OUT, sent);
+    }
+    return sent == (ssize_t)RESUME_REPLY_SIZE;
+}
+
+// Serialize the board once and send it to both players and all spectators
+static void broadcastBoard(GameSession *session, char status, int data[128]) {
+    TRACE_SCOPE("broadcast");
+    serializeChessboard(session->board, data);
+    sendFrame(session->clientSocketWhite, status, data, session->legal);
+    sendFrame(session->clientSocketBlack, status, data, session->legal);
+    spectator_publish(session->id, status, data, session->legal);
+}
+
+// Reads one message from a player; false when the connection closed
+static bool receiveMove(int socket, int msg[4]) {
+    TRACE_SCOPE("recv");
+    memset(msg, 0, 4 * sizeof(int));
+    int n = recv(socket, msg, 4 * sizeof(int), 0);
+    if (n > 0) {
+        metrics_add(METRIC_BYTES_IN, n);
+    }
+    return n > 0;
+}
+
+// Tell the remaining player the game is over
+static void notifyEnd(int socket) {
+    if (socket < 0) {
+        return;
+    }
+    char endMsg = 'e';
+    send(socket, &endMsg, sizeof(endMsg), MSG_NOSIGNAL);
+    metrics_add(METRIC_BYTES_OUT, sizeof(endMsg));
+}
+
+// Random non-zero half of a resume token
+static uint32_t newResumeSecret() {
+    uint32_t secret = 0;
+    while (secret == 0) {
+        if (getrandom(&secret, sizeof(secret), 0) != sizeof(secret)) {
+            secret = (uint32_t)rand();
+        }
+    }
+    return secret;
+}
+
+// A player's connection closed: keep its seat for the grace period
+static void playerDropped(GameSession *session, struct pollfd fds[3], int side) {
+    int &socket = side == 0 ? session->clientSocketWhite : session->clientSocketBlack;
+    close(socket);
+    socket = -1;
+    fds[side].fd = -1; // poll skips negative descriptors
+    fds[side].revents = 0;
+    session->disconnected_ms[side] = clockNowMs();
+    armDeadline(session);
+}
+
+// Takes the connections deposited by the attach thread and sends each a snapshot
+static void adoptReattached(GameSession *session, struct pollfd fds[3], const int data[128]) {
+    int fresh[2];
+    pthread_mutex_lock(&resumeLock);
+    for (int side = 0; side < 2; side++) {
+        fresh[side] = session->pending_socket[side];
+        session->pending_socket[side] = -1;
+    }
+    pthread_mutex_unlock(&resumeLock);
+
+    for (int side = 0; side < 2; side++) {
+        if (fresh[side] < 0) {
+            continue;
+        }
+        // A player can reattach before its old connection is seen closing
+        int &socket = side == 0 ? session->clientSocketWhite : session->clientSocketBlack;
+        if (socket >= 0) {
+            close(socket);
+        }
+        socket = fresh[side];
+        fds[side].fd = socket;
+        fds[side].revents = 0;
+        session->disconnected_ms[side] = 0;
+
+        int noDelay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        struct timeval noTimeout = {0, 0}; // Undo the attach port's receive timeout
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &noTimeout, sizeof(noTimeout));
+        if (!sendResume(session, socket, side == 0 ? 'w' : 'b', data)) {
+            playerDropped(session, fds, side);
+            continue;
+        }
+        metrics_add(METRIC_SESSIONS_RESUMED);
+        log_info("Game %u: %s reattached.", session->id, side == 0 ? "White" : "Black");
+    }
+    armDeadline(session);
+}
+
+// Publishes the current position when a first spectator waits for it
+static void publishSnapshot(GameSession *session, const int data[128]) {
+    pthread_mutex_lock(&resumeLock);
+    bool wanted = session->snapshot_wanted;
+    session->snapshot_wanted = false;
+    pthread_mutex_unlock(&resumeLock);
+    if (wanted) {
+        spectator_publish(session->id, session->turn, data, session->legal);
+    }
+}
+
+// Validates and plays the mover's move, clock and rules included. Returns the
+// status of the next frame: the side to move, 'c' or 's' when the game is
+// decided, 't' when the flag fell before the move arrived; 0 for a rejected move
+// and 'e' when the move could not be made durable.
+static char playMove(GameSession *session, int msg[4]) {
+    TRACE_SCOPE("move");
+    Chessboard &board = session->board;
+    char &turn = session->turn;
+    log_debug("Game %u: move received: %d %d %d %d", session->id, msg[0], msg[1], msg[2], msg[3]);
+    metrics_add(METRIC_MOVES_RECEIVED);
+
+    // Moves outside the set sent to the client are rejected with a bit test,
+    // can_move only runs to apply a legal one. A move that arrives after the
+    // flag fell does not count and leaves the board as it was.
+    int64_t now = clockNowMs();
+    uint64_t started = metrics_now_ns();
+    SessionMoveResult result = legal_move_allowed(session->legal, msg)
+                                   ? session_play_move(session, msg, now, clockBaseMs > 0)
+                                   : SESSION_MOVE_ILLEGAL;
+    metrics_time(TIMER_CAN_MOVE, started);
+    if (result == SESSION_MOVE_ILLEGAL) {
+        metrics_add(METRIC_MOVES_REJECTED);
+        return 0;
+    }
+    if (result == SESSION_MOVE_LATE) {
+        log_info("Game %u: player %c lost on time!", session->id, turn);
+        memset(&session->legal, 0, sizeof(session->legal));
+        return 't';
+    }
+    metrics_add(METRIC_MOVES_VALIDATED);
+    // Logged before the turn passes, synced while the position is checked
+    uint64_t logged = 0;
+    if (!session->multiplexed) {
+        logged = move_log_move(session, pack_move(msg), session->clock.remaining_ms[turn == 'w' ? 0 : 1]);
+    }
+    turn = (turn == 'w') ? 'b' : 'w';
+    session->clock.turn_started_ms = now;
+    armDeadline(session);
+
+    // Check for checkmate or stalemate, positions other games reached come from the cache
+    started = metrics_now_ns();
+    char outcome = position_cache_evaluate(board, turn, session->legal);
+    metrics_time(TIMER_GAME_DECIDER, started);
+    // Players only see moves that survive a crash
+    if (!move_log_wait(logged)) {
+        log_error("Game %u: move log failed, ending the game", session->id);
+        return 'e';
+    }
+    if (outcome == 'c') {
+        log_info("Game %u: player %c is in checkmate!", session->id, turn);
+        return 'c';
+    }
+    if (outcome == 's') {
+        log_info("Game %u: player %c is in stalemate!", session->id, turn);
+        return 's';
+    }
+    return turn;
+}
+
+static DisconnectReason decidedReason(char status) {
+    return status == 'c' ? DISCONNECT_CHECKMATE : status == 's' ? DISCONNECT_STALEMATE : DISCONNECT_TIME_FORFEIT;
+}
+
 void *gameSessionThread(void *arg) {
-    // Initialize the chessboard
-    Chessboard board = initializeBoard();
+    // The chessboard and turn live in the pooled session record
     GameSession *session = (GameSession *)arg;
-    int clientSocketWhite = session->clientSocketWhite;
-    int clientSocketBlack = session->clientSocketBlack;
-    free(session);
+    Chessboard &board = session->board;
+    char &turn = session->turn; // White's turn starts
+    int &clientSocketWhite = session->clientSocketWhite; // -1 while the player is away
+    int &clientSocketBlack = session->clientSocketBlack;
 
-    char turn = 'w'; // White's turn starts
-
-    // Notify clients of their roles
-    char whiteMsg = 'w', blackMsg = 'b';
-    if (send(clientSocketWhite, &whiteMsg, sizeof(char), 0) <= 0 ||
-        send(clientSocketBlack, &blackMsg, sizeof(char), 0) <= 0) {
-        printf("Failed to send initial messages to clients.\n");
-        close(clientSocketWhite);
-        close(clientSocketBlack);
-        pthread_exit(NULL);
+    // The timer thread signals this eventfd when the clock or idle deadline passes.
+    // A player of a recovered game may have reattached before it existed: the
+    // first poll then adopts the waiting connection.
+    int wakeFd = eventfd(0, EFD_NONBLOCK);
+    pthread_mutex_lock(&resumeLock);
+    session->wake_fd = wakeFd;
+    if (wakeFd >= 0 && (session->pending_socket[0] >= 0 || session->pending_socket[1] >= 0)) {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) {
+            log_error("Game %u: resume wakeup failed %d", session->id, errno);
+        }
     }
+    pthread_mutex_unlock(&resumeLock);
+    if (session->wake_fd < 0) {
+        log_error("Game %u: cannot create timer eventfd %d", session->id, errno);
+        notifyEnd(clientSocketWhite);
+        notifyEnd(clientSocketBlack);
+        endSession(session, DISCONNECT_ERROR);
+    }
+    session->deadline.callback = deadlineExpired;
+    session->deadline.data = session;
 
-    // Send the initial chessboard state to both clients
     int data[128];
     memset(data, 0, sizeof(data));
     serializeChessboard(board, data);
-    send(clientSocketWhite, data, 128 * sizeof(int), 0);
-    send(clientSocketBlack, data, 128 * sizeof(int), 0);
+    position_cache_evaluate(board, turn, session->legal);
+    session->clock.increment_ms = (int32_t)clockIncrementMs;
+
+    if (clientSocketWhite < 0 && clientSocketBlack < 0) {
+        // Recovered from the move log: both players have the grace period to reattach
+        session->disconnected_ms[0] = session->disconnected_ms[1] = clockNowMs();
+        log_info("Game %u recovered after %d moves, waiting for the players.", session->id, session->ply);
+    } else {
+        // Each player proves its seat with a token when it reattaches
+        pthread_mutex_lock(&resumeLock);
+        session->resume_secret[0] = newResumeSecret();
+        session->resume_secret[1] = newResumeSecret();
+        pthread_mutex_unlock(&resumeLock);
+        uint64_t tokenWhite = ((uint64_t)session->resume_secret[0] << 32) | session->id;
+        uint64_t tokenBlack = ((uint64_t)session->resume_secret[1] << 32) | session->id;
+        session->clock.remaining_ms[0] = session->clock.remaining_ms[1] = (int32_t)clockBaseMs;
+
+        // The game is on disk before its tokens are handed out
+        if (!move_log_wait(move_log_start(session))) {
+            log_error("Game %u: move log failed, not starting the game", session->id);
+            notifyEnd(clientSocketWhite);
+            notifyEnd(clientSocketBlack);
+            endSession(session, DISCONNECT_ERROR);
+        }
+
+        // Notify clients of their roles together with the initial chessboard state
+        if (!sendHello(clientSocketWhite, 'w', data, session->legal, tokenWhite) ||
+            !sendHello(clientSocketBlack, 'b', data, session->legal, tokenBlack)) {
+            log_warn("Game %u: failed to send initial messages to clients.", session->id);
+            endSession(session, DISCONNECT_ERROR);
+        }
+        metrics_add(METRIC_SESSIONS_STARTED);
+        log_info("Game %u started.", session->id);
+    }
+    pthread_mutex_lock(&resumeLock);
+    session->watchable = true;
+    pthread_mutex_unlock(&resumeLock);
+
+    // The mover's clock starts now
+    session->clock.turn_started_ms = clockNowMs();
+    armDeadline(session);
 
     int msg[4];
-    fd_set read_fds;
-    int max_fd = (clientSocketWhite > clientSocketBlack) ? clientSocketWhite : clientSocketBlack;
+    struct pollfd fds[3] = {
+        {clientSocketWhite, POLLIN, 0},
+        {clientSocketBlack, POLLIN, 0},
+        {session->wake_fd, POLLIN, 0},
+    };
+    DisconnectReason reason = DISCONNECT_PEER_CLOSED;
 
     while (1) {
-        FD_ZERO(&read_fds);
-        FD_SET(clientSocketWhite, &read_fds);
-        FD_SET(clientSocketBlack, &read_fds);
-
-        // Monitor both sockets for incoming data
-        int activity = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+        // Monitor both sockets and the deadline for activity
+        int activity = poll(fds, 3, -1);
         if (activity < 0) {
-            perror("Select error");
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Game %u: poll error %d", session->id, errno);
+            reason = DISCONNECT_ERROR;
             break;
         }
 
+        // A player reattached, a spectator asked for the board or a deadline passed: the
+        // mover either lost on time, left the game idle or a dropped player did not come back in time
+        if (fds[2].revents & POLLIN) {
+            uint64_t count;
+            if (read(session->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                log_error("Game %u: wakeup read failed %d", session->id, errno);
+            }
+            adoptReattached(session, fds, data);
+            publishSnapshot(session, data);
+            int64_t now = clockNowMs();
+            for (int side = 0; side < 2; side++) {
+                if (session->disconnected_ms[side] > 0 && now - session->disconnected_ms[side] >= resumeGraceMs) {
+                    log_info("Game %u: %s did not come back! Ending session.", session->id, side == 0 ? "White" : "Black");
+                    notifyEnd(side == 0 ? clientSocketBlack : clientSocketWhite);
+                    endSession(session, DISCONNECT_PEER_CLOSED);
+                }
+            }
+            int64_t spent = now - session->clock.turn_started_ms;
+            if (clockBaseMs > 0 && spent >= session->clock.remaining_ms[turn == 'w' ? 0 : 1]) {
+                log_info("Game %u: player %c lost on time!", session->id, turn);
+                session->clock.remaining_ms[turn == 'w' ? 0 : 1] = 0;
+                memset(&session->legal, 0, sizeof(session->legal));
+                broadcastBoard(session, 't', data);
+                endSession(session, DISCONNECT_TIME_FORFEIT);
+            }
+            if (idleTimeoutMs > 0 && spent >= idleTimeoutMs) {
+                log_info("Game %u: no move for %.1f s, ending session.", session->id, spent / 1000.0);
+                notifyEnd(clientSocketWhite);
+                notifyEnd(clientSocketBlack);
+                endSession(session, DISCONNECT_IDLE);
+            }
+            armDeadline(session); // Woken early, wait for the rest
+        }
+
         // Handle disconnections or data from White
-        if (FD_ISSET(clientSocketWhite, &read_fds)) {
-            memset(msg, 0, sizeof(msg));
-            int n = recv(clientSocketWhite, &msg, sizeof(msg), 0);
-            if (n <= 0) {
-                printf("White client disconnected! Ending session.\n");
-                turn = 'e';
-                send(clientSocketBlack, &turn, sizeof(turn), 0); // Notify Black
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (!receiveMove(clientSocketWhite, msg)) {
+                if (resumeGraceMs > 0) {
+                    log_info("Game %u: White client disconnected, holding the seat.", session->id);
+                    playerDropped(session, fds, 0);
+                } else {
+                    log_info("Game %u: White client disconnected! Ending session.", session->id);
+                    notifyEnd(clientSocketBlack);
+                    break;
+                }
+            } else if (msg[0] == -1) {
+                // Leaving on purpose ends the game at once, on either player's turn
+                log_info("Game %u: White left! Ending session.", session->id);
+                notifyEnd(clientSocketBlack);
+                reason = DISCONNECT_RESIGNED;
                 break;
             }
         }
 
         // Handle disconnections or data from Black
-        if (FD_ISSET(clientSocketBlack, &read_fds)) {
-            memset(msg, 0, sizeof(msg));
-            int n = recv(clientSocketBlack, &msg, sizeof(msg), 0);
-            if (n <= 0) {
-                printf("Black client disconnected! Ending session.\n");
-                turn = 'e';
-                send(clientSocketWhite, &turn, sizeof(turn), 0); // Notify White
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (!receiveMove(clientSocketBlack, msg)) {
+                if (resumeGraceMs > 0) {
+                    log_info("Game %u: Black client disconnected, holding the seat.", session->id);
+                    playerDropped(session, fds, 1);
+                } else {
+                    log_info("Game %u: Black client disconnected! Ending session.", session->id);
+                    notifyEnd(clientSocketWhite);
+                    break;
+                }
+            } else if (msg[0] == -1) {
+                log_info("Game %u: Black left! Ending session.", session->id);
+                notifyEnd(clientSocketWhite);
+                reason = DISCONNECT_RESIGNED;
                 break;
             }
         }
 
         // Process the move if it is the correct player's turn
-        int currentSocket = (turn == 'w') ? clientSocketWhite : clientSocketBlack;
-        if (FD_ISSET(currentSocket, &read_fds)) {
-            printf("Move received: %d %d %d %d\n", msg[0], msg[1], msg[2], msg[3]);
-
-            if (msg[0] == -1) {
-                printf("Client disconnected! Ending session.\n");
-                turn = 'e';
-                send((turn == 'w') ? clientSocketBlack : clientSocketWhite, &turn, sizeof(turn), 0);
+        const struct pollfd &current = fds[(turn == 'w') ? 0 : 1];
+        if (current.revents & POLLIN) {
+            char status = playMove(session, msg);
+            if (status == 'e') {
+                notifyEnd(clientSocketWhite);
+                notifyEnd(clientSocketBlack);
+                endSession(session, DISCONNECT_ERROR);
+            } else if (status == 'c' || status == 's' || status == 't') {
+                broadcastBoard(session, status, data);
+                endSession(session, decidedReason(status));
+            } else if (status) {
+                // Notify both players and the spectators about the move
+                broadcastBoard(session, status, data);
+            }
+        }
+    }
+
+    // Clean up resources when the session ends
+    endSession(session, reason);
+    return NULL;
+}
+
+// Close both players' sockets and return the record to the pool
+static void finishSession(GameSession *session, DisconnectReason reason) {
+    if (!session->multiplexed) {
+        move_log_end(session); // Not waited for, at worst the game is recovered and times out
+    }
+    // Invalidate the tokens so the attach thread stops handing over connections
+    // and spectators
+    pthread_mutex_lock(&resumeLock);
+    session->resume_secret[0] = session->resume_secret[1] = 0;
+    session->watchable = false;
+    for (int side = 0; side < 2; side++) {
+        if (session->pending_socket[side] >= 0) {
+            notifyEnd(session->pending_socket[side]);
+            close(session->pending_socket[side]);
+            session->pending_socket[side] = -1;
+        }
+    }
+    pthread_mutex_unlock(&resumeLock);
+    // Once cancelled under the lock the timer thread no longer touches the session
+    pthread_mutex_lock(&timerLock);
+    timer_cancel(&session->deadline);
+    pthread_mutex_unlock(&timerLock);
+    if (session->wake_fd >= 0) {
+        close(session->wake_fd);
+    }
+    metrics_disconnect(reason);
+    spectator_close_game(session->id);
+    if (session->clientSocketWhite >= 0) {
+        close(session->clientSocketWhite);
+    }
+    if (session->clientSocketBlack >= 0) {
+        close(session->clientSocketBlack);
+    }
+    log_info("Game %u ended after %d moves.", session->id, session->ply);
+    if (session->ply > 0) {
+        uint64_t number = archive_append(session, (uint8_t)reason);
+        if (number != UINT64_MAX) {
+            log_debug("Game %u archived as game %llu.", session->id, (unsigned long long)number);
+        }
+    }
+    session_release(session);
+}
+
+// Ends the game of a session thread and stops the thread
+void endSession(GameSession *session, DisconnectReason reason) {
+    finishSession(session, reason);
+    pthread_exit(NULL);
+}
+
+// Multiplexed bot connections. One hub thread reads them all and plays
+// their games itself, see multiplex.h.
+
+struct MuxWaiting {
+    uint64_t connection;
+    uint32_t tag;
+};
+
+struct MuxGame {
+    GameSession *session;
+    uint64_t connection[2]; // Holding White's and Black's seat
+    bool queued[2];         // The seat has a frame in its connection's queue
+};
+
+struct MuxSeat {
+    uint32_t game;
+    int side;
+};
+
+struct MuxConnection {
+    int socket;
+    std::vector<uint8_t> in;    // Bytes of an incomplete request
+    std::vector<uint8_t> out;   // Not yet sent
+    std::vector<MuxSeat> queue; // Seats whose frame is written once `out` drains
+    size_t seats;               // Waiting and playing
+    bool done;
+    ShmEndpoint shm;            // Rings of a shared-memory connection, area NULL on a plain socket
+    size_t poll_index;          // Entry of the socket in the hub's poll set, 0 until polled
+};
+
+struct MuxNew {
+    int socket;
+    ShmEndpoint shm;
+};
+
+static uint8_t muxKey[MUX_KEY_SIZE];
+static int muxWakeFd = -1;
+static pthread_mutex_t muxLock = PTHREAD_MUTEX_INITIALIZER; // Guards the three lists below
+static std::vector<MuxNew> muxNewConnections;
+static std::vector<uint32_t> muxExpired; // Games whose deadline passed
+static std::vector<uint32_t> muxSnapshots; // Games a first spectator waits on
+static std::atomic<size_t> muxConnectionCount(0);
+static std::atomic<size_t> muxGameCount(0);
+
+// Hub thread only
+static std::unordered_map<uint64_t, MuxConnection> muxConnections;
+static std::unordered_map<uint32_t, MuxGame> muxGames;
+static std::deque<MuxWaiting> muxWaiting;
+static uint64_t muxNextConnection = 1;
+
+static void muxWake() {
+    uint64_t one = 1;
+    if (write(muxWakeFd, &one, sizeof(one)) < 0) {
+        log_error("Multiplex wakeup failed %d", errno);
+    }
+}
+
+// Runs on the timer thread with timerLock held
+static void muxDeadlineExpired(Timer *timer) {
+    GameSession *session = (GameSession *)timer->data;
+    pthread_mutex_lock(&muxLock);
+    muxExpired.push_back(session->id);
+    pthread_mutex_unlock(&muxLock);
+    muxWake();
+}
+
+// A connection still being served, NULL once it closed
+static MuxConnection *muxConnection(uint64_t id) {
+    auto it = muxConnections.find(id);
+    return (it == muxConnections.end() || it->second.done) ? NULL : &it->second;
+}
+
+static void muxAppend(MuxConnection &connection, char type, char side, uint32_t game, uint32_t tag) {
+    MuxHeader header = {type, side, 0, game, tag};
+    const uint8_t *bytes = (const uint8_t *)&header;
+    connection.out.insert(connection.out.end(), bytes, bytes + sizeof(header));
+}
+
+static void muxAppendFrame(MuxConnection &connection, char type, int side, GameSession *session, char status,
+                           const int data[128], uint32_t tag) {
+    muxAppend(connection, type, side == 0 ? 'w' : 'b', session->id, tag);
+    connection.out.push_back((uint8_t)status);
+    const uint8_t *board = (const uint8_t *)data;
+    connection.out.insert(connection.out.end(), board, board + BOARD_DATA_SIZE);
+    const uint8_t *legal = (const uint8_t *)&session->legal;
+    connection.out.insert(connection.out.end(), legal, legal + LEGAL_DATA_SIZE);
+}
+
+// Queues a frame of the current position for both seats. A seat whose
+// connection has not taken the previous one yet gets the newer position instead.
+static void muxQueueFrames(uint32_t id, MuxGame &game) {
+    for (int side = 0; side < 2; side++) {
+        if (game.queued[side]) {
+            metrics_add(METRIC_MUX_FRAMES_REPLACED);
+            continue;
+        }
+        MuxConnection *connection = muxConnection(game.connection[side]);
+        if (connection) {
+            connection->queue.push_back({id, side});
+            game.queued[side] = true;
+        }
+    }
+}
+
+// Ends a game. Both seats get `status` as the final frame, or MUX_END when it is 0.
+static void muxEndGame(uint32_t id, DisconnectReason reason, char status, const int data[128]) {
+    auto it = muxGames.find(id);
+    MuxGame game = it->second;
+    muxGames.erase(it);
+    muxGameCount--;
+    for (int side = 0; side < 2; side++) {
+        MuxConnection *connection = muxConnection(game.connection[side]);
+        if (!connection) {
+            continue;
+        }
+        connection->seats--;
+        if (status) {
+            muxAppendFrame(*connection, MUX_FRAME, side, game.session, status, data, 0);
+        } else {
+            muxAppend(*connection, MUX_END, side == 0 ? 'w' : 'b', id, 0);
+        }
+    }
+    finishSession(game.session, reason);
+}
+
+static void muxStartGame(const MuxWaiting &white, const MuxWaiting &black) {
+    const MuxWaiting *seat[2] = {&white, &black};
+    MuxConnection *connection[2] = {muxConnection(white.connection), muxConnection(black.connection)};
+    GameSession *session = session_acquire(-1, -1);
+    if (!session) {
+        log_warn("Session limit reached, rejecting multiplexed players.");
+        metrics_add(METRIC_SESSIONS_REJECTED);
+        for (int side = 0; side < 2; side++) {
+            connection[side]->seats--;
+            muxAppend(*connection[side], MUX_END, 0, 0, seat[side]->tag);
+        }
+        return;
+    }
+    session->multiplexed = true;
+    session->deadline.callback = muxDeadlineExpired;
+    session->deadline.data = session;
+    session->clock.increment_ms = (int32_t)clockIncrementMs;
+    session->clock.remaining_ms[0] = session->clock.remaining_ms[1] = (int32_t)clockBaseMs;
+
+    int data[128];
+    serializeChessboard(session->board, data);
+    position_cache_evaluate(session->board, session->turn, session->legal);
+    pthread_mutex_lock(&resumeLock);
+    session->watchable = true;
+    pthread_mutex_unlock(&resumeLock);
+    muxGames[session->id] = {session, {white.connection, black.connection}, {false, false}};
+    muxGameCount++;
+    for (int side = 0; side < 2; side++) {
+        muxAppendFrame(*connection[side], MUX_GAME, side, session, session->turn, data, seat[side]->tag);
+    }
+    metrics_add(METRIC_SESSIONS_STARTED);
+    log_info("Game %u started.", session->id);
+
+    session->clock.turn_started_ms = clockNowMs();
+    armDeadline(session);
+}
+
+// Seats are paired in the order they ask, the earlier one plays White
+static void muxJoin(uint64_t id, MuxConnection &connection, uint32_t tag) {
+    if (connection.seats >= MUX_MAX_SEATS) {
+        muxAppend(connection, MUX_END, 0, 0, tag);
+        return;
+    }
+    connection.seats++;
+    // Seats of connections that closed while waiting are dropped here
+    while (!muxWaiting.empty() && !muxConnection(muxWaiting.front().connection)) {
+        muxWaiting.pop_front();
+    }
+    if (muxWaiting.empty()) {
+        muxWaiting.push_back({id, tag});
+        return;
+    }
+    MuxWaiting white = muxWaiting.front();
+    muxWaiting.pop_front();
+    muxStartGame(white, {id, tag});
+}
+
+// Side of the game held by the connection, the mover first when it holds both; -1 if none
+static int muxSide(const MuxGame &game, uint64_t connection) {
+    int mover = game.session->turn == 'w' ? 0 : 1;
+    if (game.connection[mover] == connection) {
+        return mover;
+    }
+    return game.connection[1 - mover] == connection ? 1 - mover : -1;
+}
+
+static void muxRequest(uint64_t id, MuxConnection &connection, const MuxRequest &request) {
+    if (request.type == MUX_JOIN) {
+        muxJoin(id, connection, request.game);
+        return;
+    }
+    auto it = muxGames.find(request.game);
+    if (it == muxGames.end()) {
+        return; // The game ended while the request was on its way
+    }
+    MuxGame &game = it->second;
+    GameSession *session = game.session;
+    int side = muxSide(game, id);
+    if (side < 0) {
+        return;
+    }
+    int data[128];
+    if (request.type == MUX_LEAVE) {
+        log_info("Game %u: %s left! Ending session.", session->id, side == 0 ? "White" : "Black");
+        muxEndGame(request.game, DISCONNECT_RESIGNED, 0, data);
+        return;
+    }
+    if (side != (session->turn == 'w' ? 0 : 1)) {
+        return; // Only the mover's moves are read
+    }
+
+    int msg[4] = {request.move[0], request.move[1], request.move[2], request.move[3]};
+    char status = playMove(session, msg);
+    if (status == 'e') {
+        muxEndGame(request.game, DISCONNECT_ERROR, 0, data);
+    } else if (status == 'c' || status == 's' || status == 't') {
+        broadcastBoard(session, status, data);
+        muxEndGame(request.game, decidedReason(status), status, data);
+    } else if (status) {
+        broadcastBoard(session, status, data); // Only the spectators, the seats have no socket
+        muxQueueFrames(request.game, game);
+    }
+}
+
+// A deadline passed: the mover lost on time or left the game idle
+static void muxDeadline(uint32_t id) {
+    auto it = muxGames.find(id);
+    if (it == muxGames.end()) {
+        return; // Ended after the timer fired
+    }
+    GameSession *session = it->second.session;
+    int mover = session->turn == 'w' ? 0 : 1;
+    int64_t spent = clockNowMs() - session->clock.turn_started_ms;
+    int data[128];
+    if (clockBaseMs > 0 && spent >= session->clock.remaining_ms[mover]) {
+        log_info("Game %u: player %c lost on time!", session->id, session->turn);
+        session->clock.remaining_ms[mover] = 0;
+        memset(&session->legal, 0, sizeof(session->legal));
+        broadcastBoard(session, 't', data);
+        muxEndGame(id, DISCONNECT_TIME_FORFEIT, 't', data);
+    } else if (idleTimeoutMs > 0 && spent >= idleTimeoutMs) {
+        log_info("Game %u: no move for %.1f s, ending session.", session->id, spent / 1000.0);
+        muxEndGame(id, DISCONNECT_IDLE, 0, data);
+    } else {
+        armDeadline(session); // Woken early, wait for the rest
+    }
+}
+
+// Reads what arrived and handles every complete request
+static void muxRead(uint64_t id, MuxConnection &connection) {
+    uint8_t buffer[16 * 1024];
+    ssize_t n;
+    if (connection.shm.area) {
+        n = (ssize_t)shm_read(connection.shm, buffer, sizeof(buffer));
+    } else {
+        n = recv(connection.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            connection.done = true;
+            return;
+        }
+    }
+    if (n <= 0) {
+        return;
+    }
+    metrics_add(METRIC_BYTES_IN, n);
+    connection.in.insert(connection.in.end(), buffer, buffer + n);
+
+    size_t offset = 0;
+    for (; connection.in.size() - offset >= sizeof(MuxRequest) && !connection.done; offset += sizeof(MuxRequest)) {
+        MuxRequest request;
+        memcpy(&request, connection.in.data() + offset, sizeof(request));
+        if (request.type != MUX_JOIN && request.type != MUX_MOVE && request.type != MUX_LEAVE) {
+            connection.done = true; // Not speaking the protocol
+            break;
+        }
+        muxRequest(id, connection, request);
+    }
+    connection.in.erase(connection.in.begin(), connection.in.begin() + offset);
+}
+
+// Turns queued seats into frames while little is unsent, then writes what the socket takes
+static void muxFlush(MuxConnection &connection) {
+    size_t next = 0;
+    int data[128];
+    for (; next < connection.queue.size() && connection.out.size() < MUX_OUTPUT_BATCH; next++) {
+        const MuxSeat &seat = connection.queue[next];
+        auto it = muxGames.find(seat.game);
+        if (it == muxGames.end()) {
+            continue; // Ended, the final message is already in `out`
+        }
+        MuxGame &game = it->second;
+        game.queued[seat.side] = false;
+        serializeChessboard(game.session->board, data);
+        muxAppendFrame(connection, MUX_FRAME, seat.side, game.session, game.session->turn, data, 0);
+    }
+    connection.queue.erase(connection.queue.begin(), connection.queue.begin() + next);
+
+    while (!connection.out.empty()) {
+        ssize_t n;
+        if (connection.shm.area) {
+            n = (ssize_t)shm_write(connection.shm, connection.out.data(), connection.out.size());
+            if (n == 0) {
+                break; // Ring full, the client wakes the hub when it makes room
+            }
+        } else {
+            n = send(connection.socket, connection.out.data(), connection.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    connection.done = true;
+                }
                 break;
             }
+        }
+        metrics_add(METRIC_BYTES_OUT, n);
+        connection.out.erase(connection.out.begin(), connection.out.begin() + n);
+    }
+    if (connection.out.size() > MUX_MAX_OUTPUT) {
+        connection.done = true;
+    }
+}
+
+// Ends every game the closed connection had a seat in
+static void muxClose(uint64_t id, MuxConnection &connection) {
+    std::vector<uint32_t> orphaned;
+    for (const auto &entry : muxGames) {
+        if (entry.second.connection[0] == id || entry.second.connection[1] == id) {
+            orphaned.push_back(entry.first);
+        }
+    }
+    int data[128];
+    for (uint32_t game : orphaned) {
+        log_info("Game %u: multiplexed connection closed! Ending session.", game);
+        muxEndGame(game, DISCONNECT_PEER_CLOSED, 0, data);
+    }
+    if (connection.shm.area) {
+        shm_close(connection.shm);
+    }
+    close(connection.socket);
+}
+
+void *muxHubThread(void *arg) {
+    (void)arg;
+    std::vector<struct pollfd> fds;
+    std::vector<MuxNew> fresh;
+    std::vector<uint32_t> expired;
+    std::vector<uint32_t> snapshots;
+    while (1) {
+        pthread_mutex_lock(&muxLock);
+        fresh.swap(muxNewConnections);
+        expired.swap(muxExpired);
+        snapshots.swap(muxSnapshots);
+        pthread_mutex_unlock(&muxLock);
+
+        for (const MuxNew &added : fresh) {
+            muxConnections[muxNextConnection++] = {added.socket, {}, {}, {}, 0, false, added.shm, 0};
+            muxConnectionCount++;
+        }
+        fresh.clear();
+        for (uint32_t id : expired) {
+            muxDeadline(id);
+        }
+        expired.clear();
+        for (uint32_t id : snapshots) {
+            auto it = muxGames.find(id);
+            if (it != muxGames.end()) {
+                int data[128];
+                serializeChessboard(it->second.session->board, data);
+                spectator_publish(id, it->second.session->turn, data, it->second.session->legal);
+            }
+        }
+        snapshots.clear();
+
+        for (auto &entry : muxConnections) {
+            MuxConnection &connection = entry.second;
+            if (connection.done || connection.poll_index == 0) {
+                continue;
+            }
+            short revents = fds[connection.poll_index].revents;
+            if (connection.shm.area) {
+                // Nothing more comes over the socket of a shared-memory connection but
+                // its end, and the rings are looked at every round
+                if (revents) {
+                    connection.done = true;
+                } else if (connection.out.size() < MUX_OUTPUT_BATCH) {
+                    muxRead(entry.first, connection);
+                }
+            } else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                muxRead(entry.first, connection);
+            }
+        }
+
+        // Every connection gets all frames of this round in one send
+        for (auto it = muxConnections.begin(); it != muxConnections.end();) {
+            MuxConnection &connection = it->second;
+            if (!connection.done) {
+                muxFlush(connection);
+            }
+            if (!connection.done) {
+                ++it;
+                continue;
+            }
+            muxClose(it->first, connection);
+            it = muxConnections.erase(it);
+            muxConnectionCount--;
+        }
 
-            // Validate and process the move
-            if (can_move(board, msg, turn)) {
-                
-                turn = (turn == 'w') ? 'b' : 'w';
-                // Check for checkmate or stalemate
-                char outcome = gameDecider(board, turn);
-                if (outcome == 'c') {
-                    printf("Player %c is in checkmate!\n", turn);
-                    serializeChessboard(board, data);
-                    send(clientSocketWhite, &outcome, sizeof(outcome), 0);
-                    send(clientSocketBlack, &outcome, sizeof(outcome), 0);
-                    send(clientSocketWhite, data, 128 * sizeof(int), 0);
-                    send(clientSocketBlack, data, 128 * sizeof(int), 0);
-                    close(clientSocketWhite);
-                    close(clientSocketBlack);
-                    printf("Game session ended.\n");
-                    pthread_exit(NULL);
-                } 
-                else if (outcome == 's') {
-                    printf("Player %c is in stalemate!\n", turn);
-                    serializeChessboard(board, data);
-                    send(clientSocketWhite, &outcome, sizeof(outcome), 0);
-                    send(clientSocketBlack, &outcome, sizeof(outcome), 0);
-                    send(clientSocketWhite, data, 128 * sizeof(int), 0);
-                    send(clientSocketBlack, data, 128 * sizeof(int), 0);
-                    close(clientSocketWhite);
-                    close(clientSocketBlack);
-                    printf("Game session ended.\n");
-                    pthread_exit(NULL);
+        fds.clear();
+        fds.push_back({muxWakeFd, POLLIN, 0});
+        int timeout = -1;
+        for (auto &entry : muxConnections) {
+            MuxConnection &connection = entry.second;
+            // A connection that does not read its frames is not read from either
+            bool reading = connection.out.size() < MUX_OUTPUT_BATCH;
+            connection.poll_index = fds.size();
+            if (connection.shm.area) {
+                fds.push_back({connection.socket, POLLIN, 0});
+                uint32_t what = (reading ? SHM_WAIT_DATA : 0) | (connection.out.empty() ? 0 : SHM_WAIT_SPACE);
+                if (!shm_prepare_wait(connection.shm, what)) {
+                    timeout = 0; // Already something to do
                 }
+                fds.push_back({shm_wait_fd(connection.shm), POLLIN, 0});
+                continue;
+            }
+            short events = reading ? POLLIN : 0;
+            if (!connection.out.empty()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({connection.socket, events, 0});
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            log_error("Multiplex poll error %d", errno);
+        }
+        for (auto &entry : muxConnections) {
+            if (entry.second.shm.area) {
+                shm_end_wait(entry.second.shm);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(muxWakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                log_error("Multiplex wakeup read failed %d", errno);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Loads the key bot connections present and starts the hub
+static bool muxStart(const char *keyPath) {
+    FILE *file = fopen(keyPath, "r");
+    if (!file) {
+        return false;
+    }
+    size_t length = fread(muxKey, 1, MUX_KEY_SIZE, file);
+    fclose(file);
+    while (length > 0 && (muxKey[length - 1] == '\n' || muxKey[length - 1] == '\r')) {
+        muxKey[--length] = 0;
+    }
+    if (length == 0) {
+        errno = EINVAL;
+        return false;
+    }
+    muxWakeFd = eventfd(0, EFD_NONBLOCK);
+    pthread_t thread_id;
+    if (muxWakeFd < 0 || pthread_create(&thread_id, NULL, muxHubThread, NULL) != 0) {
+        return false;
+    }
+    pthread_detach(thread_id);
+    return true;
+}
+
+// Checks the key of a bot connection and hands it to the hub. A shared-memory
+// connection gets its rings with the answer.
+static bool muxAdopt(int socket, const uint8_t key[MUX_KEY_SIZE], bool shared) {
+    if (muxWakeFd < 0) {
+        return false;
+    }
+    uint8_t difference = 0; // Compared in constant time
+    for (int i = 0; i < MUX_KEY_SIZE; i++) {
+        difference |= key[i] ^ muxKey[i];
+    }
+    if (difference != 0) {
+        return false;
+    }
+    MuxNew added = {socket, {NULL, 0, {-1, -1, -1}, 0}};
+    if (shared) {
+        // SCM_RIGHTS only passes over the Unix attach socket
+        if (!shm_create(added.shm)) {
+            log_error("Cannot create shared-memory rings %d", errno);
+            return false;
+        }
+        if (!shm_send_fds(socket, MUX_ACCEPTED, added.shm.fds)) {
+            shm_close(added.shm);
+            return false;
+        }
+    } else {
+        char accepted = MUX_ACCEPTED;
+        if (send(socket, &accepted, sizeof(accepted), MSG_NOSIGNAL) != sizeof(accepted)) {
+            return false;
+        }
+        int noDelay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    metrics_add(METRIC_MUX_CONNECTIONS);
+    pthread_mutex_lock(&muxLock);
+    muxNewConnections.push_back(added);
+    pthread_mutex_unlock(&muxLock);
+    muxWake();
+    return true;
+}
+
+// Hands a reattached player's connection to its session thread.
+// False if the token does not match a running game.
+static bool resumeSession(int socket, uint64_t token) {
+    uint32_t gameId = (uint32_t)token;
+    uint32_t secret = (uint32_t)(token >> 32);
+    GameSession *session = session_find(gameId);
+    if (!session || secret == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&resumeLock);
+    int side = -1;
+    if (session->id == gameId) {
+        side = (secret == session->resume_secret[0]) ? 0 : (secret == session->resume_secret[1]) ? 1 : -1;
+    }
+    if (side >= 0) {
+        // The latest attempt wins, an earlier one still waiting is dropped
+        if (session->pending_socket[side] >= 0) {
+            close(session->pending_socket[side]);
+        }
+        session->pending_socket[side] = socket;
+        // Before its game thread made the eventfd, the thread finds the socket itself
+        uint64_t one = 1;
+        if (session->wake_fd >= 0 && write(session->wake_fd, &one, sizeof(one)) < 0) {
+            log_error("Game %u: resume wakeup failed %d", gameId, errno);
+        }
+    }
+    pthread_mutex_unlock(&resumeLock);
+    return side >= 0;
+}
+
+// Subscribes a spectator to a running game. The first one asks the game to
+// publish its position, which nothing does for unwatched games.
+static bool watchGame(int socket, uint32_t gameId) {
+    GameSession *session = session_find(gameId);
+    if (!session) {
+        return false;
+    }
+
+    pthread_mutex_lock(&resumeLock);
+    bool snapshot = false;
+    bool watching = session->id == gameId && session->watchable && spectator_watch(socket, gameId, snapshot);
+    bool multiplexed = session->multiplexed;
+    if (snapshot && !multiplexed) {
+        session->snapshot_wanted = true;
+        uint64_t one = 1;
+        if (session->wake_fd >= 0 && write(session->wake_fd, &one, sizeof(one)) < 0) {
+            log_error("Game %u: spectator wakeup failed %d", gameId, errno);
+        }
+    }
+    pthread_mutex_unlock(&resumeLock);
+
+    if (snapshot && multiplexed) {
+        pthread_mutex_lock(&muxLock);
+        muxSnapshots.push_back(gameId);
+        pthread_mutex_unlock(&muxLock);
+        muxWake();
+    }
+    return watching;
+}
 
-                // Notify the other player about the move
+// An attach peer whose request has not fully arrived yet
+struct Handshake {
+    int socket;
+    int64_t deadline_ms;
+    size_t received;
+    uint8_t data[1 + MUX_KEY_SIZE]; // Request byte and what follows it
+};
 
-                serializeChessboard(board, data);
-                send(clientSocketWhite, &turn, sizeof(turn), 0);
-                send(clientSocketBlack, &turn, sizeof(turn), 0);
-                send(clientSocketWhite, data, 128 * sizeof(int), 0);
-                send(clientSocketBlack, data, 128 * sizeof(int), 0);
+// Bytes a request needs, request byte included; 0 for an unknown request
+static size_t handshakeSize(uint8_t request) {
+    switch (request) {
+        case REQUEST_RESUME: return 1 + sizeof(uint64_t);
+        case REQUEST_MULTIPLEX:
+        case REQUEST_MULTIPLEX_SHM: return 1 + MUX_KEY_SIZE;
+        case REQUEST_ANALYSIS: return 1;
+        case REQUEST_SPECTATE: return 1 + sizeof(uint32_t);
+        default: return 0;
+    }
+}
+
+// Hands a peer whose request is complete to the service it asked for
+static void dispatchAttach(int peerSocket, const uint8_t *data) {
+    char endMsg = 'e';
+    if (data[0] == REQUEST_RESUME) {
+        uint64_t token;
+        memcpy(&token, data + 1, sizeof(token));
+        if (!resumeSession(peerSocket, token)) {
+            send(peerSocket, &endMsg, sizeof(endMsg), MSG_NOSIGNAL);
+            close(peerSocket);
+        }
+        return;
+    }
+
+    if (data[0] == REQUEST_MULTIPLEX || data[0] == REQUEST_MULTIPLEX_SHM) {
+        if (!muxAdopt(peerSocket, data + 1, data[0] == REQUEST_MULTIPLEX_SHM)) {
+            send(peerSocket, &endMsg, sizeof(endMsg), MSG_NOSIGNAL);
+            close(peerSocket);
+        } else {
+            log_info("Multiplexed connection accepted.");
+        }
+        return;
+    }
+
+    if (data[0] == REQUEST_ANALYSIS) {
+        if (!analysis_serve(peerSocket)) {
+            send(peerSocket, &endMsg, sizeof(endMsg), MSG_NOSIGNAL);
+            close(peerSocket);
+        }
+        return;
+    }
+
+    uint32_t gameId;
+    memcpy(&gameId, data + 1, sizeof(gameId));
+    if (!watchGame(peerSocket, gameId)) {
+        send(peerSocket, &endMsg, sizeof(endMsg), MSG_NOSIGNAL);
+        close(peerSocket);
+        return;
+    }
+    metrics_add(METRIC_SPECTATORS_JOINED);
+    log_info("Spectator joined game %u.", gameId);
+}
+
+// Reads what a handshake peer sent so far. True once the request is
+// complete or the peer failed; `failed` tells which.
+static bool readHandshake(Handshake &handshake, bool &failed) {
+    failed = false;
+    while (1) {
+        size_t size = handshake.received > 0 ? handshakeSize(handshake.data[0]) : 1;
+        if (size == 0) {
+            failed = true;
+            return true;
+        }
+        if (handshake.received == size) {
+            return true;
+        }
+        ssize_t n = recv(handshake.socket, handshake.data + handshake.received, size - handshake.received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        if (n <= 0) {
+            failed = true;
+            return true;
+        }
+        handshake.received += n;
+    }
+}
+
+// Accept peers on the attach port; spectators go to the fan-out thread,
+// reattaching players to their session thread. Requests are collected on
+// non-blocking sockets, so a silent peer only holds up itself.
+void *attachListenerThread(void *) {
+    struct sockaddr_in attachAddr;
+    int attachSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (attachSocket == -1) {
+        perror("Attach socket creation failed");
+        return NULL;
+    }
+    int opt = 1;
+    setsockopt(attachSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    memset(&attachAddr, 0, sizeof(attachAddr));
+    attachAddr.sin_family = AF_INET;
+    attachAddr.sin_port = htons(ATTACH_PORT);
+    attachAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(attachSocket, (struct sockaddr *)&attachAddr, sizeof(attachAddr)) == -1 ||
+        listen(attachSocket, 64) == -1) {
+        perror("Attach port setup failed");
+        close(attachSocket);
+        return NULL;
+    }
+    log_info("Spectators can attach on port %d.", ATTACH_PORT);
+
+    std::vector<Handshake> handshakes;
+    std::vector<struct pollfd> fds;
+    while (1) {
+        // Listeners first, then one entry per handshake
+        int64_t now = clockNowMs();
+        int timeout = -1;
+        fds.clear();
+        fds.push_back({attachSocket, POLLIN, 0});
+        fds.push_back({unixAttachSocket, POLLIN, 0}); // Ignored while -1
+        for (const Handshake &handshake : handshakes) {
+            fds.push_back({handshake.socket, POLLIN, 0});
+            int left = (int)(handshake.deadline_ms > now ? handshake.deadline_ms - now : 0);
+            timeout = (timeout < 0 || left < timeout) ? left : timeout;
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno != EINTR) {
+                perror("Attach poll failed");
             }
+            continue;
+        }
+
+        // Finished, failed and expired handshakes leave the list
+        now = clockNowMs();
+        size_t kept = 0;
+        for (size_t i = 0; i < handshakes.size(); i++) {
+            Handshake &handshake = handshakes[i];
+            bool failed = false;
+            bool done = (fds[i + 2].revents != 0) && readHandshake(handshake, failed);
+            if (!done && now >= handshake.deadline_ms) {
+                done = failed = true;
+            }
+            if (!done) {
+                handshakes[kept++] = handshake;
+            } else if (failed) {
+                close(handshake.socket);
+            } else {
+                // Services expect a blocking socket, as before the handshake
+                fcntl(handshake.socket, F_SETFL, fcntl(handshake.socket, F_GETFL) & ~O_NONBLOCK);
+                dispatchAttach(handshake.socket, handshake.data);
+            }
+        }
+        handshakes.resize(kept);
+
+        for (int listener = 0; listener < 2; listener++) {
+            if (!(fds[listener].revents & POLLIN)) {
+                continue;
+            }
+            int peerSocket = accept4(fds[listener].fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (peerSocket < 0) {
+                perror("Attach accept failed");
+                continue;
+            }
+            if (handshakes.size() >= MAX_HANDSHAKES) {
+                close(peerSocket);
+                continue;
+            }
+
+            // Reads by the services keep a bound once the socket blocks again
+            struct timeval recvTimeout = {HANDSHAKE_TIMEOUT_MS / 1000, 0};
+            setsockopt(peerSocket, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
+            Handshake handshake = {peerSocket, now + HANDSHAKE_TIMEOUT_MS, 0, {0}};
+            handshakes.push_back(handshake);
         }
     }
+    return NULL;
+}
 
-    // Clean up resources when the session ends
-    close(clientSocketWhite);
-    close(clientSocketBlack);
-    printf("Game session ended.\n");
-    pthread_exit(NULL);
+// Gauges reported by the stats endpoint next to the counters
+void reportGauges(FILE *out) {
+    fprintf(out, "sessions_active %zu\n", session_pool_in_use());
+    fprintf(out, "sessions_capacity %zu\n", session_pool_capacity());
+    fprintf(out, "session_record_bytes %zu\n", sizeof(GameSession));
+    fprintf(out, "analysis_queued %zu\n", analysis_queue_length());
+    fprintf(out, "mux_connections_active %zu\n", muxConnectionCount.load());
+    fprintf(out, "mux_games_active %zu\n", muxGameCount.load());
 }
@@ -0,0 +1,202 @@
+#include "session.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// The pool is a single array of records with an index-linked free list.
+// It is allocated once, so acquiring and releasing sessions never allocates.
+static GameSession *pool = NULL;
+static size_t pool_capacity = 0;
+static uint32_t slot_mask = 0; // Low bits of an id, the slot index; the generation sits above them
+static size_t pool_in_use = 0;
+static int free_head = -1;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define SLOT_RESTORED -2 // next_free of a slot claimed by session_restore
+
+bool session_pool_init(size_t capacity)
+{
+    // calloc hands out lazily mapped pages, so untouched slots cost no RSS
+    free(pool);
+    pool = (GameSession *)calloc(capacity, sizeof(GameSession));
+    if (!pool)
+    {
+        return false;
+    }
+    pool_capacity = capacity;
+    int slot_bits = 0;
+    while (slot_bits < 31 && ((size_t)1 << slot_bits) < capacity)
+    {
+        slot_bits++;
+    }
+    slot_mask = (1u << slot_bits) - 1;
+
+    // Chain all slots into the free list, lowest index first
+    for (size_t i = 0; i < capacity; i++)
+    {
+        pool[i].id = (uint32_t)i;
+        pool[i].next_free = (i + 1 < capacity) ? (int)(i + 1) : -1;
+    }
+    free_head = capacity > 0 ? 0 : -1;
+    return true;
+}
+
+// Resets a record for a new game
+static void session_reset(GameSession *session, int clientSocketWhite, int clientSocketBlack)
+{
+    session->clientSocketWhite = clientSocketWhite;
+    session->clientSocketBlack = clientSocketBlack;
+    session->turn = 'w';
+    session->ply = 0;
+    session->board = initializeBoard();
+    memset(&session->clock, 0, sizeof(session->clock));
+    memset(&session->deadline, 0, sizeof(session->deadline));
+    session->wake_fd = -1;
+    memset(session->resume_secret, 0, sizeof(session->resume_secret));
+    memset(session->disconnected_ms, 0, sizeof(session->disconnected_ms));
+    session->pending_socket[0] = session->pending_socket[1] = -1;
+    session->multiplexed = false;
+    session->watchable = false;
+    session->snapshot_wanted = false;
+}
+
+GameSession *session_acquire(int clientSocketWhite, int clientSocketBlack)
+{
+    pthread_mutex_lock(&pool_lock);
+    if (free_head < 0)
+    {
+        pthread_mutex_unlock(&pool_lock);
+        return NULL; // Pool exhausted
+    }
+    GameSession *session = &pool[free_head];
+    free_head = session->next_free;
+    pool_in_use++;
+    // Bump the generation so a reused slot doesn't repeat a recent id; the
+    // slot bits survive the wrap
+    session->id += slot_mask + 1;
+    pthread_mutex_unlock(&pool_lock);
+
+    session->next_free = -1;
+    session_reset(session, clientSocketWhite, clientSocketBlack);
+    return session;
+}
+
+GameSession *session_restore(uint32_t id)
+{
+    if ((id & slot_mask) >= pool_capacity)
+    {
+        return NULL; // The slot is past the end of this pool
+    }
+    GameSession *session = &pool[id & slot_mask];
+    if (session->next_free == SLOT_RESTORED && session->id != id)
+    {
+        return NULL; // The pool shrank since the game started
+    }
+    session->id = id;
+    session->next_free = SLOT_RESTORED;
+    session_reset(session, -1, -1);
+    return session;
+}
+
+void session_pool_relink()
+{
+    pthread_mutex_lock(&pool_lock);
+    free_head = -1;
+    pool_in_use = 0;
+    // Walk backwards so the lowest free index ends up at the head
+    for (size_t i = pool_capacity; i-- > 0;)
+    {
+        if (pool[i].next_free == SLOT_RESTORED)
+        {
+            pool[i].next_free = -1;
+            pool_in_use++;
+        }
+        else
+        {
+            pool[i].next_free = free_head;
+            free_head = (int)i;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void session_release(GameSession *session)
+{
+    pthread_mutex_lock(&pool_lock);
+    session->next_free = free_head;
+    free_head = (int)(session - pool);
+    pool_in_use--;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+GameSession *session_find(uint32_t id)
+{
+    // session_acquire changes ids under the lock
+    pthread_mutex_lock(&pool_lock);
+    GameSession *session = NULL;
+    if ((id & slot_mask) < pool_capacity && pool[id & slot_mask].id == id)
+    {
+        session = &pool[id & slot_mask];
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return session;
+}
+
+size_t session_pool_capacity()
+{
+    return pool_capacity;
+}
+
+size_t session_pool_in_use()
+{
+    pthread_mutex_lock(&pool_lock);
+    size_t in_use = pool_in_use;
+    pthread_mutex_unlock(&pool_lock);
+    return in_use;
+}
+
+void session_record_move(GameSession *session, const int move[4])
+{
+    if (session->ply < MAX_PLIES)
+    {
+        session->moves[session->ply++] = pack_move(move);
+    }
+}
+
+SessionMoveResult session_play_move(GameSession *session, int move[4], int64_t now_ms, bool timed)
+{
+    int32_t &remaining = session->clock.remaining_ms[session->turn == 'w' ? 0 : 1];
+    int64_t spent = now_ms - session->clock.turn_started_ms;
+    if (timed && spent >= remaining)
+    {
+        remaining = 0;
+        return SESSION_MOVE_LATE;
+    }
+    if (!can_move(session->board, move, session->turn))
+    {
+        return SESSION_MOVE_ILLEGAL;
+    }
+    session_record_move(session, move);
+    if (timed)
+    {
+        remaining = (int32_t)(remaining - spent + session->clock.increment_ms);
+    }
+    return SESSION_MOVE_PLAYED;
+}
+
+uint16_t pack_move(const int move[4])
+{
+    int from = move[1] * 8 + move[0];
+    int to = move[3] * 8 + move[2];
+    return (uint16_t)((from << 6) | to);
+}
+
+void unpack_move(uint16_t packed, int move[4])
+{
+    int from = (packed >> 6) & 63;
+    int to = packed & 63;
+    move[0] = from % 8;
+    move[1] = from / 8;
+    move[2] = to % 8;
+    move[3] = to / 8;
+}
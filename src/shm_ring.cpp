@@ -0,0 +1,207 @@
+#include "shm_ring.h"
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
+
+// Ring the endpoint writes to and the one it reads from
+static ShmRing &tx_ring(ShmEndpoint &endpoint)
+{
+    return endpoint.area->rings[endpoint.side == 0 ? 1 : 0];
+}
+
+static ShmRing &rx_ring(ShmEndpoint &endpoint)
+{
+    return endpoint.area->rings[endpoint.side];
+}
+
+// Wakes the peer if it sleeps waiting for `what`; only the first writer to see the flag rings
+static void wake_peer(ShmEndpoint &endpoint, uint32_t what)
+{
+    std::atomic<uint32_t> &waiting = endpoint.area->waiting[1 - endpoint.side];
+    if ((waiting.load() & what) && (waiting.fetch_and(~what) & what))
+    {
+        uint64_t one = 1;
+        ssize_t rung = write(endpoint.fds[2 - endpoint.side], &one, sizeof(one));
+        (void)rung; // A peer that is gone is noticed through its socket
+    }
+}
+
+static bool map_area(ShmEndpoint &endpoint)
+{
+    void *memory = mmap(NULL, sizeof(ShmArea), PROT_READ | PROT_WRITE, MAP_SHARED, endpoint.fds[0], 0);
+    if (memory == MAP_FAILED)
+    {
+        return false;
+    }
+    endpoint.area = (ShmArea *)memory;
+    return true;
+}
+
+bool shm_create(ShmEndpoint &endpoint)
+{
+    endpoint.area = NULL;
+    endpoint.side = 0;
+    endpoint.armed = 0;
+    endpoint.fds[0] = memfd_create("chess-shm", MFD_CLOEXEC);
+    endpoint.fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    endpoint.fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // A fresh memfd reads as zeros, which is an empty ring with nobody waiting
+    if (endpoint.fds[0] < 0 || endpoint.fds[1] < 0 || endpoint.fds[2] < 0 ||
+        ftruncate(endpoint.fds[0], sizeof(ShmArea)) != 0 || !map_area(endpoint))
+    {
+        shm_close(endpoint);
+        return false;
+    }
+    return true;
+}
+
+bool shm_attach(ShmEndpoint &endpoint, const int fds[SHM_FDS])
+{
+    endpoint.area = NULL;
+    endpoint.side = 1;
+    endpoint.armed = 0;
+    memcpy(endpoint.fds, fds, sizeof(endpoint.fds));
+    struct stat info;
+    if (fstat(fds[0], &info) != 0 || info.st_size != (off_t)sizeof(ShmArea) || !map_area(endpoint))
+    {
+        shm_close(endpoint);
+        return false;
+    }
+    return true;
+}
+
+void shm_close(ShmEndpoint &endpoint)
+{
+    if (endpoint.area)
+    {
+        munmap(endpoint.area, sizeof(ShmArea));
+        endpoint.area = NULL;
+    }
+    for (int i = 0; i < SHM_FDS; i++)
+    {
+        if (endpoint.fds[i] >= 0)
+        {
+            close(endpoint.fds[i]);
+        }
+        endpoint.fds[i] = -1;
+    }
+}
+
+size_t shm_write(ShmEndpoint &endpoint, const void *data, size_t size)
+{
+    ShmRing &ring = tx_ring(endpoint);
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t tail = ring.tail.load(std::memory_order_acquire);
+    size_t room = SHM_RING_SIZE - (size_t)(head - tail);
+    size_t n = size < room ? size : room;
+    if (n == 0)
+    {
+        return 0;
+    }
+    size_t offset = head & (SHM_RING_SIZE - 1);
+    size_t first = n < SHM_RING_SIZE - offset ? n : SHM_RING_SIZE - offset;
+    memcpy(ring.data + offset, data, first);
+    memcpy(ring.data, (const uint8_t *)data + first, n - first);
+    ring.head.store(head + n); // Sequentially consistent, pairs with shm_prepare_wait
+    wake_peer(endpoint, SHM_WAIT_DATA);
+    return n;
+}
+
+size_t shm_read(ShmEndpoint &endpoint, void *data, size_t size)
+{
+    ShmRing &ring = rx_ring(endpoint);
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    size_t available = (size_t)(head - tail);
+    size_t n = size < available ? size : available;
+    if (n == 0)
+    {
+        return 0;
+    }
+    size_t offset = tail & (SHM_RING_SIZE - 1);
+    size_t first = n < SHM_RING_SIZE - offset ? n : SHM_RING_SIZE - offset;
+    memcpy(data, ring.data + offset, first);
+    memcpy((uint8_t *)data + first, ring.data, n - first);
+    ring.tail.store(tail + n);
+    wake_peer(endpoint, SHM_WAIT_SPACE);
+    return n;
+}
+
+int shm_wait_fd(const ShmEndpoint &endpoint)
+{
+    return endpoint.fds[1 + endpoint.side];
+}
+
+bool shm_prepare_wait(ShmEndpoint &endpoint, uint32_t what)
+{
+    endpoint.armed = what;
+    endpoint.area->waiting[endpoint.side].store(what);
+    // Checked after the flag is visible, so a write that misses the flag is seen here
+    ShmRing &rx = rx_ring(endpoint);
+    ShmRing &tx = tx_ring(endpoint);
+    bool ready = ((what & SHM_WAIT_DATA) && rx.head.load() != rx.tail.load()) ||
+                 ((what & SHM_WAIT_SPACE) && tx.head.load() - tx.tail.load() < SHM_RING_SIZE);
+    return !ready;
+}
+
+void shm_end_wait(ShmEndpoint &endpoint)
+{
+    // The peer clears the flag it rang for, only then there is something to drain
+    uint32_t left = endpoint.area->waiting[endpoint.side].exchange(0);
+    if (left != endpoint.armed)
+    {
+        uint64_t count;
+        ssize_t drained = read(shm_wait_fd(endpoint), &count, sizeof(count));
+        (void)drained;
+    }
+    endpoint.armed = 0;
+}
+
+bool shm_send_fds(int socket, char message, const int fds[SHM_FDS])
+{
+    struct iovec iov = {&message, 1};
+    char control[CMSG_SPACE(SHM_FDS * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(SHM_FDS * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, SHM_FDS * sizeof(int));
+    return sendmsg(socket, &msg, MSG_NOSIGNAL) == 1;
+}
+
+bool shm_receive_fds(int socket, char &message, int fds[SHM_FDS])
+{
+    struct iovec iov = {&message, 1};
+    char control[CMSG_SPACE(SHM_FDS * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    for (int i = 0; i < SHM_FDS; i++)
+    {
+        fds[i] = -1;
+    }
+    if (recvmsg(socket, &msg, MSG_CMSG_CLOEXEC) != 1)
+    {
+        return false;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(SHM_FDS * sizeof(int)))
+    {
+        memcpy(fds, CMSG_DATA(cmsg), SHM_FDS * sizeof(int));
+    }
+    return true;
+}
@@ -0,0 +1,349 @@
+#include "spectator.h"
+#include "protocol.h"
+#include "metrics.h"
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+// A serialized update shared by every watcher of a game
+struct Frame {
+    std::atomic<int> refs;
+    char bytes[FRAME_SIZE]; // Status byte + board + legal moves
+};
+
+// Latest state of a watched game. Channels are created by the first
+// spectator_watch, so unwatched games never allocate one.
+struct Channel {
+    Frame *latest;     // NULL until the game publishes its first frame
+    uint64_t version;  // Bumped on every update
+    int watchers;
+    bool closed;
+};
+
+// A spectator connection, owned by the fan-out thread
+struct Watcher {
+    int socket;
+    uint32_t game;
+    Frame *frame;          // Frame being written, NULL when idle
+    size_t offset;         // Bytes of `frame` already written
+    uint64_t version;      // Channel version of `frame`
+    int64_t blocked_since; // When the socket stopped accepting data, 0 if it is not blocked
+    bool greeted;          // The spectate hello went out; the first frame carries it
+    bool done;
+};
+
+static pthread_mutex_t hub_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<uint32_t, Channel> channels;
+static std::vector<Watcher> new_watchers;
+static int wake_fd = -1;
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static Frame *frame_new()
+{
+    Frame *frame = new Frame;
+    frame->refs.store(1, std::memory_order_relaxed);
+    return frame;
+}
+
+static void frame_unref(Frame *frame)
+{
+    if (frame->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete frame;
+    }
+}
+
+static void wake_hub()
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("Spectator wakeup failed");
+    }
+}
+
+// Called with hub_lock held
+static void channel_release_watcher(uint32_t game)
+{
+    auto it = channels.find(game);
+    if (it == channels.end())
+    {
+        return;
+    }
+    it->second.watchers--;
+    if (it->second.closed && it->second.watchers == 0)
+    {
+        if (it->second.latest)
+        {
+            frame_unref(it->second.latest);
+        }
+        channels.erase(it);
+    }
+}
+
+// Write as much of the watcher's frame as the socket takes without blocking
+static void watcher_flush(Watcher &w, int64_t now)
+{
+    while (w.frame)
+    {
+        ssize_t n = send(w.socket, w.frame->bytes + w.offset, FRAME_SIZE - w.offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // Slow spectator: give it some time, then drop it
+                if (w.blocked_since == 0)
+                {
+                    w.blocked_since = now;
+                }
+                else if (now - w.blocked_since > SPECTATOR_STALL_MS)
+                {
+                    w.done = true;
+                    metrics_add(METRIC_SPECTATORS_DROPPED);
+                }
+            }
+            else if (errno != EINTR)
+            {
+                w.done = true;
+            }
+            return;
+        }
+        w.blocked_since = 0;
+        w.offset += n;
+        metrics_add(METRIC_BYTES_OUT, n);
+        if (w.offset == FRAME_SIZE)
+        {
+            frame_unref(w.frame);
+            w.frame = NULL;
+        }
+    }
+}
+
+static void *fanoutThread(void *)
+{
+    std::vector<Watcher> watchers;
+    std::vector<struct pollfd> fds;
+
+    while (1)
+    {
+        // Pick up new watchers and hand the latest frame to idle ones.
+        // Watchers that fell behind simply skip to the newest update.
+        pthread_mutex_lock(&hub_lock);
+        watchers.insert(watchers.end(), new_watchers.begin(), new_watchers.end());
+        new_watchers.clear();
+        for (Watcher &w : watchers)
+        {
+            const Channel &ch = channels.at(w.game);
+            if (w.frame)
+            {
+                if (ch.version - w.version > SPECTATOR_MAX_LAG && !w.done)
+                {
+                    w.done = true; // Too slow to keep up, drop it
+                    metrics_add(METRIC_SPECTATORS_DROPPED);
+                }
+            }
+            else if (w.version != ch.version && !w.greeted)
+            {
+                // The first frame announces spectator mode, a private copy
+                w.frame = frame_new();
+                memcpy(w.frame->bytes, ch.latest->bytes, FRAME_SIZE);
+                w.frame->bytes[0] = REQUEST_SPECTATE;
+                w.offset = 0;
+                w.version = ch.version;
+                w.greeted = true;
+            }
+            else if (w.version != ch.version)
+            {
+                ch.latest->refs.fetch_add(1, std::memory_order_relaxed);
+                w.frame = ch.latest;
+                w.offset = 0;
+                w.version = ch.version;
+            }
+            else if (ch.closed)
+            {
+                w.done = true; // Final update written
+            }
+        }
+        pthread_mutex_unlock(&hub_lock);
+
+        // Write frames without holding the lock
+        int64_t now = now_ms();
+        bool blocked = false;
+        for (Watcher &w : watchers)
+        {
+            if (!w.done)
+            {
+                watcher_flush(w, now);
+                blocked |= (w.frame != NULL);
+            }
+        }
+
+        // Drop finished and slow watchers
+        pthread_mutex_lock(&hub_lock);
+        for (size_t i = 0; i < watchers.size();)
+        {
+            Watcher &w = watchers[i];
+            if (!w.done)
+            {
+                i++;
+                continue;
+            }
+            close(w.socket);
+            if (w.frame)
+            {
+                frame_unref(w.frame);
+            }
+            channel_release_watcher(w.game);
+            w = watchers.back();
+            watchers.pop_back();
+        }
+        pthread_mutex_unlock(&hub_lock);
+
+        // Sleep until an update arrives or a blocked socket becomes writable
+        fds.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        for (const Watcher &w : watchers)
+        {
+            if (w.frame)
+            {
+                fds.push_back({w.socket, POLLOUT, 0});
+            }
+        }
+        if (poll(fds.data(), fds.size(), blocked ? 100 : -1) < 0 && errno != EINTR)
+        {
+            perror("Spectator poll error");
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0)
+            {
+                perror("Spectator wakeup read failed");
+            }
+        }
+    }
+    return NULL;
+}
+
+bool spectator_hub_start()
+{
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+        return false;
+    }
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, fanoutThread, NULL) != 0)
+    {
+        return false;
+    }
+    pthread_detach(thread_id);
+    return true;
+}
+
+void spectator_publish(uint32_t id, char status, const int data[128], const LegalMoves &legal)
+{
+    pthread_mutex_lock(&hub_lock);
+    auto it = channels.find(id);
+    if (it == channels.end())
+    {
+        pthread_mutex_unlock(&hub_lock);
+        return;
+    }
+    Channel &ch = it->second;
+
+    // Reuse the frame in place unless a watcher is still writing it
+    if (!ch.latest)
+    {
+        ch.latest = frame_new();
+    }
+    else if (ch.latest->refs.load(std::memory_order_acquire) != 1)
+    {
+        frame_unref(ch.latest);
+        ch.latest = frame_new();
+    }
+    ch.latest->bytes[0] = status;
+    memcpy(ch.latest->bytes + 1, data, BOARD_DATA_SIZE);
+    memcpy(ch.latest->bytes + 1 + BOARD_DATA_SIZE, &legal, LEGAL_DATA_SIZE);
+    ch.version++;
+    bool watched = ch.watchers > 0;
+    pthread_mutex_unlock(&hub_lock);
+
+    if (watched)
+    {
+        wake_hub();
+    }
+}
+
+void spectator_close_game(uint32_t id)
+{
+    pthread_mutex_lock(&hub_lock);
+    auto it = channels.find(id);
+    if (it == channels.end())
+    {
+        pthread_mutex_unlock(&hub_lock);
+        return;
+    }
+    bool watched = it->second.watchers > 0;
+    if (watched)
+    {
+        it->second.closed = true; // The fan-out thread removes it after the last watcher
+    }
+    else
+    {
+        if (it->second.latest)
+        {
+            frame_unref(it->second.latest);
+        }
+        channels.erase(it);
+    }
+    pthread_mutex_unlock(&hub_lock);
+
+    if (watched)
+    {
+        wake_hub();
+    }
+}
+
+bool spectator_watch(int socket, uint32_t id, bool &snapshot_wanted)
+{
+    pthread_mutex_lock(&hub_lock);
+    auto it = channels.find(id);
+    if (it == channels.end())
+    {
+        it = channels.emplace(id, Channel{NULL, 0, 0, false}).first;
+    }
+    Channel &ch = it->second;
+    if (ch.closed)
+    {
+        pthread_mutex_unlock(&hub_lock);
+        return false;
+    }
+    ch.watchers++;
+
+    // The current board goes out as the hello once the channel has a frame;
+    // a new channel waits for the game to publish one
+    snapshot_wanted = ch.latest == NULL;
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+    new_watchers.push_back(Watcher{socket, id, NULL, 0, ch.latest ? ch.version - 1 : 0, 0, false, false});
+    pthread_mutex_unlock(&hub_lock);
+
+    wake_hub();
+    return true;
+}
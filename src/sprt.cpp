@@ -0,0 +1,80 @@
+#include "sprt.h"
+#include <math.h>
+
+double elo_from_score(double score)
+{
+    if (score <= 0.0)
+    {
+        return -INFINITY;
+    }
+    if (score >= 1.0)
+    {
+        return INFINITY;
+    }
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+double score_from_elo(double elo)
+{
+    return 1.0 / (1.0 + pow(10.0, -elo / 400.0));
+}
+
+// Mean score and per-game variance of the results
+static bool score_moments(const MatchScore &match, double &mean, double &variance)
+{
+    double games = (double)(match.wins + match.draws + match.losses);
+    if (games == 0)
+    {
+        return false;
+    }
+    double w = match.wins / games, d = match.draws / games, l = match.losses / games;
+    mean = w + d / 2;
+    variance = w * (1 - mean) * (1 - mean) + d * (0.5 - mean) * (0.5 - mean) + l * mean * mean;
+    return true;
+}
+
+void elo_estimate(const MatchScore &match, double &elo, double &error95)
+{
+    double mean, variance;
+    elo = 0;
+    error95 = 0;
+    if (!score_moments(match, mean, variance))
+    {
+        return;
+    }
+    double games = (double)(match.wins + match.draws + match.losses);
+    double margin = 1.959964 * sqrt(variance / games);
+    elo = elo_from_score(mean);
+    error95 = (elo_from_score(mean + margin) - elo_from_score(mean - margin)) / 2;
+}
+
+void sprt_bounds(double alpha, double beta, double &lower, double &upper)
+{
+    lower = log(beta / (1 - alpha));
+    upper = log((1 - beta) / alpha);
+}
+
+double sprt_llr(const MatchScore &match, double elo0, double elo1)
+{
+    double mean, variance;
+    if (!score_moments(match, mean, variance) || variance <= 0)
+    {
+        return 0; // Nothing to tell the hypotheses apart yet
+    }
+    double games = (double)(match.wins + match.draws + match.losses);
+    double s0 = score_from_elo(elo0), s1 = score_from_elo(elo1);
+    return games * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+}
+
+SprtVerdict sprt_verdict(double llr, double lower, double upper)
+{
+    if (llr >= upper)
+    {
+        return SPRT_ACCEPT_H1;
+    }
+    if (llr <= lower)
+    {
+        return SPRT_ACCEPT_H0;
+    }
+    return SPRT_CONTINUE;
+}
@@ -0,0 +1,107 @@
+#include "timer_wheel.h"
+#include <stddef.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static void list_insert(Timer *head, Timer *timer)
+{
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void timer_wheel_init(TimerWheel &wheel, uint64_t now)
+{
+    wheel.now = now;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            Timer *head = &wheel.slots[level][slot];
+            head->next = head->prev = head;
+        }
+    }
+}
+
+// Puts the timer in the slot matching its distance from now
+static void timer_place(TimerWheel &wheel, Timer *timer)
+{
+    uint64_t delta = timer->expires - wheel.now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+    int slot = (timer->expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    list_insert(&wheel.slots[level][slot], timer);
+}
+
+void timer_add(TimerWheel &wheel, Timer *timer, uint64_t expires)
+{
+    timer_cancel(timer);
+    if (expires <= wheel.now)
+    {
+        expires = wheel.now + 1;
+    }
+    else if (expires - wheel.now >= WHEEL_SPAN)
+    {
+        expires = wheel.now + WHEEL_SPAN - 1;
+    }
+    timer->expires = expires;
+    timer_place(wheel, timer);
+}
+
+void timer_cancel(Timer *timer)
+{
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+        timer->prev->next = timer->next;
+        timer->next = timer->prev = NULL;
+    }
+}
+
+bool timer_pending(const Timer *timer)
+{
+    return timer->next != NULL;
+}
+
+// Moves the timers of one slot to the levels below
+static void timer_cascade(TimerWheel &wheel, int level, int slot)
+{
+    Timer *head = &wheel.slots[level][slot];
+    while (head->next != head)
+    {
+        Timer *timer = head->next;
+        timer_cancel(timer);
+        timer_place(wheel, timer);
+    }
+}
+
+void timer_wheel_advance(TimerWheel &wheel, uint64_t now)
+{
+    while (wheel.now < now)
+    {
+        uint64_t tick = ++wheel.now;
+
+        // Higher levels first, a level is cascaded when the one below wraps
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            if ((tick & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) == 0)
+            {
+                timer_cascade(wheel, level, (tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+            }
+        }
+
+        // Everything left in the level 0 slot expires now
+        Timer *head = &wheel.slots[0][tick & SLOT_MASK];
+        while (head->next != head)
+        {
+            Timer *timer = head->next;
+            timer_cancel(timer);
+            timer->callback(timer);
+        }
+    }
+}
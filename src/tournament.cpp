@@ -0,0 +1,373 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "chessboard.h"
+#include "search.h"
+#include "sprt.h"
+
+// Self-play match between two evaluations, for accepting or rejecting a
+// change. All games run in this process, several at once on worker
+// threads, with no socket or process per game. Each opening is played
+// twice with colors swapped. Games are decided by the rules library:
+// gameDecider for checkmate and stalemate, and draws for threefold
+// repetition, bare kings and the ply limit. Elo and the SPRT log-likelihood
+// ratio are updated after every game, and with -s the match stops as soon
+// as the test accepts a hypothesis. With -p every position played is also
+// written with the game's result, as training data for chess_tune.
+
+#define MAX_OPENING_LINE 256
+#define REPORT_EVERY 50 // Games between progress lines
+#define SPRT_ALPHA 0.05
+#define SPRT_BETA 0.05
+
+struct Options {
+    int games = 200;
+    int threads = 1;
+    int depth = 0;
+    uint64_t nodes = 20000;       // Per move, used when no depth is given
+    size_t hash_mb = 4;           // Per engine and thread
+    int max_plies = 300;
+    int random_plies = 8;         // Opening moves played at random without a book
+    bool sprt = false;
+    double elo0 = 0, elo1 = 10;
+};
+
+enum GameResult { RESULT_FIRST_WINS, RESULT_DRAW, RESULT_SECOND_WINS };
+
+static Options options;
+static EvalParams params[2]; // [0] the engine under test, [1] the baseline
+static std::vector<std::string> openings;
+static FILE *positionsFile;
+
+static std::atomic<int> nextGame(0);
+static std::atomic<bool> stopMatch(false);
+static pthread_mutex_t scoreLock = PTHREAD_MUTEX_INITIALIZER;
+static MatchScore score;
+static int gamesDone;
+static int reasons[4]; // Checkmate, stalemate, repetition, adjudicated draw
+static std::atomic<uint64_t> totalNodes(0);
+static std::atomic<uint64_t> totalPlies(0);
+static double sprtLower, sprtUpper;
+static int64_t startNs;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool load_openings(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    char line[MAX_OPENING_LINE];
+    while (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        Chessboard board;
+        char turn;
+        if (line[0] == 0 || line[0] == '#')
+        {
+            continue;
+        }
+        if (!boardFromFen(line, board, turn))
+        {
+            fprintf(stderr, "Invalid opening: %s\n", line);
+            fclose(file);
+            return false;
+        }
+        openings.push_back(line);
+    }
+    fclose(file);
+    return !openings.empty();
+}
+
+// Only the two kings are left
+static bool bare_kings(const Chessboard &board)
+{
+    for (int y = 0; y < 8; y++)
+        for (int x = 0; x < 8; x++)
+            if (board[y][x].type != 'e' && board[y][x].type != 'K')
+                return false;
+    return true;
+}
+
+// Start of the pair's games: a book position, or random plies from the initial position
+static void opening_position(int pair, Chessboard &board, char &turn)
+{
+    if (!openings.empty())
+    {
+        boardFromFen(openings[pair % openings.size()].c_str(), board, turn);
+        return;
+    }
+    board = initializeBoard();
+    turn = 'w';
+    unsigned seed = (unsigned)pair * 2654435761u + 1;
+    for (int ply = 0; ply < options.random_plies; ply++)
+    {
+        int moves[256][4];
+        int count = legal_moves(board, turn, moves, 256);
+        if (count == 0)
+        {
+            break;
+        }
+        can_move(board, moves[rand_r(&seed) % count], turn);
+        turn = (turn == 'w') ? 'b' : 'w';
+    }
+}
+
+// Plays one game; `first_color` is the color of the engine under test
+static GameResult play_game(int pair, char first_color, SearchTable tables[2], int &reason,
+                             std::vector<std::string> &fens)
+{
+    Chessboard board;
+    char turn;
+    opening_position(pair, board, turn);
+    search_table_clear(tables[0]);
+    search_table_clear(tables[1]);
+    std::vector<uint64_t> seen;
+    seen.push_back(position_hash(board, turn));
+
+    for (int ply = 0;; ply++)
+    {
+        char outcome = gameDecider(board, turn);
+        if (outcome == 'c')
+        {
+            reason = 0;
+            return (turn == first_color) ? RESULT_SECOND_WINS : RESULT_FIRST_WINS;
+        }
+        if (outcome == 's')
+        {
+            reason = 1;
+            return RESULT_DRAW;
+        }
+        int repeats = 0;
+        for (uint64_t hash : seen)
+            repeats += (hash == seen.back());
+        if (repeats >= 3)
+        {
+            reason = 2;
+            return RESULT_DRAW;
+        }
+        if (ply >= options.max_plies || bare_kings(board))
+        {
+            reason = 3;
+            return RESULT_DRAW;
+        }
+
+        if (positionsFile)
+        {
+            char fen[FEN_SIZE];
+            boardToFen(board, turn, fen);
+            fens.push_back(fen);
+        }
+
+        int engine = (turn == first_color) ? 0 : 1;
+        SearchLimits limits = {options.depth, options.depth ? 0 : options.nodes, 0, NULL, &tables[engine]};
+        SearchResult result;
+        search(board, turn, limits, params[engine], result);
+        totalNodes.fetch_add(result.nodes, std::memory_order_relaxed);
+        if (!result.has_move || !can_move(board, result.move, turn))
+        {
+            reason = 3; // Not reached while gameDecider and legal_moves agree
+            return RESULT_DRAW;
+        }
+        totalPlies.fetch_add(1, std::memory_order_relaxed);
+        turn = (turn == 'w') ? 'b' : 'w';
+        seen.push_back(position_hash(board, turn));
+    }
+}
+
+static void print_status(const char *prefix)
+{
+    double elo, error;
+    elo_estimate(score, elo, error);
+    double elapsed = (now_ns() - startNs) / 1e9;
+    printf("%sGames %d: +%llu =%llu -%llu, Elo %.1f +/- %.1f", prefix, gamesDone, (unsigned long long)score.wins,
+           (unsigned long long)score.draws, (unsigned long long)score.losses, elo, error);
+    if (options.sprt)
+    {
+        printf(", LLR %.2f (%.2f, %.2f)", sprt_llr(score, options.elo0, options.elo1), sprtLower, sprtUpper);
+    }
+    printf(", %.1f games/s\n", gamesDone / elapsed);
+    fflush(stdout);
+}
+
+static void record(GameResult result, int reason)
+{
+    pthread_mutex_lock(&scoreLock);
+    if (!stopMatch.load())
+    {
+        score.wins += (result == RESULT_FIRST_WINS);
+        score.draws += (result == RESULT_DRAW);
+        score.losses += (result == RESULT_SECOND_WINS);
+        reasons[reason]++;
+        gamesDone++;
+        if (options.sprt && sprt_verdict(sprt_llr(score, options.elo0, options.elo1), sprtLower, sprtUpper) != SPRT_CONTINUE)
+        {
+            stopMatch.store(true); // Games still running are not counted
+        }
+        if (gamesDone % REPORT_EVERY == 0)
+        {
+            print_status("");
+        }
+    }
+    pthread_mutex_unlock(&scoreLock);
+}
+
+static void *workerThread(void *)
+{
+    SearchTable tables[2];
+    if (!search_table_create(tables[0], options.hash_mb) || !search_table_create(tables[1], options.hash_mb))
+    {
+        fprintf(stderr, "Cannot allocate hash tables\n");
+        exit(1);
+    }
+    std::vector<std::string> fens;
+    for (;;)
+    {
+        int game = nextGame.fetch_add(1);
+        if (game >= options.games || stopMatch.load())
+        {
+            break;
+        }
+        int reason = 0;
+        char first_color = (game % 2 == 0) ? 'w' : 'b';
+        fens.clear();
+        GameResult result = play_game(game / 2, first_color, tables, reason, fens);
+        record(result, reason);
+        if (positionsFile)
+        {
+            // Results are from White's side
+            const char *label = (result == RESULT_DRAW) ? "1/2-1/2"
+                                : ((result == RESULT_FIRST_WINS) == (first_color == 'w')) ? "1-0" : "0-1";
+            std::string lines;
+            for (const std::string &fen : fens)
+                lines += fen + " " + label + "\n";
+            pthread_mutex_lock(&scoreLock);
+            fwrite(lines.data(), 1, lines.size(), positionsFile);
+            pthread_mutex_unlock(&scoreLock);
+        }
+    }
+    search_table_free(tables[0]);
+    search_table_free(tables[1]);
+    return NULL;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-a params] [-b params] [-o openings] [-g games] [-t threads] [-d depth | -n nodes]\n"
+            "          [-H hash_mb] [-m max_plies] [-r random_plies] [-s elo0:elo1] [-p positions]\n"
+            "  -a  evaluation of the engine under test, -b of the baseline; built-in tables by default\n"
+            "  -o  file with one FEN per line, each played with both colors\n"
+            "  -r  random opening plies per pair without -o, default 8\n"
+            "  -p  append every position played and its game's result to this file\n"
+            "  -s  stop when the SPRT of H0 elo0 against H1 elo1 decides (alpha = beta = 0.05)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    params[0] = default_eval_params;
+    params[1] = default_eval_params;
+    options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:o:g:t:d:n:H:m:r:s:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+        case 'b':
+            if (!eval_params_load(optarg, params[opt == 'a' ? 0 : 1]))
+            {
+                fprintf(stderr, "Cannot load evaluation parameters from %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            if (!load_openings(optarg))
+            {
+                return 1;
+            }
+            break;
+        case 'g': options.games = atoi(optarg); break;
+        case 't': options.threads = atoi(optarg); break;
+        case 'd': options.depth = atoi(optarg); break;
+        case 'n': options.nodes = strtoull(optarg, NULL, 10); break;
+        case 'H': options.hash_mb = (size_t)atoi(optarg); break;
+        case 'm': options.max_plies = atoi(optarg); break;
+        case 'r': options.random_plies = atoi(optarg); break;
+        case 'p':
+            positionsFile = fopen(optarg, "a");
+            if (!positionsFile)
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            options.sprt = sscanf(optarg, "%lf:%lf", &options.elo0, &options.elo1) == 2;
+            if (!options.sprt)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.games < 1 || options.threads < 1 || options.hash_mb < 1 || (options.depth == 0 && options.nodes == 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    sprt_bounds(SPRT_ALPHA, SPRT_BETA, sprtLower, sprtUpper);
+
+    printf("Playing %d games on %d threads, %s %llu per move, openings: %s\n", options.games, options.threads,
+           options.depth ? "depth" : "nodes", (unsigned long long)(options.depth ? options.depth : options.nodes),
+           openings.empty() ? "random" : "file");
+    fflush(stdout);
+    startNs = now_ns();
+    std::vector<pthread_t> threads(options.threads);
+    for (pthread_t &thread : threads)
+    {
+        pthread_create(&thread, NULL, workerThread, NULL);
+    }
+    for (pthread_t &thread : threads)
+    {
+        pthread_join(thread, NULL);
+    }
+    double elapsed = (now_ns() - startNs) / 1e9;
+    if (positionsFile)
+    {
+        fclose(positionsFile);
+    }
+
+    print_status("Final: ");
+    printf("Checkmates %d, stalemates %d, repetitions %d, adjudicated draws %d\n", reasons[0], reasons[1],
+           reasons[2], reasons[3]);
+    printf("%.1f s, %.0f plies/s, %.0f nodes/s\n", elapsed, totalPlies.load() / elapsed, totalNodes.load() / elapsed);
+    if (options.sprt)
+    {
+        SprtVerdict verdict = sprt_verdict(sprt_llr(score, options.elo0, options.elo1), sprtLower, sprtUpper);
+        printf("SPRT: %s\n", verdict == SPRT_ACCEPT_H1   ? "H1 accepted"
+                             : verdict == SPRT_ACCEPT_H0 ? "H0 accepted"
+                                                         : "inconclusive");
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "trace.h"
+
+#ifdef CHESS_TRACE
+
+#include <atomic>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct TraceEvent {
+    const char *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int tid;
+};
+
+// Single-writer ring of the most recent events of one thread
+struct TraceRing {
+    TraceEvent events[TRACE_RING_SIZE];
+    std::atomic<uint64_t> head; // Events written so far
+    int tid;
+    bool in_use;
+    TraceRing *next;
+};
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing *rings = NULL;
+static uint64_t trace_epoch_ns = 0;
+
+// Hands the ring to the next new thread once its owner exits; its events stay until overwritten
+struct TraceRingOwner {
+    TraceRing *ring = NULL;
+    ~TraceRingOwner()
+    {
+        if (ring)
+        {
+            pthread_mutex_lock(&rings_lock);
+            ring->in_use = false;
+            pthread_mutex_unlock(&rings_lock);
+        }
+    }
+};
+static thread_local TraceRingOwner ring_owner;
+
+static TraceRing *trace_acquire_ring()
+{
+    pthread_mutex_lock(&rings_lock);
+    TraceRing *ring = rings;
+    while (ring && ring->in_use)
+    {
+        ring = ring->next;
+    }
+    if (!ring)
+    {
+        ring = (TraceRing *)calloc(1, sizeof(TraceRing));
+        if (!ring)
+        {
+            pthread_mutex_unlock(&rings_lock);
+            abort();
+        }
+        ring->next = rings;
+        rings = ring;
+    }
+    ring->in_use = true;
+    ring->tid = (int)syscall(SYS_gettid);
+    pthread_mutex_unlock(&rings_lock);
+    return ring;
+}
+
+uint64_t trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    TraceRing *ring = ring_owner.ring;
+    if (!ring)
+    {
+        ring = ring_owner.ring = trace_acquire_ring();
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent &event = ring->events[head % TRACE_RING_SIZE];
+    event.name = name;
+    event.start_ns = start_ns;
+    event.duration_ns = end_ns - start_ns;
+    event.tid = ring->tid;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void trace_dump()
+{
+    const char *path = getenv("CHESS_TRACE_FILE");
+    if (!path)
+    {
+        path = "chess_trace.json";
+    }
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        perror("Cannot write trace");
+        return;
+    }
+
+    // Threads keep recording meanwhile; an event being overwritten during the dump may come out torn
+    fprintf(out, "{\"traceEvents\":[\n");
+    bool first = true;
+    pthread_mutex_lock(&rings_lock);
+    for (TraceRing *ring = rings; ring; ring = ring->next)
+    {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (uint64_t i = begin; i < head; i++)
+        {
+            const TraceEvent &event = ring->events[i % TRACE_RING_SIZE];
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n", event.name, (int)getpid(), event.tid,
+                    (event.start_ns - trace_epoch_ns) / 1000.0, event.duration_ns / 1000.0);
+            first = false;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(out);
+    fprintf(stderr, "Trace written to %s\n", path);
+}
+
+// Dumps on SIGUSR1; SIGINT and SIGTERM dump through the atexit handler and stop the process
+static void *traceSignalThread(void *arg)
+{
+    sigset_t *signals = (sigset_t *)arg;
+    while (1)
+    {
+        int sig = 0;
+        if (sigwait(signals, &sig) != 0)
+        {
+            continue;
+        }
+        if (sig == SIGUSR1)
+        {
+            trace_dump();
+        }
+        else
+        {
+            exit(EXIT_SUCCESS);
+        }
+    }
+    return NULL;
+}
+
+void trace_init()
+{
+    trace_epoch_ns = trace_now_ns();
+
+    // Block the signals in every thread created from now on, the dump thread waits for them
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    atexit(trace_dump);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, traceSignalThread, &signals) == 0)
+    {
+        pthread_detach(thread_id);
+    }
+}
+
+#endif // CHESS_TRACE
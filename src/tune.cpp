@@ -0,0 +1,359 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "chessboard.h"
+#include "search.h"
+
+// Texel tuning of the evaluation tables. Positions labelled with their
+// game's result (chess_tournament -p writes them) are streamed into a
+// compact array: one 16-bit feature per piece from eval_features, a count
+// and the result, about 60 bytes for a middlegame position. The error is
+// the mean squared difference between the result and the sigmoid of the
+// evaluation, 1 / (1 + 10^(-K e / 400)), with K fitted to the starting
+// tables first.
+//
+// Every epoch the positions are split between threads. Each one sums the
+// error and its gradient over its slice. The weight table holds the
+// negated values for Black, so a position's evaluation is a plain sum of
+// table entries, a loop the compiler can vectorize. The per-thread
+// gradients are added up and the parameters take one Adam (or plain
+// gradient descent) step. The tables are written after every epoch in the
+// format chess_engine -e and chess_tournament -a read.
+
+#define PARAMETERS (EVAL_PIECES * 65) // Material, then the tables, as in parameter files
+#define MAX_LINE 512
+#define ADAM_BETA1 0.9
+#define ADAM_BETA2 0.999
+#define ADAM_EPSILON 1e-8
+
+struct Dataset {
+    std::vector<uint16_t> features; // All positions' features back to back
+    std::vector<uint8_t> counts;    // Features per position
+    std::vector<uint8_t> results;   // White's score doubled: 0 loss, 1 draw, 2 win
+};
+
+struct Slice {
+    size_t first, last;  // Positions
+    size_t offset;       // Index of the first one's features
+    double error;
+    double gradient[EVAL_FEATURES]; // Sum of (result - s) s (1 - s) per feature
+    pthread_t thread;
+};
+
+static Dataset data;
+static float weights[EVAL_FEATURES];
+static float scale; // K ln(10) / 400
+static bool withGradient;
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Game result from the last token of a line: 1-0, 0-1, 1/2-1/2 or 1, 0.5, 0, maybe in quotes or brackets
+static int parse_result(char *line)
+{
+    char *end = line + strlen(line);
+    while (end > line && strchr(" \t\r\n;\"]", end[-1]))
+    {
+        end--;
+    }
+    *end = 0;
+    char *token = end;
+    while (token > line && !strchr(" \t\"[", token[-1]))
+    {
+        token--;
+    }
+    if (strcmp(token, "1-0") == 0 || strcmp(token, "1") == 0 || strcmp(token, "1.0") == 0)
+    {
+        return 2;
+    }
+    if (strcmp(token, "1/2-1/2") == 0 || strcmp(token, "0.5") == 0)
+    {
+        return 1;
+    }
+    if (strcmp(token, "0-1") == 0 || strcmp(token, "0") == 0 || strcmp(token, "0.0") == 0)
+    {
+        return 0;
+    }
+    return -1;
+}
+
+static bool load_positions(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    char line[MAX_LINE];
+    size_t skipped = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        Chessboard board;
+        char turn;
+        int result = parse_result(line);
+        if (result < 0 || !boardFromFen(line, board, turn))
+        {
+            skipped += (line[0] != 0 && line[0] != '#');
+            continue;
+        }
+        uint16_t features[64];
+        int count = eval_features(board, features);
+        data.features.insert(data.features.end(), features, features + count);
+        data.counts.push_back((uint8_t)count);
+        data.results.push_back((uint8_t)result);
+    }
+    fclose(file);
+    if (skipped)
+    {
+        fprintf(stderr, "Skipped %zu unreadable lines\n", skipped);
+    }
+    return !data.counts.empty();
+}
+
+static void *sliceThread(void *arg)
+{
+    Slice *slice = (Slice *)arg;
+    const uint16_t *features = data.features.data() + slice->offset;
+    double error = 0;
+    if (withGradient)
+    {
+        memset(slice->gradient, 0, sizeof(slice->gradient));
+    }
+    for (size_t i = slice->first; i < slice->last; i++)
+    {
+        int count = data.counts[i];
+        float eval = 0;
+        for (int k = 0; k < count; k++)
+        {
+            eval += weights[features[k]];
+        }
+        float sigmoid = 1.0f / (1.0f + expf(-scale * eval));
+        float residual = data.results[i] * 0.5f - sigmoid;
+        error += residual * residual;
+        if (withGradient)
+        {
+            double term = residual * sigmoid * (1.0f - sigmoid);
+            for (int k = 0; k < count; k++)
+            {
+                slice->gradient[features[k]] += term;
+            }
+        }
+        features += count;
+    }
+    slice->error = error;
+    return NULL;
+}
+
+// Mean squared error of `theta` over all positions; fills `gradient` when given
+static double run_epoch(const double theta[PARAMETERS], std::vector<Slice> &slices, double gradient[PARAMETERS])
+{
+    for (int kind = 0; kind < EVAL_PIECES; kind++)
+    {
+        for (int square = 0; square < 64; square++)
+        {
+            float value = (float)(theta[kind] + theta[EVAL_PIECES + kind * 64 + square]);
+            weights[kind * 64 + square] = value;
+            weights[EVAL_BLACK_FEATURES + kind * 64 + square] = -value;
+        }
+    }
+    withGradient = gradient != NULL;
+    for (Slice &slice : slices)
+    {
+        pthread_create(&slice.thread, NULL, sliceThread, &slice);
+    }
+    double error = 0;
+    for (Slice &slice : slices)
+    {
+        pthread_join(slice.thread, NULL);
+        error += slice.error;
+    }
+    double positions = (double)data.counts.size();
+    if (gradient)
+    {
+        // d error / d weight = -2 / N * sum (result - s) s (1 - s) * scale * feature
+        memset(gradient, 0, PARAMETERS * sizeof(double));
+        for (int feature = 0; feature < EVAL_BLACK_FEATURES; feature++)
+        {
+            double sum = 0;
+            for (const Slice &slice : slices)
+            {
+                sum += slice.gradient[feature] - slice.gradient[EVAL_BLACK_FEATURES + feature];
+            }
+            double g = -2.0 * scale * sum / positions;
+            gradient[EVAL_PIECES + feature] = g;
+            gradient[feature / 64] += g; // Material counts on every square
+        }
+    }
+    return error / positions;
+}
+
+// Golden-section search for the K that fits the starting tables best
+static double fit_scale(const double theta[PARAMETERS], std::vector<Slice> &slices)
+{
+    const double ratio = (sqrt(5.0) - 1) / 2;
+    double low = 0.01, high = 3.0;
+    for (int i = 0; i < 30; i++)
+    {
+        double a = high - ratio * (high - low), b = low + ratio * (high - low);
+        scale = (float)(a * log(10.0) / 400);
+        double error_a = run_epoch(theta, slices, NULL);
+        scale = (float)(b * log(10.0) / 400);
+        double error_b = run_epoch(theta, slices, NULL);
+        if (error_a < error_b)
+        {
+            high = b;
+        }
+        else
+        {
+            low = a;
+        }
+    }
+    return (low + high) / 2;
+}
+
+static void to_params(const double theta[PARAMETERS], EvalParams &params)
+{
+    for (int kind = 0; kind < EVAL_PIECES; kind++)
+    {
+        params.material[kind] = (int32_t)lround(theta[kind]);
+        for (int square = 0; square < 64; square++)
+            params.pst[kind][square] = (int32_t)lround(theta[EVAL_PIECES + kind * 64 + square]);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-o output] [-s start_params] [-e epochs] [-t threads] [-r rate] [-G] [-K k] positions\n"
+            "  positions: one FEN per line followed by the game's result (1-0, 0-1, 1/2-1/2)\n"
+            "  -o  tuned parameters, default tuned.txt\n"
+            "  -G  plain gradient descent instead of Adam\n"
+            "  -K  sigmoid scale, fitted to the start parameters by default\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = "tuned.txt";
+    EvalParams start = default_eval_params;
+    int epochs = 100;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool adam = true;
+    double rate = 0;
+    double k = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:s:e:t:r:GK:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o': output = optarg; break;
+        case 's':
+            if (!eval_params_load(optarg, start))
+            {
+                fprintf(stderr, "Cannot load evaluation parameters from %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'e': epochs = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'G': adam = false; break;
+        case 'K': k = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || epochs < 1 || threads < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (rate <= 0)
+    {
+        rate = adam ? 1.0 : 5000.0; // Centipawns per step; plain gradients are small
+    }
+
+    double started = now_s();
+    if (!load_positions(argv[optind]))
+    {
+        fprintf(stderr, "No positions in %s\n", argv[optind]);
+        return 1;
+    }
+    size_t positions = data.counts.size();
+    size_t bytes = data.features.size() * sizeof(uint16_t) + data.counts.size() + data.results.size();
+    printf("Loaded %zu positions (%.1f MB) in %.2f s\n", positions, bytes / 1048576.0, now_s() - started);
+
+    // Equal slices of positions; each thread starts at its own feature offset
+    std::vector<Slice> slices(threads < (int)positions ? threads : (int)positions);
+    size_t offset = 0, position = 0;
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+        slices[i].first = position;
+        slices[i].offset = offset;
+        slices[i].last = positions * (i + 1) / slices.size();
+        for (; position < slices[i].last; position++)
+        {
+            offset += data.counts[position];
+        }
+    }
+
+    double theta[PARAMETERS], gradient[PARAMETERS];
+    double moment[PARAMETERS] = {0}, velocity[PARAMETERS] = {0};
+    for (int kind = 0; kind < EVAL_PIECES; kind++)
+    {
+        theta[kind] = start.material[kind];
+        for (int square = 0; square < 64; square++)
+            theta[EVAL_PIECES + kind * 64 + square] = start.pst[kind][square];
+    }
+    if (k <= 0)
+    {
+        k = fit_scale(theta, slices);
+    }
+    scale = (float)(k * log(10.0) / 400);
+    printf("K = %.4f, start error %.6f, %zu threads, %s, rate %g\n", k, run_epoch(theta, slices, NULL),
+           slices.size(), adam ? "Adam" : "gradient descent", rate);
+
+    EvalParams tuned;
+    for (int epoch = 1; epoch <= epochs; epoch++)
+    {
+        double epoch_started = now_s();
+        double error = run_epoch(theta, slices, gradient);
+        for (int i = 0; i < PARAMETERS; i++)
+        {
+            if (!adam)
+            {
+                theta[i] -= rate * gradient[i];
+                continue;
+            }
+            moment[i] = ADAM_BETA1 * moment[i] + (1 - ADAM_BETA1) * gradient[i];
+            velocity[i] = ADAM_BETA2 * velocity[i] + (1 - ADAM_BETA2) * gradient[i] * gradient[i];
+            double corrected_moment = moment[i] / (1 - pow(ADAM_BETA1, epoch));
+            double corrected_velocity = velocity[i] / (1 - pow(ADAM_BETA2, epoch));
+            theta[i] -= rate * corrected_moment / (sqrt(corrected_velocity) + ADAM_EPSILON);
+        }
+        to_params(theta, tuned);
+        if (!eval_params_save(output, tuned))
+        {
+            perror(output);
+            return 1;
+        }
+        double elapsed = now_s() - epoch_started;
+        printf("Epoch %d: error %.6f, %.3f s (%.2f M positions/s)\n", epoch, error, elapsed,
+               positions / elapsed / 1e6);
+        fflush(stdout);
+    }
+    printf("Final error %.6f, parameters written to %s\n", run_epoch(theta, slices, NULL), output);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "archive.h"
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test_helpers.h"
+
+class ArchiveTest : public TempFileTest {
+protected:
+    char index_path[80];
+    void SetUp() override {
+        use_path("test_archive", {".idx"});
+        sibling(".idx", index_path, sizeof(index_path));
+        ASSERT_TRUE(session_pool_init(1));
+    }
+    void TearDown() override {
+        archive_close();
+        TempFileTest::TearDown();
+    }
+};
+
+TEST_F(ArchiveTest, EncodeDecodeRoundTrip) {
+    GameSession *session = session_acquire(1, 2);
+    play_random(session, 120, 7);
+
+    std::vector<uint8_t> bits;
+    ASSERT_TRUE(archive_encode(session->moves, session->ply, bits));
+    EXPECT_LT(bits.size(), (size_t)session->ply); // Under a byte per move
+
+    ArchivedGame game;
+    game.header.ply = session->ply;
+    game.header.bytes = (uint16_t)bits.size();
+    game.bits = bits.data();
+    uint16_t decoded[MAX_PLIES];
+    ASSERT_TRUE(archive_decode(game, decoded));
+    for (int i = 0; i < session->ply; i++) {
+        EXPECT_EQ(decoded[i], session->moves[i]);
+    }
+
+    uint16_t illegal = 0; // a1 to a1
+    EXPECT_FALSE(archive_encode(&illegal, 1, bits));
+}
+
+TEST_F(ArchiveTest, RandomAccessAndStreaming) {
+    const int games = ARCHIVE_BLOCK_GAMES + 10; // One full block and a short one
+    std::vector<uint16_t> first_moves(games);
+    std::vector<uint32_t> ids(games);
+    ASSERT_TRUE(archive_open(path));
+    for (int i = 0; i < games; i++) {
+        GameSession *session = session_acquire(1, 2);
+        play_random(session, 1 + i % 8, i); // Short games keep the test fast
+        first_moves[i] = session->moves[0];
+        ids[i] = session->id;
+        EXPECT_EQ(archive_append(session, 3), (uint64_t)i);
+        session_release(session);
+    }
+    archive_close();
+
+    ArchiveReader reader;
+    ASSERT_TRUE(archive_reader_open(reader, path));
+    EXPECT_EQ(reader.games, (uint64_t)games);
+    EXPECT_EQ(reader.blocks, 2u);
+
+    int samples[] = {games - 1, 0, ARCHIVE_BLOCK_GAMES, 1234};
+    for (int number : samples) {
+        ArchivedGame game;
+        uint16_t moves[MAX_PLIES];
+        ASSERT_TRUE(archive_read(reader, number, game));
+        EXPECT_EQ(game.header.id, ids[number]);
+        EXPECT_EQ(game.header.ply, 1 + number % 8);
+        EXPECT_EQ(game.header.end_reason, 3);
+        ASSERT_TRUE(archive_decode(game, moves));
+        EXPECT_EQ(moves[0], first_moves[number]);
+    }
+    ArchivedGame game;
+    EXPECT_FALSE(archive_read(reader, games, game));
+
+    int streamed = 0;
+    while (archive_next(reader, game)) {
+        EXPECT_EQ(game.header.id, ids[streamed]);
+        streamed++;
+    }
+    EXPECT_EQ(streamed, games);
+    archive_reader_close(reader);
+}
+
+TEST_F(ArchiveTest, ReopenDropsTornBlock) {
+    ASSERT_TRUE(archive_open(path));
+    GameSession *session = session_acquire(1, 2);
+    play_random(session, 20, 1);
+    archive_append(session, 0);
+    archive_close();
+
+    // A block whose index entry exists but whose data was cut short
+    ASSERT_TRUE(archive_open(path));
+    archive_append(session, 0);
+    archive_close();
+    ASSERT_EQ(truncate(path, 40), 0);
+
+    ASSERT_TRUE(archive_open(path));
+    EXPECT_EQ(archive_append(session, 0), 0u); // Numbering resumes after the intact data
+    archive_close();
+}
@@ -95,6 +95,130 @@ TEST(ChessboardTest, StalemateDetection) {
     EXPECT_FALSE(stalemate(board, 'w', king_pos));
 }
 
+TEST(ChessboardTest, LegalMoves) {
+    Chessboard board = initializeBoard();
+    int moves[256][4];
+
+    // 16 pawn moves and 4 knight moves from the starting position
+    EXPECT_EQ(legal_moves(board, 'w', moves, 256), 20);
+    EXPECT_EQ(legal_moves(board, 'b', moves, 256), 20);
+    EXPECT_EQ(legal_moves(board, 'w', moves, 5), 5);
+
+    // The board itself is left untouched
+    EXPECT_EQ(board[1][0].type, 'p');
+    EXPECT_EQ(board[3][0].type, 'e');
+
+    Chessboard endgame = initializeEndgameBoard();
+    EXPECT_EQ(legal_moves(endgame, 'w', moves, 256), 0);
+}
+
+TEST(ChessboardTest, LegalMoveSet) {
+    Chessboard board = initializeBoard();
+    LegalMoves legal;
+    legal_move_set(board, 'w', legal);
+
+    // Every listed move is in the set and nothing else is
+    int moves[256][4];
+    int count = legal_moves(board, 'w', moves, 256);
+    int bits = 0;
+    for (int i = 0; i < 16; i++) {
+        bits += __builtin_popcountll(legal.targets[i]);
+    }
+    EXPECT_EQ(bits, count);
+    for (int i = 0; i < count; i++) {
+        EXPECT_TRUE(legal_move_allowed(legal, moves[i]));
+    }
+
+    int knight[4] = {1, 0, 2, 2};
+    int blocked[4] = {0, 0, 0, 2};   // Rook behind its pawn
+    int outside[4] = {1, 1, 1, 8};
+    EXPECT_TRUE(legal_move_allowed(legal, knight));
+    EXPECT_FALSE(legal_move_allowed(legal, blocked));
+    EXPECT_FALSE(legal_move_allowed(legal, outside));
+    EXPECT_EQ(legal_targets(legal, 1, 1), (1ULL << (2 * 8 + 1)) | (1ULL << (3 * 8 + 1)));
+    EXPECT_EQ(legal_targets(legal, 3, 0), 0u);
+
+    Chessboard endgame = initializeEndgameBoard();
+    legal_move_set(endgame, 'w', legal);
+    EXPECT_EQ(legal.from, 0u);
+}
+
+TEST(ChessboardTest, FenLoading) {
+    Chessboard board;
+    char turn = 0;
+
+    ASSERT_TRUE(boardFromFen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", board, turn));
+    Chessboard start = initializeBoard();
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            EXPECT_EQ(board[row][col].type, start[row][col].type);
+            EXPECT_EQ(board[row][col].color, start[row][col].color);
+        }
+    }
+    EXPECT_EQ(turn, 'w');
+
+    ASSERT_TRUE(boardFromFen("8/8/8/3k4/8/8/2Q5/K7 b", board, turn));
+    EXPECT_EQ(turn, 'b');
+    EXPECT_EQ(board[0][7].type, 'K');   // White king on a1
+    EXPECT_EQ(board[1][5].type, 'q');   // White queen on c2
+    EXPECT_EQ(board[4][4].color, 'b');  // Black king on d5
+
+    EXPECT_FALSE(boardFromFen("8/8/8/8/8/8/8 w", board, turn));
+    EXPECT_FALSE(boardFromFen("9/8/8/8/8/8/8/8 w", board, turn));
+    EXPECT_FALSE(boardFromFen("8/8/8/8/8/8/8/7x w", board, turn));
+
+    char fen[FEN_SIZE];
+    boardToFen(initializeBoard(), 'w', fen);
+    EXPECT_STREQ(fen, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w");
+    ASSERT_TRUE(boardFromFen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R b", board, turn));
+    boardToFen(board, turn, fen);
+    EXPECT_STREQ(fen, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R b");
+}
+
+TEST(ChessboardTest, UciMovesPromotePawnsOnTheLastRank) {
+    char text[UCI_MOVE_SIZE];
+    Chessboard board = initializeBoard();
+    int knight[4] = {1, 0, 2, 2}, pawn[4] = {3, 1, 3, 3};
+    moveToUci(board, knight, text);
+    EXPECT_STREQ(text, "g1f3");
+    moveToUci(board, pawn, text);
+    EXPECT_STREQ(text, "e2e4");
+
+    char turn;
+    ASSERT_TRUE(boardFromFen("4k2R/P7/8/8/8/8/p7/4K3 w", board, turn));
+    int white[4] = {7, 6, 7, 7}, black[4] = {7, 1, 7, 0}, rook[4] = {0, 7, 0, 6};
+    moveToUci(board, white, text);
+    EXPECT_STREQ(text, "a7a8q");
+    moveToUci(board, black, text);
+    EXPECT_STREQ(text, "a2a1q");
+    moveToUci(board, rook, text);
+    EXPECT_STREQ(text, "h8h7");
+}
+
+TEST(PositionHashTest, DependsOnPlacementAndSide) {
+    Chessboard board = initializeBoard();
+    uint64_t start = position_hash(board, 'w');
+    EXPECT_EQ(position_hash(initializeBoard(), 'w'), start);
+    EXPECT_NE(position_hash(board, 'b'), start);
+
+    // Knight out and back reaches the starting placement again
+    int out[4] = {1, 0, 2, 2}, back[4] = {2, 2, 1, 0};
+    ASSERT_TRUE(can_move(board, out, 'w'));
+    EXPECT_NE(position_hash(board, 'b'), position_hash(initializeBoard(), 'b'));
+    ASSERT_TRUE(can_move(board, back, 'w'));
+    EXPECT_EQ(position_hash(board, 'w'), start);
+}
+
+TEST(ChessboardTest, HashIgnoresUnknownPieces) {
+    // Boards from the network may carry any byte; unknown pieces hash like empty squares
+    Chessboard board = initializeBoard();
+    uint64_t start = position_hash(board, 'w');
+    board[4][4] = Piece('\0', 'b');
+    EXPECT_EQ(position_hash(board, 'w'), start);
+    board[4][4] = Piece('x', 'w');
+    EXPECT_EQ(position_hash(board, 'w'), start);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,58 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "session.h"
+
+// Plays `ply` random legal moves into the session's history
+inline void play_random(GameSession *session, int ply, unsigned seed) {
+    for (int i = 0; i < ply; i++) {
+        int moves[256][4];
+        int count = legal_moves(session->board, session->turn, moves, 256);
+        if (count == 0) {
+            break;
+        }
+        int *move = moves[rand_r(&seed) % count];
+        can_move(session->board, move, session->turn);
+        session_record_move(session, move);
+        session->turn = (session->turn == 'w') ? 'b' : 'w';
+    }
+}
+
+// Fixture owning a per-process file in /tmp and its siblings (`path` plus
+// each suffix), removed before and after every test
+class TempFileTest : public ::testing::Test {
+protected:
+    char path[64];
+
+    void use_path(const char *name, std::vector<std::string> suffixes = {}) {
+        snprintf(path, sizeof(path), "/tmp/%s_%d.bin", name, (int)getpid());
+        this->suffixes = suffixes;
+        remove_files();
+    }
+    // `path` with a suffix appended, into `out`
+    void sibling(const char *suffix, char *out, size_t size) const {
+        snprintf(out, size, "%s%s", path, suffix);
+    }
+    void TearDown() override {
+        remove_files();
+    }
+
+private:
+    std::vector<std::string> suffixes;
+
+    void remove_files() const {
+        unlink(path);
+        for (const std::string &suffix : suffixes) {
+            unlink((path + suffix).c_str());
+        }
+    }
+};
+
+#endif // TEST_HELPERS_H
@@ -0,0 +1,167 @@
+#include "move_log.h"
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "test_helpers.h"
+
+static std::vector<GameSession *> recovered;
+
+static void collect(GameSession *session) {
+    recovered.push_back(session);
+}
+
+class MoveLogTest : public TempFileTest {
+protected:
+    void SetUp() override {
+        use_path("test_move_log", {".tmp"});
+        recovered.clear();
+        ASSERT_TRUE(session_pool_init(8));
+    }
+    void TearDown() override {
+        move_log_close();
+        TempFileTest::TearDown();
+    }
+};
+
+TEST_F(MoveLogTest, RecoversRunningGames) {
+    ASSERT_TRUE(move_log_open(path, 0, collect));
+    EXPECT_TRUE(recovered.empty());
+
+    GameSession *running = session_acquire(1, 2);
+    GameSession *finished = session_acquire(3, 4);
+    running->resume_secret[0] = 11;
+    running->resume_secret[1] = 22;
+    move_log_start(running);
+    move_log_start(finished);
+
+    int moves[2][4] = {{3, 1, 3, 3}, {3, 6, 3, 4}}; // e2e4 e7e5
+    Chessboard expected = initializeBoard();
+    for (int i = 0; i < 2; i++) {
+        char turn = i == 0 ? 'w' : 'b';
+        ASSERT_TRUE(can_move(expected, moves[i], turn));
+        move_log_move(running, pack_move(moves[i]), 1000 * (i + 1));
+    }
+    move_log_wait(move_log_end(finished));
+    move_log_close(); // The server stops without ending `running`
+
+    // A record torn by the crash is ignored
+    FILE *file = fopen(path, "ab");
+    fwrite("torn", 1, 4, file);
+    fclose(file);
+
+    uint32_t id = running->id;
+    ASSERT_TRUE(session_pool_init(8));
+    ASSERT_TRUE(move_log_open(path, 5000, collect));
+    ASSERT_EQ(recovered.size(), 1u);
+    GameSession *session = recovered[0];
+    EXPECT_EQ(session->id, id);
+    EXPECT_EQ(session->turn, 'w');
+    EXPECT_EQ(session->ply, 2);
+    EXPECT_EQ(session->resume_secret[1], 22u);
+    EXPECT_EQ(session->clock.remaining_ms[0], 1000);
+    EXPECT_EQ(session->clock.remaining_ms[1], 2000);
+    EXPECT_EQ(session->clientSocketWhite, -1);
+    EXPECT_EQ(memcmp(&session->board, &expected, sizeof(expected)), 0);
+
+    // The recovered slot stays taken and the compacted log still holds the game
+    EXPECT_EQ(session_pool_in_use(), 1u);
+    EXPECT_NE(session_acquire(5, 6), session);
+    move_log_close();
+    recovered.clear();
+    ASSERT_TRUE(session_pool_init(8));
+    ASSERT_TRUE(move_log_open(path, 5000, collect));
+    ASSERT_EQ(recovered.size(), 1u);
+    EXPECT_EQ(recovered[0]->ply, 2);
+    EXPECT_EQ(recovered[0]->clock.remaining_ms[1], 2000);
+}
+
+TEST_F(MoveLogTest, KeepsGamesLongerThanTheHistory) {
+    ASSERT_TRUE(move_log_open(path, 0, collect));
+    GameSession *session = session_acquire(1, 2);
+    move_log_start(session);
+
+    // Knights shuffle g1-f3, g8-f6 and back; an odd count leaves Black to move
+    int cycle[4][4] = {{1, 0, 2, 2}, {1, 7, 2, 5}, {2, 2, 1, 0}, {2, 5, 1, 7}};
+    Chessboard expected = initializeBoard();
+    uint64_t last = 0;
+    for (int i = 0; i < MAX_PLIES + 77; i++) {
+        ASSERT_TRUE(can_move(expected, cycle[i % 4], i % 2 == 0 ? 'w' : 'b'));
+        last = move_log_move(session, pack_move(cycle[i % 4]), 0);
+    }
+    move_log_wait(last);
+    move_log_close();
+
+    // Recovery compacts the log; the second restart reads the compacted one
+    for (int restart = 0; restart < 2; restart++) {
+        recovered.clear();
+        ASSERT_TRUE(session_pool_init(8));
+        ASSERT_TRUE(move_log_open(path, 0, collect));
+        ASSERT_EQ(recovered.size(), 1u);
+        EXPECT_EQ(recovered[0]->turn, 'b');
+        EXPECT_EQ(recovered[0]->ply, MAX_PLIES);
+        EXPECT_EQ(memcmp(&recovered[0]->board, &expected, sizeof(expected)), 0);
+        move_log_close();
+    }
+}
+
+TEST_F(MoveLogTest, CheckpointsWhileRunning) {
+    ASSERT_TRUE(move_log_open(path, 0, collect));
+    GameSession *running = session_acquire(1, 2);
+    move_log_start(running);
+    int move[4] = {3, 1, 3, 3}; // e2e4
+    move_log_move(running, pack_move(move), 0);
+    uint32_t id = running->id;
+
+    // Finished games alone grow the log past the checkpoint size
+    for (int i = 0; i < MOVE_LOG_COMPACT_MIN / 2 + 100; i++) {
+        GameSession *finished = session_acquire(3, 4);
+        move_log_start(finished);
+        move_log_end(finished);
+        session_release(finished);
+    }
+    move_log_close();
+
+    struct stat st;
+    ASSERT_EQ(stat(path, &st), 0);
+    EXPECT_LT((size_t)st.st_size, 1000 * sizeof(MoveLogRecord));
+
+    ASSERT_TRUE(session_pool_init(8));
+    ASSERT_TRUE(move_log_open(path, 0, collect));
+    ASSERT_EQ(recovered.size(), 1u);
+    EXPECT_EQ(recovered[0]->id, id);
+    EXPECT_EQ(recovered[0]->ply, 1);
+}
+
+TEST_F(MoveLogTest, FailedSyncIsNotAcknowledged) {
+    ASSERT_TRUE(move_log_open(path, 0, collect));
+    GameSession *session = session_acquire(1, 2);
+    ASSERT_TRUE(move_log_wait(move_log_start(session)));
+
+    // Writes past the file size limit fail with EFBIG; the start record fills it
+    signal(SIGXFSZ, SIG_IGN);
+    struct rlimit saved, limit;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    limit = saved;
+    limit.rlim_cur = sizeof(MoveLogRecord);
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+    int move[4] = {1, 0, 2, 2};
+    uint64_t last = 0;
+    for (int i = 0; i < 16; i++) {
+        last = move_log_move(session, pack_move(move), 0);
+    }
+    bool synced = move_log_wait(last);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, SIG_DFL);
+    EXPECT_FALSE(synced);
+    EXPECT_FALSE(move_log_wait(move_log_move(session, pack_move(move), 0)));
+
+    // The torn batch was cut off again
+    struct stat st;
+    ASSERT_EQ(stat(path, &st), 0);
+    EXPECT_EQ((size_t)st.st_size, sizeof(MoveLogRecord));
+}
@@ -0,0 +1,118 @@
+#include "position_cache.h"
+#include "metrics.h"
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+static uint64_t hits() {
+    return metrics_local().counters[METRIC_POSITION_CACHE_HITS].load();
+}
+
+// Positions along a random game, each with its side to move
+static void random_positions(int count, unsigned seed, std::vector<Chessboard> &boards, std::vector<char> &turns) {
+    Chessboard board = initializeBoard();
+    char turn = 'w';
+    for (int i = 0; i < count; i++) {
+        boards.push_back(board);
+        turns.push_back(turn);
+        int moves[256][4];
+        int legal = legal_moves(board, turn, moves, 256);
+        if (legal == 0) {
+            board = initializeBoard();
+            turn = 'w';
+            continue;
+        }
+        can_move(board, moves[rand_r(&seed) % legal], turn);
+        turn = (turn == 'w') ? 'b' : 'w';
+    }
+}
+
+class PositionCacheTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        position_cache_free();
+    }
+};
+
+TEST_F(PositionCacheTest, MatchesRulesEvaluation) {
+    ASSERT_TRUE(position_cache_init(64 * 1024)); // Small enough to evict
+    std::vector<Chessboard> boards;
+    std::vector<char> turns;
+    random_positions(300, 3, boards, turns);
+    Chessboard mate;
+    char mate_turn;
+    ASSERT_TRUE(boardFromFen("7k/6Q1/6K1/8/8/8/8/8 b", mate, mate_turn));
+    boards.push_back(mate);
+    turns.push_back(mate_turn);
+
+    uint64_t before = hits();
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < boards.size(); i++) {
+            LegalMoves cached, expected;
+            char outcome = position_cache_evaluate(boards[i], turns[i], cached);
+            EXPECT_EQ(outcome, gameDecider(boards[i], turns[i]));
+            if (outcome == turns[i]) {
+                legal_move_set(boards[i], turns[i], expected);
+            } else {
+                memset(&expected, 0, sizeof(expected));
+            }
+            EXPECT_EQ(memcmp(&cached, &expected, sizeof(expected)), 0) << "position " << i;
+        }
+    }
+    EXPECT_GT(hits(), before);
+    LegalMoves legal;
+    EXPECT_EQ(position_cache_evaluate(mate, mate_turn, legal), 'c');
+    EXPECT_EQ(legal.from, 0u);
+}
+
+TEST_F(PositionCacheTest, ClockGivesHitPositionsASecondChance) {
+    ASSERT_TRUE(position_cache_init(1)); // Below one set: disabled
+    EXPECT_EQ(position_cache_capacity(), 0u);
+    ASSERT_TRUE(position_cache_init(12 * 1024));
+    uint64_t sets = position_cache_capacity() / POSITION_CACHE_WAYS;
+    ASSERT_GT(sets, 1u);
+
+    // One-off positions that share a set with the opening position
+    Chessboard start = initializeBoard();
+    uint64_t set = position_hash(start, 'w') & (sets - 1);
+    std::vector<Chessboard> boards;
+    std::vector<char> turns;
+    random_positions(2000, 11, boards, turns);
+    std::vector<size_t> same_set;
+    std::vector<uint64_t> seen = {position_hash(start, 'w')};
+    for (size_t i = 0; i < boards.size() && same_set.size() < POSITION_CACHE_WAYS; i++) {
+        uint64_t hash = position_hash(boards[i], turns[i]);
+        if ((hash & (sets - 1)) == set && std::find(seen.begin(), seen.end(), hash) == seen.end()) {
+            seen.push_back(hash);
+            same_set.push_back(i);
+        }
+    }
+    ASSERT_EQ(same_set.size(), (size_t)POSITION_CACHE_WAYS);
+
+    // Fill the set, hit the opening, then one more position needs a way
+    LegalMoves legal;
+    position_cache_evaluate(start, 'w', legal);
+    for (int i = 0; i < POSITION_CACHE_WAYS - 1; i++) {
+        position_cache_evaluate(boards[same_set[i]], turns[same_set[i]], legal);
+    }
+    position_cache_evaluate(start, 'w', legal);
+    size_t last = same_set[POSITION_CACHE_WAYS - 1];
+    position_cache_evaluate(boards[last], turns[last], legal);
+
+    uint64_t before = hits();
+    position_cache_evaluate(start, 'w', legal);
+    EXPECT_EQ(hits(), before + 1); // Kept by its reference mark
+    position_cache_evaluate(boards[same_set[0]], turns[same_set[0]], legal);
+    EXPECT_EQ(hits(), before + 1); // The oldest unreferenced one went
+}
+
+TEST_F(PositionCacheTest, DisabledCacheStillEvaluates) {
+    ASSERT_TRUE(position_cache_init(0));
+    Chessboard board = initializeBoard();
+    LegalMoves legal;
+    uint64_t before = hits();
+    EXPECT_EQ(position_cache_evaluate(board, 'w', legal), 'w');
+    EXPECT_NE(legal.from, 0u);
+    EXPECT_EQ(hits(), before);
+}
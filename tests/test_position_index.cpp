@@ -0,0 +1,93 @@
+#include "position_index.h"
+#include "archive.h"
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test_helpers.h"
+
+class PositionIndexTest : public TempFileTest {
+protected:
+    char index_path[80];
+    void SetUp() override {
+        use_path("test_position_index", {".idx", ".pos"});
+        sibling(".pos", index_path, sizeof(index_path));
+        ASSERT_TRUE(session_pool_init(1));
+    }
+    void TearDown() override {
+        archive_close();
+        TempFileTest::TearDown();
+    }
+};
+
+TEST_F(PositionIndexTest, FindsEveryPosition) {
+    // Several archive blocks and, with a tiny memory budget, several runs per thread
+    const int games = ARCHIVE_BLOCK_GAMES + 100;
+    ASSERT_TRUE(archive_open(path));
+    for (int i = 0; i < games; i++) {
+        GameSession *session = session_acquire(1, 2);
+        play_random(session, 1 + i % 3, i);
+        archive_append(session, 0);
+        session_release(session);
+    }
+    archive_close();
+    ASSERT_TRUE(position_index_build(path, index_path, 3, 0));
+
+    PositionIndex index;
+    ASSERT_TRUE(position_index_open(index, index_path));
+    uint64_t expected = 0;
+    for (int i = 0; i < games; i++) {
+        expected += 2 + i % 3;
+    }
+    ASSERT_EQ(index.count, expected);
+    for (uint64_t i = 1; i < index.count; i++) {
+        ASSERT_LE(index.entries[i - 1].hash, index.entries[i].hash);
+    }
+
+    // Every game starts from the initial position
+    uint64_t first;
+    EXPECT_EQ(position_index_find(index, position_hash(initializeBoard(), 'w'), first), (uint64_t)games);
+    EXPECT_EQ(index.entries[first].game, 0u);
+    EXPECT_EQ(index.entries[first].ply, 0);
+
+    // Replayed positions of sampled games point back at them
+    ArchiveReader reader;
+    ASSERT_TRUE(archive_reader_open(reader, path));
+    for (int number = 0; number < games; number += 251) {
+        ArchivedGame game;
+        uint16_t moves[MAX_PLIES];
+        ASSERT_TRUE(archive_read(reader, number, game));
+        ASSERT_TRUE(archive_decode(game, moves));
+        Chessboard board = initializeBoard();
+        char turn = 'w';
+        for (int ply = 0; ply < game.header.ply; ply++) {
+            int move[4];
+            unpack_move(moves[ply], move);
+            can_move(board, move, turn);
+            turn = (turn == 'w') ? 'b' : 'w';
+        }
+        uint64_t count = position_index_find(index, position_hash(board, turn), first);
+        bool found = false;
+        for (uint64_t i = first; i < first + count; i++) {
+            found |= index.entries[i].game == (uint32_t)number && index.entries[i].ply == game.header.ply;
+        }
+        EXPECT_TRUE(found) << "game " << number;
+    }
+    archive_reader_close(reader);
+
+    EXPECT_EQ(position_index_find(index, 12345, first), 0u);
+    position_index_close(index);
+}
+
+TEST_F(PositionIndexTest, EmptyArchive) {
+    ASSERT_TRUE(archive_open(path));
+    archive_close();
+    ASSERT_TRUE(position_index_build(path, index_path, 4, 1 << 20));
+    PositionIndex index;
+    ASSERT_TRUE(position_index_open(index, index_path));
+    EXPECT_EQ(index.count, 0u);
+    uint64_t first;
+    EXPECT_EQ(position_index_find(index, 1, first), 0u);
+    position_index_close(index);
+}
@@ -0,0 +1,138 @@
+#include "search.h"
+#include <gtest/gtest.h>
+
+static SearchResult run(const char *fen, int depth) {
+    Chessboard board;
+    char turn;
+    EXPECT_TRUE(boardFromFen(fen, board, turn));
+    SearchLimits limits = {depth, 0, 0, NULL, NULL};
+    SearchResult result;
+    search(board, turn, limits, default_eval_params, result);
+    return result;
+}
+
+TEST(SearchTest, StartPositionIsBalanced) {
+    Chessboard board = initializeBoard();
+    EXPECT_EQ(evaluate(board, 'w', default_eval_params), 0);
+    EXPECT_EQ(evaluate(board, 'b', default_eval_params), 0);
+
+    // A knight in the centre is worth more than on the rim, for either color
+    Chessboard centre, rim;
+    char turn;
+    ASSERT_TRUE(boardFromFen("4k3/8/8/8/3N4/8/8/4K3 w", centre, turn));
+    ASSERT_TRUE(boardFromFen("4k3/8/8/8/N7/8/8/4K3 w", rim, turn));
+    EXPECT_GT(evaluate(centre, 'w', default_eval_params), evaluate(rim, 'w', default_eval_params));
+    ASSERT_TRUE(boardFromFen("4k3/8/8/3n4/8/8/8/4K3 b", centre, turn));
+    ASSERT_TRUE(boardFromFen("4k3/8/8/n7/8/8/8/4K3 b", rim, turn));
+    EXPECT_GT(evaluate(centre, 'b', default_eval_params), evaluate(rim, 'b', default_eval_params));
+}
+
+TEST(SearchTest, TakesHangingQueen) {
+    SearchResult result = run("4k3/8/8/3q4/8/8/3R4/4K3 w", 2);
+    ASSERT_TRUE(result.has_move);
+    // d2 to d5 on this board, files are mirrored
+    EXPECT_EQ(result.move[0], 4);
+    EXPECT_EQ(result.move[1], 1);
+    EXPECT_EQ(result.move[2], 4);
+    EXPECT_EQ(result.move[3], 4);
+    EXPECT_GT(result.score, 300);
+}
+
+TEST(SearchTest, FindsMateInOne) {
+    SearchResult result = run("7k/8/6K1/8/8/8/8/1Q6 w", 3);
+    ASSERT_TRUE(result.has_move);
+    EXPECT_EQ(result.score, SEARCH_MATE - 1);
+    EXPECT_EQ(result.move[3], 7); // The queen mates on the eighth rank
+}
+
+TEST(SearchTest, NoLegalMove) {
+    SearchResult mated = run("7k/6Q1/6K1/8/8/8/8/8 b", 4);
+    EXPECT_FALSE(mated.has_move);
+    EXPECT_EQ(mated.score, -SEARCH_MATE);
+    SearchResult stalemate = run("7k/8/6QK/8/8/8/8/8 b", 4);
+    EXPECT_FALSE(stalemate.has_move);
+    EXPECT_EQ(stalemate.score, 0);
+}
+
+TEST(SearchTest, LimitsStopTheSearch) {
+    Chessboard board = initializeBoard();
+    SearchResult result;
+    SearchLimits nodes = {0, 2000, 0, NULL, NULL};
+    search(board, 'w', nodes, default_eval_params, result);
+    EXPECT_TRUE(result.has_move);
+    EXPECT_LT(result.depth, SEARCH_MAX_DEPTH);
+
+    std::atomic<bool> stop(true);
+    SearchLimits stopped = {6, 0, 0, &stop, NULL};
+    search(board, 'w', stopped, default_eval_params, result);
+    EXPECT_TRUE(result.has_move); // Depth 1 always completes
+    EXPECT_EQ(result.depth, 1);
+}
+
+TEST(SearchTest, TableKeepsTheResultAndSavesNodes) {
+    const char *fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w";
+    Chessboard board;
+    char turn;
+    ASSERT_TRUE(boardFromFen(fen, board, turn));
+    SearchTable table;
+    ASSERT_TRUE(search_table_create(table, 1));
+    EXPECT_EQ(table.mask + 1, 65536u); // 16 byte entries
+
+    SearchLimits plain = {4, 0, 0, NULL, NULL};
+    SearchLimits cached = {4, 0, 0, NULL, &table};
+    SearchResult without, first, again;
+    search(board, turn, plain, default_eval_params, without);
+    search(board, turn, cached, default_eval_params, first);
+    search(board, turn, cached, default_eval_params, again);
+    EXPECT_LT(first.nodes, without.nodes);
+    EXPECT_LT(again.nodes, first.nodes / 2);
+    EXPECT_EQ(again.score, first.score);
+
+    // Mate distances survive the table
+    search_table_clear(table);
+    SearchResult mate = run("7k/8/6K1/8/8/8/8/1Q6 w", 3);
+    ASSERT_TRUE(boardFromFen("7k/8/6K1/8/8/8/8/1Q6 w", board, turn));
+    SearchLimits deep = {5, 0, 0, NULL, &table};
+    search(board, turn, deep, default_eval_params, first);
+    EXPECT_EQ(first.score, mate.score);
+    search_table_free(table);
+}
+
+TEST(SearchTest, ParamsFileRoundTrips) {
+    EvalParams params = default_eval_params;
+    params.material[EVAL_KNIGHT] = 305;
+    params.pst[EVAL_KING][63] = -7;
+    const char *path = "test_search_params.txt";
+    ASSERT_TRUE(eval_params_save(path, params));
+    EvalParams loaded = default_eval_params;
+    ASSERT_TRUE(eval_params_load(path, loaded));
+    EXPECT_EQ(memcmp(&loaded, &params, sizeof(params)), 0);
+
+    // A truncated file leaves the parameters alone
+    FILE *file = fopen(path, "w");
+    fprintf(file, "# material only\n100 300 300 500 900 0\n");
+    fclose(file);
+    EXPECT_FALSE(eval_params_load(path, loaded));
+    EXPECT_EQ(memcmp(&loaded, &params, sizeof(params)), 0);
+    remove(path);
+}
+
+TEST(SearchTest, FeaturesAddUpToTheEvaluation) {
+    const char *fens[] = {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w",
+                          "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w",
+                          "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 b"};
+    for (const char *fen : fens) {
+        Chessboard board;
+        char turn;
+        ASSERT_TRUE(boardFromFen(fen, board, turn));
+        uint16_t features[64];
+        int count = eval_features(board, features);
+        int sum = 0;
+        for (int i = 0; i < count; i++) {
+            int feature = features[i] % EVAL_BLACK_FEATURES;
+            int value = default_eval_params.material[feature / 64] + default_eval_params.pst[feature / 64][feature % 64];
+            sum += (features[i] < EVAL_BLACK_FEATURES) ? value : -value;
+        }
+        EXPECT_EQ(sum, evaluate(board, 'w', default_eval_params)) << fen;
+    }
+}
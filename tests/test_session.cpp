@@ -0,0 +1,104 @@
+#include "session.h"
+#include <gtest/gtest.h>
+
+TEST(SessionTest, PackMoveRoundTrip) {
+    int move[4] = {3, 1, 3, 3};
+    int unpacked[4];
+    unpack_move(pack_move(move), unpacked);
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(unpacked[i], move[i]);
+    }
+}
+
+TEST(SessionTest, PoolIsBounded) {
+    ASSERT_TRUE(session_pool_init(2));
+
+    GameSession *first = session_acquire(1, 2);
+    GameSession *second = session_acquire(3, 4);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    EXPECT_EQ(session_acquire(5, 6), nullptr);
+    EXPECT_EQ(session_pool_in_use(), 2u);
+
+    EXPECT_EQ(first->turn, 'w');
+    EXPECT_EQ(first->board[0][3].type, 'K');
+
+    // A released slot is reused under a new id
+    uint32_t oldId = first->id;
+    session_release(first);
+    GameSession *third = session_acquire(7, 8);
+    EXPECT_EQ(third, first);
+    EXPECT_NE(third->id, oldId);
+    EXPECT_EQ(third->clientSocketWhite, 7);
+}
+
+TEST(SessionTest, RecordMoveStopsAtCapacity) {
+    ASSERT_TRUE(session_pool_init(1));
+    GameSession *session = session_acquire(1, 2);
+    ASSERT_NE(session, nullptr);
+
+    int move[4] = {1, 0, 2, 2};
+    for (int i = 0; i < MAX_PLIES + 10; i++) {
+        session_record_move(session, move);
+    }
+    EXPECT_EQ(session->ply, MAX_PLIES);
+    EXPECT_EQ(session->moves[0], pack_move(move));
+}
+
+TEST(SessionTest, FindOnlyMatchesCurrentGame) {
+    ASSERT_TRUE(session_pool_init(2));
+    GameSession *session = session_acquire(1, 2);
+    ASSERT_NE(session, nullptr);
+    EXPECT_EQ(session->pending_socket[0], -1);
+    EXPECT_EQ(session_find(session->id), session);
+
+    // Once the slot holds another game the old id no longer resolves
+    uint32_t oldId = session->id;
+    session_release(session);
+    GameSession *reused = session_acquire(3, 4);
+    EXPECT_EQ(reused, session);
+    EXPECT_EQ(session_find(oldId), nullptr);
+    EXPECT_EQ(session_find(reused->id), reused);
+}
+
+TEST(SessionTest, IdsKeepTheirSlotWhenTheGenerationWraps) {
+    ASSERT_TRUE(session_pool_init(3));
+    GameSession *session = session_restore(0xFFFFFFFEu);
+    ASSERT_NE(session, nullptr);
+    session_pool_relink();
+    EXPECT_EQ(session_find(0xFFFFFFFEu), session);
+
+    // The generation wraps past 2^32 and the id still resolves to its slot
+    session_release(session);
+    GameSession *reused = session_acquire(1, 2);
+    EXPECT_EQ(reused, session);
+    EXPECT_LT(reused->id, 0xFFFFFFFEu);
+    EXPECT_EQ(session_find(reused->id), reused);
+    EXPECT_EQ(session_find(0xFFFFFFFEu), nullptr);
+}
+
+TEST(SessionTest, LateMoveIsNotPlayed) {
+    ASSERT_TRUE(session_pool_init(1));
+    GameSession *session = session_acquire(1, 2);
+    ASSERT_NE(session, nullptr);
+    session->clock.remaining_ms[0] = session->clock.remaining_ms[1] = 1000;
+    session->clock.increment_ms = 500;
+    session->clock.turn_started_ms = 10000;
+    Chessboard before = session->board;
+
+    // The flag fell at 11000; a move arriving after it leaves everything as it was
+    int move[4] = {3, 1, 3, 3}; // e2e4
+    EXPECT_EQ(session_play_move(session, move, 11000, true), SESSION_MOVE_LATE);
+    EXPECT_EQ(session->ply, 0);
+    EXPECT_EQ(session->clock.remaining_ms[0], 0);
+    EXPECT_EQ(memcmp(&session->board, &before, sizeof(before)), 0);
+
+    // In time, the move is played and the clock charged with the increment
+    session->clock.remaining_ms[0] = 1000;
+    EXPECT_EQ(session_play_move(session, move, 10400, true), SESSION_MOVE_PLAYED);
+    EXPECT_EQ(session->ply, 1);
+    EXPECT_EQ(session->moves[0], pack_move(move));
+    EXPECT_EQ(session->clock.remaining_ms[0], 1100);
+    EXPECT_EQ(session->board[3][3].type, 'p');
+}
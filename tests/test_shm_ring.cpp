@@ -0,0 +1,122 @@
+#include "shm_ring.h"
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+// Connects a client endpoint to a fresh server endpoint the way the server
+// does it: the descriptors travel over a Unix socket
+static void connect_pair(ShmEndpoint &server, ShmEndpoint &client) {
+    ASSERT_TRUE(shm_create(server));
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    ASSERT_TRUE(shm_send_fds(sockets[0], 'm', server.fds));
+    char message = 0;
+    int fds[SHM_FDS];
+    ASSERT_TRUE(shm_receive_fds(sockets[1], message, fds));
+    EXPECT_EQ(message, 'm');
+    ASSERT_TRUE(shm_attach(client, fds));
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+TEST(ShmRingTest, CarriesBytesBothWaysAcrossTheWrap) {
+    ShmEndpoint server, client;
+    connect_pair(server, client);
+
+    std::vector<uint8_t> chunk(SHM_RING_SIZE / 3 + 7);
+    std::vector<uint8_t> received(chunk.size());
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < chunk.size(); i++)
+            chunk[i] = (uint8_t)(i * 31 + round);
+        ASSERT_EQ(shm_write(client, chunk.data(), chunk.size()), chunk.size());
+        ASSERT_EQ(shm_read(server, received.data(), received.size()), chunk.size());
+        EXPECT_EQ(received, chunk);
+        ASSERT_EQ(shm_write(server, chunk.data(), chunk.size()), chunk.size());
+        ASSERT_EQ(shm_read(client, received.data(), received.size()), chunk.size());
+        EXPECT_EQ(received, chunk);
+    }
+    EXPECT_EQ(shm_read(server, received.data(), received.size()), 0u);
+
+    shm_close(client);
+    shm_close(server);
+}
+
+TEST(ShmRingTest, FullRingTakesPartialWritesAndWakesOnlyWaiters) {
+    ShmEndpoint server, client;
+    connect_pair(server, client);
+    std::vector<uint8_t> data(SHM_RING_SIZE + 100, 7);
+
+    // Only what fits is taken
+    EXPECT_EQ(shm_write(server, data.data(), data.size()), (size_t)SHM_RING_SIZE);
+    EXPECT_EQ(shm_write(server, data.data(), 1), 0u);
+
+    // Nobody waited for data, so nobody was woken
+    struct pollfd fd = {shm_wait_fd(client), POLLIN, 0};
+    EXPECT_EQ(poll(&fd, 1, 0), 0);
+
+    // A server waiting for space is woken by the client's read
+    EXPECT_TRUE(shm_prepare_wait(server, SHM_WAIT_SPACE));
+    uint8_t buffer[100];
+    EXPECT_EQ(shm_read(client, buffer, sizeof(buffer)), sizeof(buffer));
+    fd = {shm_wait_fd(server), POLLIN, 0};
+    EXPECT_EQ(poll(&fd, 1, 0), 1);
+    shm_end_wait(server);
+    EXPECT_EQ(poll(&fd, 1, 0), 0);
+
+    // A wait that is already satisfied is refused
+    EXPECT_FALSE(shm_prepare_wait(client, SHM_WAIT_DATA));
+    shm_end_wait(client);
+
+    shm_close(client);
+    shm_close(server);
+}
+
+TEST(ShmRingTest, StreamsBetweenThreadsWithSleepingReader) {
+    ShmEndpoint server, client;
+    connect_pair(server, client);
+    const uint64_t total = 8 * SHM_RING_SIZE;
+
+    std::thread writer([&] {
+        uint8_t chunk[4096];
+        uint64_t sent = 0;
+        while (sent < total) {
+            size_t n = 0;
+            for (; n < sizeof(chunk) && sent + n < total; n++)
+                chunk[n] = (uint8_t)((sent + n) % 251);
+            size_t done = 0;
+            while (done < n) {
+                size_t written = shm_write(client, chunk + done, n - done);
+                done += written;
+                if (written == 0 && shm_prepare_wait(client, SHM_WAIT_SPACE)) {
+                    struct pollfd fd = {shm_wait_fd(client), POLLIN, 0};
+                    poll(&fd, 1, -1);
+                }
+                shm_end_wait(client);
+            }
+            sent += n;
+        }
+    });
+
+    uint64_t received = 0;
+    bool intact = true;
+    uint8_t buffer[10000];
+    while (received < total) {
+        size_t n = shm_read(server, buffer, sizeof(buffer));
+        for (size_t i = 0; i < n; i++)
+            intact &= buffer[i] == (uint8_t)((received + i) % 251);
+        received += n;
+        if (n == 0 && shm_prepare_wait(server, SHM_WAIT_DATA)) {
+            struct pollfd fd = {shm_wait_fd(server), POLLIN, 0};
+            poll(&fd, 1, -1); // Never woken would hang the test here
+        }
+        shm_end_wait(server);
+    }
+    writer.join();
+    EXPECT_TRUE(intact);
+
+    shm_close(client);
+    shm_close(server);
+}
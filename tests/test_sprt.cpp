@@ -0,0 +1,51 @@
+#include "sprt.h"
+#include <gtest/gtest.h>
+
+TEST(SprtTest, EloAndScoreAreInverse) {
+    EXPECT_DOUBLE_EQ(elo_from_score(0.5), 0.0);
+    EXPECT_NEAR(elo_from_score(0.75), 190.85, 0.01);
+    EXPECT_NEAR(elo_from_score(0.25), -190.85, 0.01);
+    EXPECT_NEAR(score_from_elo(elo_from_score(0.61)), 0.61, 1e-12);
+
+    MatchScore even = {30, 40, 30};
+    double elo, error;
+    elo_estimate(even, elo, error);
+    EXPECT_NEAR(elo, 0.0, 1e-9);
+    EXPECT_GT(error, 30.0);
+    EXPECT_LT(error, 80.0);
+
+    // Four times the games halve the interval
+    MatchScore more = {120, 160, 120};
+    double error_more;
+    elo_estimate(more, elo, error_more);
+    EXPECT_NEAR(error_more, error / 2, error * 0.05);
+}
+
+TEST(SprtTest, BoundsFollowErrorRates) {
+    double lower, upper;
+    sprt_bounds(0.05, 0.05, lower, upper);
+    EXPECT_NEAR(lower, -2.944, 0.001);
+    EXPECT_NEAR(upper, 2.944, 0.001);
+    EXPECT_EQ(sprt_verdict(0.0, lower, upper), SPRT_CONTINUE);
+    EXPECT_EQ(sprt_verdict(3.0, lower, upper), SPRT_ACCEPT_H1);
+    EXPECT_EQ(sprt_verdict(-3.0, lower, upper), SPRT_ACCEPT_H0);
+}
+
+TEST(SprtTest, LlrGrowsWithEvidence) {
+    MatchScore none = {0, 0, 0};
+    EXPECT_EQ(sprt_llr(none, 0, 10), 0.0);
+
+    // A score halfway between the hypotheses favours neither
+    double midpoint = (score_from_elo(0) + score_from_elo(10)) / 2;
+    EXPECT_NEAR(midpoint, 0.5072, 0.0001);
+
+    MatchScore better = {600, 1000, 400};
+    MatchScore worse = {400, 1000, 600};
+    double llr = sprt_llr(better, 0, 10);
+    EXPECT_GT(llr, 2.944);
+    EXPECT_LT(sprt_llr(worse, 0, 10), -2.944);
+
+    // Same proportions over twice the games double the LLR
+    MatchScore twice = {1200, 2000, 800};
+    EXPECT_NEAR(sprt_llr(twice, 0, 10), 2 * llr, 1e-9);
+}
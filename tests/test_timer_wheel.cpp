@@ -0,0 +1,65 @@
+#include "timer_wheel.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+static std::vector<uint64_t> fired; // Tick each callback ran at
+static TimerWheel *current_wheel;
+
+static void record_expiry(Timer *timer) {
+    fired.push_back(current_wheel->now);
+    EXPECT_EQ(timer->expires, current_wheel->now);
+}
+
+class TimerWheelTest : public ::testing::Test {
+protected:
+    TimerWheel wheel;
+    void SetUp() override {
+        timer_wheel_init(wheel, 1000);
+        current_wheel = &wheel;
+        fired.clear();
+    }
+};
+
+TEST_F(TimerWheelTest, FiresAtExpiryOnEveryLevel) {
+    // Near, cascaded once, twice and three times
+    uint64_t delays[] = {1, 63, 64, 100, 4095, 4096, 70000, 300000};
+    Timer timers[8] = {};
+    for (int i = 0; i < 8; i++) {
+        timers[i].callback = record_expiry;
+        timer_add(wheel, &timers[i], wheel.now + delays[i]);
+    }
+
+    timer_wheel_advance(wheel, 1000 + 300000);
+    ASSERT_EQ(fired.size(), 8u);
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(fired[i], 1000 + delays[i]);
+        EXPECT_FALSE(timer_pending(&timers[i]));
+    }
+}
+
+TEST_F(TimerWheelTest, CancelAndRearm) {
+    Timer a = {}, b = {};
+    a.callback = b.callback = record_expiry;
+    timer_add(wheel, &a, 1010);
+    timer_add(wheel, &b, 1020);
+    EXPECT_TRUE(timer_pending(&a));
+
+    timer_cancel(&a);
+    timer_cancel(&a); // Cancelling twice is harmless
+    timer_add(wheel, &b, 5000); // Re-arming moves the timer
+
+    timer_wheel_advance(wheel, 4999);
+    EXPECT_TRUE(fired.empty());
+    timer_wheel_advance(wheel, 5000);
+    ASSERT_EQ(fired.size(), 1u);
+    EXPECT_EQ(fired[0], 5000u);
+}
+
+TEST_F(TimerWheelTest, PastExpiryFiresOnNextTick) {
+    Timer timer = {};
+    timer.callback = record_expiry;
+    timer_add(wheel, &timer, 10);
+    timer_wheel_advance(wheel, 1001);
+    ASSERT_EQ(fired.size(), 1u);
+    EXPECT_EQ(fired[0], 1001u);
+}